@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// A token bucket per key, such as a username or a client address: each
+// request takes a token, tokens come back at `rate` a second, and at most
+// `burst` accumulate. Keys are split across independently locked shards.
+// A bucket is created full on first use and dropped once it would be full
+// again, so the tables only hold keys seen within the last burst / rate
+// seconds, however many clients come and go.
+class RateLimiter {
+public:
+    void configure(double rate, double burst) {
+        perMicro = rate / 1e6;
+        capacity = std::max(burst, 1.0);
+        refillMicros = rate > 0 ? (uint64_t)(capacity / perMicro) : 0;
+    }
+
+    bool enabled() const { return perMicro > 0; }
+
+    // Takes a token for `key`. Returns 0 if there was one, otherwise the
+    // number of whole seconds until there will be, for Retry-After.
+    unsigned take(std::string_view key, uint64_t nowMicros) {
+        Shard &shard = shards[std::hash<std::string_view>()(key) % SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (nowMicros - shard.lastSweep > refillMicros) sweep(shard, nowMicros);
+        auto it = shard.buckets.find(std::string(key));
+        if (it == shard.buckets.end()) {
+            it = shard.buckets.emplace(std::string(key), Bucket{capacity, nowMicros}).first;
+        }
+        Bucket &b = it->second;
+        b.tokens = std::min(capacity, b.tokens + (double)(nowMicros - b.updated) * perMicro);
+        b.updated = nowMicros;
+        if (b.tokens >= 1) {
+            b.tokens -= 1;
+            return 0;
+        }
+        return std::max(1u, (unsigned)std::ceil((1 - b.tokens) / perMicro / 1e6));
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (const Shard &shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            total += shard.buckets.size();
+        }
+        return total;
+    }
+
+private:
+    static const size_t SHARDS = 16;
+
+    struct Bucket {
+        double tokens;
+        uint64_t updated;       // microseconds
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, Bucket> buckets;
+        uint64_t lastSweep = 0;
+    };
+
+    void sweep(Shard &shard, uint64_t nowMicros) {
+        for (auto it = shard.buckets.begin(); it != shard.buckets.end();) {
+            const Bucket &b = it->second;
+            if (b.tokens + (double)(nowMicros - b.updated) * perMicro >= capacity) it = shard.buckets.erase(it);
+            else ++it;
+        }
+        shard.lastSweep = nowMicros;
+    }
+
+    double perMicro = 0;
+    double capacity = 1;
+    uint64_t refillMicros = 0;
+    Shard shards[SHARDS];
+};
+
+// Decides whether a request has waited too long to be worth serving, the
+// way CoDel judges a queue. A long wait now and then is a burst the queue
+// is absorbing; a wait that never drops below `target` for a whole
+// `interval` means the queue is standing and only adds latency. While it
+// stands, expensive requests that waited longer than `target` are turned
+// away at once, and cheap ones past four times that, so the requests behind
+// them are served in time. Otherwise only requests that waited past
+// `interval` are. A target of 0 admits everything.
+//
+// One per event loop; not thread-safe.
+class QueueShedder {
+public:
+    QueueShedder(uint64_t targetMicros, uint64_t intervalMicros)
+        : target(targetMicros), interval(std::max(intervalMicros, targetMicros)) {}
+
+    bool admit(uint64_t waitedMicros, uint64_t nowMicros, bool cheap) {
+        if (target == 0) return true;
+        if (nowMicros - intervalStart >= interval) {
+            standing = minWait != UINT64_MAX && minWait > target;
+            minWait = UINT64_MAX;
+            intervalStart = nowMicros;
+        }
+        minWait = std::min(minWait, waitedMicros);
+        uint64_t limit = !standing ? interval : cheap ? std::min(interval, 4 * target) : target;
+        return waitedMicros <= limit;
+    }
+
+    bool overloaded() const { return standing; }
+
+private:
+    uint64_t target;
+    uint64_t interval;
+    uint64_t intervalStart = 0;
+    uint64_t minWait = UINT64_MAX;
+    bool standing = false;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <unordered_set>
+#include <vector>
+
+// Allocator for many small objects of different sizes that are freed one
+// at a time. Sizes are rounded up to 8 bytes; each size class keeps a free
+// list threaded through its returned blocks, and fresh blocks are cut from
+// 64 KiB chunks, so an object costs no allocator header and neighbours
+// share cache lines. Objects above MAX_SMALL come from operator new.
+// Everything is released with the arena. Not thread-safe.
+class Arena {
+public:
+    static const size_t GRANULE = 8;
+    static const size_t MAX_SMALL = 512;
+    static const size_t CHUNK = 64 * 1024;
+
+    Arena() {}
+
+    ~Arena() {
+        for (char* chunk : chunks) ::operator delete(chunk);
+        for (void* block : large) ::operator delete(block);
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size) {
+        size_t rounded = roundUp(size);
+        inUse += rounded;
+        if (rounded > MAX_SMALL) {
+            void* block = ::operator new(rounded);
+            large.insert(block);
+            largeBytes += rounded;
+            return block;
+        }
+        FreeBlock* &head = freeLists[rounded / GRANULE - 1];
+        if (head) {
+            FreeBlock* block = head;
+            head = block->next;
+            return block;
+        }
+        if (chunks.empty() || chunkUsed + rounded > CHUNK) {
+            chunks.push_back((char*)::operator new(CHUNK));
+            chunkUsed = 0;
+        }
+        void* block = chunks.back() + chunkUsed;
+        chunkUsed += rounded;
+        return block;
+    }
+
+    // `size` must be the size the block was allocated with.
+    void release(void* block, size_t size) {
+        size_t rounded = roundUp(size);
+        inUse -= rounded;
+        if (rounded > MAX_SMALL) {
+            large.erase(block);
+            largeBytes -= rounded;
+            ::operator delete(block);
+            return;
+        }
+        FreeBlock* freed = (FreeBlock*)block;
+        freed->next = freeLists[rounded / GRANULE - 1];
+        freeLists[rounded / GRANULE - 1] = freed;
+    }
+
+    size_t bytesInUse() const { return inUse; }
+    size_t bytesReserved() const { return chunks.size() * CHUNK + largeBytes; }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static size_t roundUp(size_t size) {
+        return size == 0 ? GRANULE : (size + GRANULE - 1) / GRANULE * GRANULE;
+    }
+
+    FreeBlock* freeLists[MAX_SMALL / GRANULE] = {};
+    std::vector<char*> chunks;
+    size_t chunkUsed = 0;
+    std::unordered_set<void*> large;
+    size_t largeBytes = 0;
+    size_t inUse = 0;
+};
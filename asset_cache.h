@@ -0,0 +1,251 @@
+#pragma once
+
+#include "http.h"
+#include "rcu.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef TASKBUDDY_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef TASKBUDDY_WITH_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+inline const char* getMimeType(const std::string& path) {
+    if (path.find(".html") != std::string::npos) return "text/html";
+    if (path.find(".css") != std::string::npos) return "text/css";
+    if (path.find(".js") != std::string::npos) return "application/javascript";
+    if (path.find(".json") != std::string::npos) return "application/json";
+    return "text/plain";
+}
+
+// One loaded file with its precompressed variants. Variants are only kept
+// when they are smaller than the original. Immutable once published.
+struct Asset {
+    const char* contentType;
+    std::string tag;    // hash of the original bytes; ETags are derived from it
+    std::shared_ptr<const std::string> identity;
+    std::shared_ptr<const std::string> gzip;
+    std::shared_ptr<const std::string> brotli;
+};
+
+namespace assetimpl {
+
+inline uint64_t hashBytes(const std::string &data) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : data) {
+        h = (h ^ c) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+inline std::shared_ptr<const std::string> gzipCompress(const std::string &data) {
+#ifdef TASKBUDDY_WITH_ZLIB
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // 15 window bits plus 16 selects the gzip wrapper.
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) return nullptr;
+    std::string out(deflateBound(&zs, data.size()), '\0');
+    zs.next_in = (Bytef*)data.data();
+    zs.avail_in = (uInt)data.size();
+    zs.next_out = (Bytef*)&out[0];
+    zs.avail_out = (uInt)out.size();
+    int rc = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    if (rc != Z_STREAM_END) return nullptr;
+    return std::make_shared<const std::string>(std::move(out));
+#else
+    (void)data;
+    return nullptr;
+#endif
+}
+
+inline std::shared_ptr<const std::string> brotliCompress(const std::string &data) {
+#ifdef TASKBUDDY_WITH_BROTLI
+    size_t size = BrotliEncoderMaxCompressedSize(data.size());
+    if (size == 0) return nullptr;
+    std::string out(size, '\0');
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                               data.size(), (const uint8_t*)data.data(), &size, (uint8_t*)&out[0])) {
+        return nullptr;
+    }
+    out.resize(size);
+    return std::make_shared<const std::string>(std::move(out));
+#else
+    (void)data;
+    return nullptr;
+#endif
+}
+
+// True if `coding` is listed in an Accept-Encoding value with a non-zero q.
+inline bool acceptsEncoding(std::string_view header, std::string_view coding) {
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t end = header.find(',', pos);
+        if (end == std::string_view::npos) end = header.size();
+        std::string_view item = header.substr(pos, end - pos);
+        pos = end + 1;
+
+        size_t semi = item.find(';');
+        std::string_view name = item.substr(0, semi);
+        while (!name.empty() && name.front() == ' ') name.remove_prefix(1);
+        while (!name.empty() && name.back() == ' ') name.remove_suffix(1);
+        if (!headerEquals(name.data(), name.size(), coding.data())) continue;
+        if (semi == std::string_view::npos) return true;
+        std::string_view params = item.substr(semi + 1);
+        size_t q = params.find("q=");
+        if (q == std::string_view::npos) return true;
+        return std::strtod(std::string(params.substr(q + 2)).c_str(), nullptr) > 0;
+    }
+    return false;
+}
+
+} // namespace assetimpl
+
+// Static files served from memory. Each file is read, hashed and compressed
+// once at startup and again whenever it changes on disk (Linux, inotify);
+// responses share the cached buffers instead of copying them.
+//
+// Register every file with add() before serving starts; the table itself is
+// fixed afterwards and only the assets behind it are replaced.
+class AssetCache {
+public:
+    explicit AssetCache(std::string directory = ".") : directory(std::move(directory)) {}
+
+    AssetCache(const AssetCache&) = delete;
+    AssetCache& operator=(const AssetCache&) = delete;
+
+    void add(const std::string &file) {
+        std::unique_ptr<Entry> &entry = entries[file];
+        if (!entry) entry.reset(new Entry());
+        reload(file);
+    }
+
+    // Re-reads `file` if it is registered. Returns false for unknown files.
+    bool reload(const std::string &file) {
+        auto it = entries.find(file);
+        if (it == entries.end()) return false;
+
+        Asset* asset = new Asset();
+        asset->contentType = getMimeType(file);
+        std::ifstream in(directory + "/" + file, std::ios::binary);
+        if (in.is_open()) {
+            std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            char tag[17];
+            snprintf(tag, sizeof(tag), "%016llx", (unsigned long long)assetimpl::hashBytes(bytes));
+            asset->tag = tag;
+            std::shared_ptr<const std::string> gz = assetimpl::gzipCompress(bytes);
+            std::shared_ptr<const std::string> br = assetimpl::brotliCompress(bytes);
+            if (gz && gz->size() < bytes.size()) asset->gzip = gz;
+            if (br && br->size() < bytes.size()) asset->brotli = br;
+            asset->identity = std::make_shared<const std::string>(std::move(bytes));
+        }
+        it->second->asset.publish(asset);
+        return true;
+    }
+
+    // Builds the response for a registered file, or 404 if it is not loaded.
+    HttpResponse serve(const std::string &file, const HttpRequest &request) const {
+        HttpResponse response;
+        RcuReadGuard guard;
+        auto it = entries.find(file);
+        const Asset* asset = it == entries.end() ? nullptr : it->second->asset.load();
+        if (!asset || !asset->identity) {
+            response.status = 404;
+            response.body = "File not found: " + file;
+            return response;
+        }
+
+        // Each encoding is a different representation and gets its own
+        // strong ETag.
+        std::shared_ptr<const std::string> body = asset->identity;
+        std::string etag = "\"" + asset->tag;
+        const char* encoding = nullptr;
+        if (asset->brotli && assetimpl::acceptsEncoding(request.acceptEncoding, "br")) {
+            body = asset->brotli;
+            etag += "-br";
+            encoding = "br";
+        } else if (asset->gzip && assetimpl::acceptsEncoding(request.acceptEncoding, "gzip")) {
+            body = asset->gzip;
+            etag += "-gzip";
+            encoding = "gzip";
+        }
+        etag += "\"";
+
+        response.contentType = asset->contentType;
+        // The URLs are not versioned, so clients must revalidate; a matching
+        // ETag makes that a header-only round trip.
+        response.fixedHeaders = "Cache-Control: no-cache\r\nVary: Accept-Encoding\r\n";
+        response.headers = takeResponseBuffer();
+        response.headers += "ETag: ";
+        response.headers += etag;
+        response.headers += "\r\n";
+        if (!request.ifNoneMatch.empty() && etagMatches(request.ifNoneMatch, etag)) {
+            response.status = 304;
+            return response;
+        }
+        if (encoding) {
+            response.headers += "Content-Encoding: ";
+            response.headers += encoding;
+            response.headers += "\r\n";
+        }
+        response.sharedBody = body;
+        return response;
+    }
+
+    // Starts a background thread that reloads registered files when they
+    // are written or replaced. Editors often save by renaming a new file
+    // over the old one, so the directory is watched rather than the files.
+    // Does nothing outside Linux.
+    void watch() {
+#ifdef __linux__
+        int fd = inotify_init1(IN_CLOEXEC);
+        if (fd < 0) return;
+        if (inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            close(fd);
+            return;
+        }
+        std::thread([this, fd]() {
+            alignas(inotify_event) char buffer[16 * 1024];
+            while (true) {
+                ssize_t n = read(fd, buffer, sizeof(buffer));
+                if (n <= 0) {
+                    if (n < 0 && errno == EINTR) continue;
+                    break;
+                }
+                for (char* p = buffer; p < buffer + n;) {
+                    const inotify_event* event = (const inotify_event*)p;
+                    if (event->len > 0) reload(event->name);
+                    p += sizeof(inotify_event) + event->len;
+                }
+            }
+            close(fd);
+        }).detach();
+#endif
+    }
+
+private:
+    struct Entry {
+        RcuPtr<Asset> asset;
+    };
+
+    std::string directory;
+    std::unordered_map<std::string, std::unique_ptr<Entry>> entries;
+};
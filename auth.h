@@ -0,0 +1,139 @@
+#pragma once
+
+#include "crypto.h"
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// scrypt cost for new password hashes. N = 2^14, r = 8 takes 16 MiB and
+// tens of milliseconds per hash, which is why hashing runs on a worker pool.
+struct ScryptParams {
+    int logN = 14;
+    uint32_t r = 8;
+    uint32_t p = 1;
+};
+
+namespace authimpl {
+
+const char SCRYPT_PREFIX[] = "$scrypt$";
+const size_t SALT_BYTES = 16;
+const size_t HASH_BYTES = 32;
+
+template <typename T>
+bool parseNumber(std::string_view &text, const char* name, char terminator, T &out) {
+    size_t nameLen = strlen(name);
+    if (text.substr(0, nameLen) != name) return false;
+    text.remove_prefix(nameLen);
+    std::from_chars_result r = std::from_chars(text.data(), text.data() + text.size(), out);
+    if (r.ec != std::errc() || r.ptr == text.data() + text.size() || *r.ptr != terminator) return false;
+    text.remove_prefix(r.ptr - text.data() + 1);
+    return true;
+}
+
+// Splits "$scrypt$ln=N,r=R,p=P$<salt>$<hash>" into its parts.
+inline bool parseScryptHash(std::string_view encoded, ScryptParams &params, std::string &salt, std::string &hash) {
+    std::string_view rest = encoded;
+    if (rest.substr(0, sizeof(SCRYPT_PREFIX) - 1) != SCRYPT_PREFIX) return false;
+    rest.remove_prefix(sizeof(SCRYPT_PREFIX) - 1);
+    if (!parseNumber(rest, "ln=", ',', params.logN) || !parseNumber(rest, "r=", ',', params.r) ||
+        !parseNumber(rest, "p=", '$', params.p)) {
+        return false;
+    }
+    if (params.logN < 1 || params.logN > 24 || params.r == 0 || params.r > 64 || params.p == 0 || params.p > 16) {
+        return false;
+    }
+    size_t dollar = rest.find('$');
+    if (dollar == std::string_view::npos) return false;
+    return base64UrlDecode(rest.substr(0, dollar), salt) && base64UrlDecode(rest.substr(dollar + 1), hash) &&
+           !hash.empty();
+}
+
+} // namespace authimpl
+
+// Encodes as "$scrypt$ln=14,r=8,p=1$<salt>$<hash>", so the cost travels with
+// the hash and can be raised later without invalidating stored passwords.
+inline std::string hashPassword(std::string_view password, const ScryptParams &params = ScryptParams()) {
+    std::string salt = randomBytes(authimpl::SALT_BYTES);
+    uint8_t hash[authimpl::HASH_BYTES];
+    scrypt(password, salt, params.logN, params.r, params.p, hash, sizeof(hash));
+    return std::string(authimpl::SCRYPT_PREFIX) + "ln=" + std::to_string(params.logN) + ",r=" +
+           std::to_string(params.r) + ",p=" + std::to_string(params.p) + "$" + base64UrlEncode(salt) + "$" +
+           base64UrlEncode(std::string_view((const char*)hash, sizeof(hash)));
+}
+
+enum class PasswordCheck { Mismatch, Match, MatchNeedsRehash };
+
+// Checks `password` against a stored hash. Entries written before passwords
+// were hashed hold the plaintext; they still match, and MatchNeedsRehash
+// tells the caller to replace them, as it does for hashes made with
+// cheaper parameters than `current`.
+inline PasswordCheck verifyPassword(std::string_view password, std::string_view stored,
+                                    const ScryptParams &current = ScryptParams()) {
+    if (stored.substr(0, sizeof(authimpl::SCRYPT_PREFIX) - 1) != authimpl::SCRYPT_PREFIX) {
+        return constantTimeEquals(password, stored) ? PasswordCheck::MatchNeedsRehash : PasswordCheck::Mismatch;
+    }
+    ScryptParams params;
+    std::string salt, expected;
+    if (!authimpl::parseScryptHash(stored, params, salt, expected)) return PasswordCheck::Mismatch;
+    std::string actual(expected.size(), '\0');
+    scrypt(password, salt, params.logN, params.r, params.p, (uint8_t*)&actual[0], actual.size());
+    if (!constantTimeEquals(actual, expected)) return PasswordCheck::Mismatch;
+    bool weaker = params.logN < current.logN || params.r < current.r || params.p < current.p;
+    return weaker ? PasswordCheck::MatchNeedsRehash : PasswordCheck::Match;
+}
+
+// Stateless session tokens: "<username>.<expiry>.<mac>", where the username
+// and MAC are base64url and the expiry is in Unix seconds. Checking one is a
+// single HMAC over the token, with no lookup, so it costs the same however
+// many users or sessions exist. Tokens stay valid until they expire or the
+// key changes.
+class SessionTokens {
+public:
+    static const int64_t DEFAULT_LIFETIME = 7 * 24 * 3600;
+
+    explicit SessionTokens(std::string key = randomBytes(32), int64_t lifetimeSeconds = DEFAULT_LIFETIME)
+        : keyed(key.data(), key.size()), lifetime(lifetimeSeconds) {}
+
+    int64_t lifetimeSeconds() const { return lifetime; }
+
+    std::string issue(std::string_view username, int64_t now) const {
+        std::string token = base64UrlEncode(username);
+        token += '.';
+        token += std::to_string(now + lifetime);
+        std::string mac = sign(token);
+        token += '.';
+        token += base64UrlEncode(mac);
+        return token;
+    }
+
+    bool verify(std::string_view token, std::string &username, int64_t now) const {
+        size_t macDot = token.rfind('.');
+        if (macDot == std::string_view::npos) return false;
+        std::string_view signedPart = token.substr(0, macDot);
+        std::string mac;
+        if (!base64UrlDecode(token.substr(macDot + 1), mac) || !constantTimeEquals(mac, sign(signedPart))) {
+            return false;
+        }
+        size_t dot = signedPart.find('.');
+        if (dot == std::string_view::npos) return false;
+        int64_t expiry = 0;
+        std::string_view expiryText = signedPart.substr(dot + 1);
+        std::from_chars_result r = std::from_chars(expiryText.data(), expiryText.data() + expiryText.size(), expiry);
+        if (r.ec != std::errc() || r.ptr != expiryText.data() + expiryText.size() || expiry <= now) return false;
+        return base64UrlDecode(signedPart.substr(0, dot), username) && !username.empty();
+    }
+
+private:
+    std::string sign(std::string_view data) const {
+        HmacSha256 hmac = keyed;
+        hmac.update(data.data(), data.size());
+        uint8_t mac[Sha256::DIGEST_SIZE];
+        hmac.finish(mac);
+        return std::string((const char*)mac, sizeof(mac));
+    }
+
+    HmacSha256 keyed;           // key pads already absorbed; copied per token
+    int64_t lifetime;
+};
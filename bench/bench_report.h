@@ -0,0 +1,102 @@
+#pragma once
+
+// Machine-readable results for store_bench and load_gen: one JSON object per
+// line, {"bench": NAME, METRIC: NUMBER, ...}. Files from two runs can be
+// diffed as they are, or compared with --baseline, which prints the change
+// of every metric the two runs share.
+
+#include "json.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+class BenchReport {
+public:
+    struct Row {
+        std::string name;
+        std::vector<std::pair<std::string, double>> metrics;
+
+        Row &set(const std::string &metric, double value) {
+            metrics.emplace_back(metric, value);
+            return *this;
+        }
+    };
+
+    Row &add(const std::string &name) {
+        rows.push_back(Row{name, {}});
+        return rows.back();
+    }
+
+    const std::vector<Row> &results() const { return rows; }
+
+    void write(FILE* out) const {
+        for (const Row &row : rows) {
+            std::string line = "{\"bench\":\"";
+            appendJsonEscaped(line, row.name);
+            line += "\"";
+            for (const auto &m : row.metrics) {
+                line += ",\"";
+                appendJsonEscaped(line, m.first);
+                line += "\":";
+                char number[32];
+                snprintf(number, sizeof(number), "%.6g", std::isfinite(m.second) ? m.second : 0.0);
+                line += number;
+            }
+            line += "}\n";
+            fputs(line.c_str(), out);
+        }
+        fflush(out);
+    }
+
+    bool writeFile(const std::string &path) const {
+        FILE* f = fopen(path.c_str(), "w");
+        if (!f) return false;
+        write(f);
+        return fclose(f) == 0;
+    }
+
+    static bool readFile(const std::string &path, BenchReport &report) {
+        std::ifstream file(path);
+        if (!file.is_open()) return false;
+        std::string line;
+        JsonDocument doc;
+        while (std::getline(file, line)) {
+            if (line.empty() || !doc.parse(line) || !doc.root().isObject()) continue;
+            Row &row = report.add(doc.root()["bench"].string());
+            for (JsonValue v = doc.root().first(); v.valid(); v = v.next()) {
+                if (v.type() != JsonType::Number) continue;
+                row.set(std::string(v.rawKey()), strtod(std::string(v.raw()).c_str(), nullptr));
+            }
+        }
+        return true;
+    }
+
+    // Prints "bench metric: baseline -> current (+x.x%)" for every metric in
+    // both reports.
+    void compare(const BenchReport &baseline, FILE* out) const {
+        for (const Row &row : rows) {
+            const Row* old = nullptr;
+            for (const Row &candidate : baseline.rows) {
+                if (candidate.name == row.name) old = &candidate;
+            }
+            if (!old) continue;
+            for (const auto &m : row.metrics) {
+                for (const auto &before : old->metrics) {
+                    if (before.first != m.first) continue;
+                    double change = before.second != 0 ? (m.second - before.second) / before.second * 100 : 0;
+                    fprintf(out, "%-28s %-16s %14.6g -> %-14.6g (%+.1f%%)\n", row.name.c_str(), m.first.c_str(),
+                            before.second, m.second, change);
+                }
+            }
+        }
+    }
+
+private:
+    std::vector<Row> rows;
+};
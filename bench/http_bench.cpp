@@ -0,0 +1,214 @@
+// Compares the resumable RequestParser with the framer it replaced, on
+// pipelined requests parsed from one buffer and on requests that arrive in
+// small reads, where the old framer rescanned from the start every time.
+// Also times route lookup: the if-chain the server used to compare each
+// path against, and Router's table.
+//
+//   g++ -std=c++17 -O2 -I.. http_bench.cpp -o http_bench
+
+#include "http.h"
+#include "router.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+// The request framer from before RequestParser, kept as the baseline.
+struct LegacyRequest {
+    std::string method, path, body, acceptEncoding, ifNoneMatch;
+    bool keepAlive = true;
+};
+
+bool legacyParse(const char* data, size_t len, LegacyRequest &request, size_t &consumed) {
+    const char* end = data + len;
+    const char* headEnd = nullptr;
+    for (const char* p = data; p + 3 < end; p++) {
+        if (p[0] == '\r' && p[1] == '\n' && p[2] == '\r' && p[3] == '\n') {
+            headEnd = p;
+            break;
+        }
+    }
+    if (!headEnd) return false;
+
+    const char* lineEnd = (const char*)memchr(data, '\r', headEnd - data + 1);
+    const char* methodEnd = (const char*)memchr(data, ' ', lineEnd - data);
+    const char* pathEnd = (const char*)memchr(methodEnd + 1, ' ', lineEnd - methodEnd - 1);
+    request.method.assign(data, methodEnd);
+    request.path.assign(methodEnd + 1, pathEnd);
+    std::string version(pathEnd + 1, lineEnd);
+    request.keepAlive = (version == "HTTP/1.1");
+
+    size_t contentLength = 0;
+    const char* line = lineEnd + 2;
+    while (line < headEnd + 2) {
+        const char* next = (const char*)memchr(line, '\r', headEnd + 2 - line);
+        if (!next) next = headEnd;
+        const char* colon = (const char*)memchr(line, ':', next - line);
+        if (colon) {
+            const char* value = colon + 1;
+            while (value < next && (*value == ' ' || *value == '\t')) value++;
+            const char* valueEnd = next;
+            if (headerEquals(line, colon - line, "content-length")) {
+                std::string digits(value, valueEnd);
+                contentLength = (size_t)strtoull(digits.c_str(), nullptr, 10);
+            } else if (headerEquals(line, colon - line, "accept-encoding")) {
+                request.acceptEncoding.assign(value, valueEnd);
+            } else if (headerEquals(line, colon - line, "if-none-match")) {
+                request.ifNoneMatch.assign(value, valueEnd);
+            }
+        }
+        line = next + 2;
+    }
+
+    size_t headLength = (headEnd - data) + 4;
+    if (len - headLength < contentLength) return false;
+    request.body.assign(data + headLength, contentLength);
+    consumed = headLength + contentLength;
+    return true;
+}
+
+const char* GET_REQUEST =
+    "GET /schedule?user=alice&since=1879250643714050 HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko)\r\n"
+    "Accept: */*\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "If-None-Match: \"1879250643714050\"\r\n"
+    "Connection: keep-alive\r\n\r\n";
+
+std::string postRequest(size_t bodyBytes) {
+    std::string body = "{\"username\":\"alice\",\"ops\":[";
+    while (body.size() < bodyBytes) body += "{\"op\":\"toggle\",\"id\":1700000000123},";
+    body.back() = ']';
+    body += '}';
+    return "POST /batch HTTP/1.1\r\nHost: 127.0.0.1:8080\r\nContent-Type: application/json\r\n"
+           "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+template <typename F>
+void report(const char* name, size_t bytes, size_t requests, F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (bytes == 0) printf("%-46s %15s %10.0f requests/s\n", name, "", requests / seconds);
+    else printf("%-46s %9.1f MB/s %10.0f requests/s\n", name, bytes / seconds / 1e6, requests / seconds);
+}
+
+// Parses `input` as it would arrive in reads of `chunk` bytes.
+template <typename Parse>
+size_t parseInChunks(const std::string &input, size_t chunk, Parse parse) {
+    std::string buffer;
+    size_t requests = 0;
+    for (size_t fed = 0; fed < input.size(); fed += chunk) {
+        buffer.append(input, fed, chunk);
+        size_t offset = 0;
+        size_t consumed = 0;
+        while (parse(&buffer[offset], buffer.size() - offset, consumed)) {
+            offset += consumed;
+            requests++;
+        }
+        buffer.erase(0, offset);
+    }
+    return requests;
+}
+
+// The comparisons handleRequest made, in its order, for the route index.
+int ifChainRoute(std::string_view method, std::string_view path) {
+    if (method == "GET") {
+        if (path == "/" || path == "/index.html") return 0;
+        else if (path == "/login.html") return 1;
+        else if (path == "/signup.html") return 2;
+        else if (path == "/style.css") return 3;
+        else if (path == "/script.js") return 4;
+        else if (path == "/metrics") return 5;
+        else if (path == "/events") return 6;
+        else if (path == "/overdue" || path == "/due_soon") return 7;
+        else if (path == "/schedule") return 8;
+    }
+    if (method == "POST" && path == "/add_task") return 9;
+    if (method == "POST" && path == "/toggle_complete") return 10;
+    if (method == "POST" && path == "/delete_task") return 11;
+    if (method == "POST" && path == "/batch") return 12;
+    if (method == "POST" && path == "/register") return 13;
+    if (method == "POST" && path == "/login") return 14;
+    if (method == "OPTIONS") return 15;
+    return -1;
+}
+
+struct NoContext {};
+
+HttpResponse noHandler(NoContext &) {
+    return HttpResponse();
+}
+
+HttpResponse noRoute(NoContext &, const char*) {
+    return HttpResponse();
+}
+
+} // namespace
+
+int main() {
+    std::string gets;
+    const int GETS = 200000;
+    for (int i = 0; i < GETS; i++) gets += GET_REQUEST;
+    std::string post = postRequest(256 * 1024);
+    std::string posts;
+    const int POSTS = 40;
+    for (int i = 0; i < POSTS; i++) posts += post;
+    volatile size_t sink = 0;
+
+    LegacyRequest legacy;
+    auto legacyStep = [&](char* data, size_t len, size_t &consumed) {
+        if (!legacyParse(data, len, legacy, consumed)) return false;
+        sink += legacy.path.size() + legacy.body.size();
+        return true;
+    };
+    RequestParser parser;
+    HttpRequest request;
+    auto parserStep = [&](char* data, size_t len, size_t &consumed) {
+        if (parser.parse(data, len, request, consumed) != ParseResult::Complete) return false;
+        sink += request.path.size() + request.body.size();
+        return true;
+    };
+
+    report("pipelined GETs, legacy", gets.size(), GETS, [&]() { parseInChunks(gets, gets.size(), legacyStep); });
+    report("pipelined GETs, RequestParser", gets.size(), GETS, [&]() { parseInChunks(gets, gets.size(), parserStep); });
+    report("GETs in 64-byte reads, legacy", gets.size(), GETS, [&]() { parseInChunks(gets, 64, legacyStep); });
+    report("GETs in 64-byte reads, RequestParser", gets.size(), GETS, [&]() { parseInChunks(gets, 64, parserStep); });
+    report("256 KiB POSTs in 16 KiB reads, legacy", posts.size(), POSTS, [&]() { parseInChunks(posts, 16384, legacyStep); });
+    report("256 KiB POSTs in 16 KiB reads, RequestParser", posts.size(), POSTS, [&]() { parseInChunks(posts, 16384, parserStep); });
+
+    // Mostly /schedule, as in the load generator's default mix.
+    std::vector<std::pair<std::string, std::string>> routes = {
+        {"GET", "/schedule"}, {"GET", "/schedule"}, {"GET", "/schedule"}, {"GET", "/schedule"},
+        {"GET", "/schedule"}, {"GET", "/schedule"}, {"GET", "/schedule"}, {"POST", "/add_task"},
+        {"POST", "/toggle_complete"}, {"GET", "/script.js"}, {"POST", "/login"}, {"GET", "/nowhere"}};
+    Router<NoContext> router(noRoute);
+    for (const char* path : {"/", "/index.html", "/login.html", "/signup.html", "/style.css", "/script.js",
+                             "/metrics", "/events", "/overdue", "/due_soon", "/schedule"}) {
+        router.add(HttpMethod::Get, path, noHandler, 0);
+    }
+    for (const char* path : {"/add_task", "/toggle_complete", "/delete_task", "/batch", "/register", "/login"}) {
+        router.add(HttpMethod::Post, path, noHandler, 0);
+    }
+    router.freeze();
+    const int LOOKUPS = 20000000;
+    report("route lookups, if-chain", 0, LOOKUPS, [&]() {
+        for (int i = 0; i < LOOKUPS; i++) {
+            const auto &r = routes[i % routes.size()];
+            sink += (size_t)ifChainRoute(r.first, r.second);
+        }
+    });
+    report("route lookups, Router", 0, LOOKUPS, [&]() {
+        const char* allow;
+        for (int i = 0; i < LOOKUPS; i++) {
+            const auto &r = routes[i % routes.size()];
+            sink += (size_t)router.find(r.first, r.second, allow);
+        }
+    });
+    return sink == 42 ? 1 : 0;
+}
@@ -0,0 +1,131 @@
+// Compares the structural-index JSON parser with the find()-based parsers
+// it replaced, on request-sized bodies and on a large tasks.json.
+//
+//   g++ -std=c++17 -O2 -march=native -I.. json_bench.cpp -o json_bench
+
+#include "json.h"
+#include "task_json.h"
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+namespace {
+
+// The request-body parser from before json.h, kept as the baseline.
+std::map<std::string, std::string> legacyParseJson(const std::string &json) {
+    std::map<std::string, std::string> result;
+    size_t pos = 0;
+    while ((pos = json.find("\"", pos)) != std::string::npos) {
+        size_t keyStart = pos + 1;
+        size_t keyEnd = json.find("\"", keyStart);
+        std::string key = json.substr(keyStart, keyEnd - keyStart);
+        size_t valueStart = json.find(":", keyEnd) + 1;
+        while (valueStart < json.length() && (json[valueStart] == ' ' || json[valueStart] == '\n')) valueStart++;
+        std::string value;
+        if (valueStart < json.length() && json[valueStart] == '\"') {
+            valueStart++;
+            size_t valueEnd = json.find("\"", valueStart);
+            value = json.substr(valueStart, valueEnd - valueStart);
+            pos = valueEnd + 1;
+        } else {
+            size_t valueEnd = json.find_first_of(",}\n\r\t", valueStart);
+            value = json.substr(valueStart, valueEnd - valueStart);
+            pos = valueEnd;
+        }
+        result[key] = value;
+    }
+    return result;
+}
+
+struct Timing {
+    double seconds;
+    unsigned long long cycles;
+};
+
+template <typename F>
+Timing measure(F f) {
+    auto start = std::chrono::steady_clock::now();
+#ifdef HAVE_RDTSC
+    unsigned long long c0 = __rdtsc();
+#endif
+    f();
+#ifdef HAVE_RDTSC
+    unsigned long long cycles = __rdtsc() - c0;
+#else
+    unsigned long long cycles = 0;
+#endif
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return Timing{seconds, cycles};
+}
+
+void report(const char* name, size_t bytes, Timing t) {
+    printf("%-28s %9.1f MB/s", name, bytes / t.seconds / 1e6);
+    if (t.cycles) printf("  %6.3f bytes/cycle", (double)bytes / t.cycles);
+    printf("\n");
+}
+
+std::string makeTasksFile(int count) {
+    std::vector<Task> tasks;
+    for (int i = 0; i < count; i++) {
+        Task t;
+        t.id = 1700000000000LL + i;
+        t.name = "Write the quarterly report, part " + std::to_string(i);
+        t.category = i % 3 ? "Work" : "Personal";
+        t.priority = i % 2 ? "High" : "Low";
+        t.deadline = "2026-03-14";
+        t.completed = i % 5 == 0;
+        t.username = "user" + std::to_string(i % 100);
+        tasks.push_back(t);
+    }
+    std::ostringstream out;
+    writeTasksJson(out, tasks);
+    return out.str();
+}
+
+} // namespace
+
+int main() {
+    const std::string body =
+        "{\"id\":1700000000123,\"name\":\"Buy groceries for the week\",\"category\":\"Personal\","
+        "\"priority\":\"Medium\",\"deadline\":\"2026-03-14\",\"username\":\"alice\"}";
+    const int ITERATIONS = 200000;
+    size_t bodyBytes = body.size() * (size_t)ITERATIONS;
+    volatile size_t sink = 0;
+
+    report("request body, legacy", bodyBytes, measure([&]() {
+        for (int i = 0; i < ITERATIONS; i++) sink += legacyParseJson(body).size();
+    }));
+    JsonDocument doc;
+    report("request body, json.h", bodyBytes, measure([&]() {
+        std::string scratch;
+        std::string_view name;
+        for (int i = 0; i < ITERATIONS; i++) {
+            doc.parse(body);
+            long long id = 0;
+            doc.root()["id"].getInt64(id);
+            doc.root()["name"].getString(name, scratch);
+            sink += (size_t)id + name.size();
+        }
+    }));
+
+    std::string file = makeTasksFile(200000);
+    std::vector<Task> tasks;
+    std::string error;
+    report("tasks.json 200k, json.h", file.size(), measure([&]() {
+        parseTasksJson(file, tasks, error);
+    }));
+    report("tasks.json 200k, parse only", file.size(), measure([&]() {
+        doc.parse(file);
+    }));
+    printf("%zu structurals, %zu tasks\n", doc.structuralCount(), tasks.size());
+    return sink == 42 ? 1 : 0;
+}
@@ -0,0 +1,594 @@
+// HTTP load generator for a running server. It registers and logs in a set
+// of users, then replays a weighted mix of /schedule, /add_task,
+// /toggle_complete, /login and static asset requests over keep-alive
+// connections, one thread per connection.
+//
+// Closed loop (the default) sends each connection's next request as soon as
+// the previous answer arrives, which finds peak throughput. Open loop
+// (--rate R) sends R requests per second in total on a fixed schedule and
+// measures latency from when each request was due rather than when it went
+// out, so a stalled server is charged for the requests queued behind the
+// stall instead of hiding them.
+//
+//   g++ -std=c++17 -O2 -pthread -I.. load_gen.cpp -o load_gen
+//   ./load_gen --port 8080 --connections 32 --duration 10 [--rate 5000]
+//              [--mix schedule=70,add=8,toggle=8,login=4,static=10]
+//              [--users 16] [--out results.json] [--baseline old.json]
+//
+// Results are JSON lines (see bench_report.h): throughput, non-2xx answers,
+// 503 and 429 rejections and p50/p99/p999 latency overall and per request kind.
+//
+// --subscribers N also holds N /events streams open across the users for
+// the whole run, drained by one thread, and reports how many events they
+// received and how many the server dropped. Past about 28k subscribers the
+// client runs out of ephemeral ports unless ip_local_port_range is widened.
+
+#include "bench_report.h"
+#include "json.h"
+#include "metrics.h"
+#include "platform.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+namespace {
+
+enum Kind { SCHEDULE, ADD, TOGGLE, LOGIN, STATIC, KINDS };
+const char* KIND_NAMES[KINDS] = {"schedule", "add", "toggle", "login", "static"};
+const char* ASSETS[] = {"/index.html", "/style.css", "/script.js", "/login.html", "/signup.html"};
+const char* PASSWORD = "load-generator";
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    unsigned connections = 32;
+    double duration = 10;
+    double warmup = 2;
+    double rate = 0;
+    unsigned users = 16;
+    unsigned seedTasks = 50;
+    unsigned subscribers = 0;
+    unsigned mix[KINDS] = {70, 8, 8, 4, 10};
+    std::string out, baseline;
+};
+
+struct User {
+    std::string name;
+    std::string token;
+    std::vector<long long> taskIds;
+};
+
+struct Random {
+    uint64_t state;
+    explicit Random(uint64_t seed) : state(seed * 0x9e3779b97f4a7c15ULL + 1) {}
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+};
+
+// Microsecond timestamps, bumped so no two tasks from this run or a later
+// one share an id.
+long long nextTaskId() {
+    static std::atomic<long long> last{0};
+    long long now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    long long previous = last.load();
+    while (!last.compare_exchange_weak(previous, std::max(now, previous + 1))) {}
+    return std::max(now, previous + 1);
+}
+
+// One keep-alive connection, reconnecting when the server closes it. Reads
+// responses framed by Content-Length; 204 and 304 have no body.
+class Client {
+public:
+    Client(const Options &options) : options(options) {}
+    ~Client() { disconnect(); }
+
+    // Returns the status, or -1 when the connection failed.
+    int send(const std::string &request, std::string &body, std::string* etag = nullptr) {
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if (s == INVALID_SOCKET_HANDLE) {
+                s = connectToServer(options.host.c_str(), options.port);
+                if (s == INVALID_SOCKET_HANDLE) return -1;
+                buffer.clear();
+            }
+            if (!sendAll(request)) {
+                disconnect();
+                continue;
+            }
+            int status = readResponse(body, etag);
+            if (status < 0) {
+                disconnect();
+                continue;
+            }
+            return status;
+        }
+        return -1;
+    }
+
+private:
+    bool sendAll(const std::string &data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_type n = sendSome(s, data.data() + sent, data.size() - sent);
+            if (n <= 0) {
+                if (n < 0 && isInterrupted(lastSocketError())) continue;
+                return false;
+            }
+            sent += (size_t)n;
+        }
+        return true;
+    }
+
+    bool fill() {
+        char chunk[16384];
+        ssize_type n = recvSome(s, chunk, sizeof(chunk));
+        if (n < 0 && isInterrupted(lastSocketError())) return true;
+        if (n <= 0) return false;
+        buffer.append(chunk, (size_t)n);
+        return true;
+    }
+
+    static std::string header(const std::string &head, const char* name) {
+        size_t nameLength = strlen(name);
+        for (size_t pos = head.find("\r\n"); pos != std::string::npos; pos = head.find("\r\n", pos + 2)) {
+            size_t line = pos + 2;
+            if (head.size() < line + nameLength + 1 || head[line + nameLength] != ':') continue;
+            bool match = true;
+            for (size_t i = 0; i < nameLength && match; i++) {
+                match = tolower((unsigned char)head[line + i]) == name[i];
+            }
+            if (!match) continue;
+            size_t start = line + nameLength + 1;
+            while (start < head.size() && head[start] == ' ') start++;
+            return head.substr(start, head.find("\r\n", start) - start);
+        }
+        return "";
+    }
+
+    int readResponse(std::string &body, std::string* etag) {
+        size_t headEnd;
+        while ((headEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill()) return -1;
+        }
+        std::string head = buffer.substr(0, headEnd);
+        if (head.compare(0, 5, "HTTP/") != 0 || head.size() < 12) return -1;
+        int status = atoi(head.c_str() + 9);
+        size_t length = 0;
+        if (status != 204 && status != 304) length = (size_t)strtoull(header(head, "content-length").c_str(), nullptr, 10);
+        size_t total = headEnd + 4 + length;
+        while (buffer.size() < total) {
+            if (!fill()) return -1;
+        }
+        body.assign(buffer, headEnd + 4, length);
+        buffer.erase(0, total);
+        if (etag) {
+            std::string tag = header(head, "etag");
+            if (!tag.empty()) *etag = tag;
+        }
+        if (header(head, "connection") == "close") disconnect();
+        return status;
+    }
+
+    void disconnect() {
+        if (s != INVALID_SOCKET_HANDLE) closeSocket(s);
+        s = INVALID_SOCKET_HANDLE;
+    }
+
+    const Options &options;
+    socket_t s = INVALID_SOCKET_HANDLE;
+    std::string buffer;
+};
+
+std::string post(const Options &options, const char* path, const std::string &token, const std::string &json) {
+    std::string request = "POST ";
+    request += path;
+    request += " HTTP/1.1\r\nHost: " + options.host + "\r\nContent-Type: application/json\r\n";
+    if (!token.empty()) request += "Authorization: Bearer " + token + "\r\n";
+    request += "Content-Length: " + std::to_string(json.size()) + "\r\n\r\n" + json;
+    return request;
+}
+
+std::string get(const Options &options, const char* path, const std::string &token, const std::string &etag = "") {
+    std::string request = "GET ";
+    request += path;
+    request += " HTTP/1.1\r\nHost: " + options.host + "\r\nAccept-Encoding: gzip, br\r\n";
+    if (!token.empty()) request += "Authorization: Bearer " + token + "\r\n";
+    if (!etag.empty()) request += "If-None-Match: " + etag + "\r\n";
+    request += "\r\n";
+    return request;
+}
+
+std::string credentials(const User &user) {
+    std::string json = "{\"username\":\"";
+    appendJsonEscaped(json, user.name);
+    json += "\",\"password\":\"";
+    json += PASSWORD;
+    json += "\"}";
+    return json;
+}
+
+std::string newTask(long long id, uint64_t n) {
+    static const char* categories[] = {"Work", "Personal", "Study"};
+    static const char* priorities[] = {"High", "Medium", "Low"};
+    return "{\"id\":" + std::to_string(id) + ",\"name\":\"Load task " + std::to_string(n) +
+           "\",\"category\":\"" + categories[n % 3] + "\",\"priority\":\"" + priorities[n % 3] +
+           "\",\"deadline\":\"2026-0" + std::to_string(n % 9 + 1) + "-15\"}";
+}
+
+// Sends until the server answers with something other than 503 or 429,
+// since hashing passwords for many users at once overflows its queue.
+int sendRetrying(Client &client, const std::string &request, std::string &body) {
+    for (int attempt = 0;; attempt++) {
+        int status = client.send(request, body);
+        if ((status != 503 && status != 429) || attempt == 50) return status;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+bool setUp(const Options &options, std::vector<User> &users) {
+    std::vector<std::thread> threads;
+    std::atomic<bool> failed{false};
+    for (unsigned t = 0; t < 4; t++) {
+        threads.emplace_back([&, t]() {
+            Client client(options);
+            std::string body;
+            for (size_t i = t; i < users.size() && !failed; i += 4) {
+                User &user = users[i];
+                int status = sendRetrying(client, post(options, "/register", "", credentials(user)), body);
+                if (status != 200 && body.find("already exists") == std::string::npos) {
+                    fprintf(stderr, "register %s: %d %s\n", user.name.c_str(), status, body.c_str());
+                    failed = true;
+                    return;
+                }
+                status = sendRetrying(client, post(options, "/login", "", credentials(user)), body);
+                JsonDocument doc;
+                if (status != 200 || !doc.parse(body) || !doc.root()["token"].isString()) {
+                    fprintf(stderr, "login %s: %d %s\n", user.name.c_str(), status, body.c_str());
+                    failed = true;
+                    return;
+                }
+                user.token = doc.root()["token"].string();
+                for (unsigned n = 0; n < options.seedTasks; n++) {
+                    long long id = nextTaskId();
+                    if (client.send(post(options, "/add_task", user.token, newTask(id, n)), body) == 200) {
+                        user.taskIds.push_back(id);
+                    }
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads) thread.join();
+    return !failed;
+}
+
+struct Counts {
+    LatencyHistogram latency[KINDS];
+    uint64_t requests[KINDS] = {};
+    uint64_t errors[KINDS] = {};
+    uint64_t rejected[KINDS] = {};
+};
+
+void runConnection(const Options &options, unsigned index, const std::vector<User> &users,
+                   std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point measureFrom,
+                   std::chrono::steady_clock::time_point end, Counts &counts) {
+    using Clock = std::chrono::steady_clock;
+    Client client(options);
+    Random random(index + 1);
+    const User &user = users[index % users.size()];
+    std::vector<long long> ownIds;
+    std::string etags[sizeof(ASSETS) / sizeof(ASSETS[0])];
+    uint64_t assetFetches = 0;
+    unsigned weightTotal = 0;
+    for (unsigned w : options.mix) weightTotal += w;
+
+    // Open loop: this connection's share of the rate, phase-shifted so the
+    // connections do not fire together.
+    Clock::duration interval = Clock::duration::zero();
+    Clock::time_point due = start;
+    if (options.rate > 0) {
+        interval = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(options.connections / options.rate));
+        due += interval * index / options.connections;
+    }
+
+    std::string body;
+    uint64_t n = 0;
+    while (true) {
+        if (options.rate > 0) {
+            if (due >= end) break;
+            std::this_thread::sleep_until(due);
+        }
+        Clock::time_point sent = Clock::now();
+        if (sent >= end) break;
+
+        unsigned pick = (unsigned)(random.next() % weightTotal);
+        int kind = 0;
+        while (pick >= options.mix[kind]) pick -= options.mix[kind++];
+
+        int status;
+        switch (kind) {
+        case SCHEDULE:
+            status = client.send(get(options, "/schedule", user.token), body);
+            break;
+        case ADD: {
+            long long id = nextTaskId();
+            status = client.send(post(options, "/add_task", user.token, newTask(id, n)), body);
+            if (status == 200) ownIds.push_back(id);
+            break;
+        }
+        case TOGGLE: {
+            const std::vector<long long> &ids = !ownIds.empty() && random.next() % 2 ? ownIds : user.taskIds;
+            long long id = ids.empty() ? 0 : ids[random.next() % ids.size()];
+            status = client.send(post(options, "/toggle_complete", user.token, "{\"id\":" + std::to_string(id) + "}"), body);
+            break;
+        }
+        case LOGIN:
+            status = client.send(post(options, "/login", "", credentials(user)), body);
+            break;
+        default: {
+            // Browsers revalidate what they cached; every other fetch is
+            // conditional once an ETag is known.
+            size_t asset = (size_t)(random.next() % (sizeof(ASSETS) / sizeof(ASSETS[0])));
+            std::string etag = assetFetches++ % 2 ? etags[asset] : "";
+            status = client.send(get(options, ASSETS[asset], "", etag), body, &etags[asset]);
+            break;
+        }
+        }
+
+        Clock::time_point done = Clock::now();
+        Clock::time_point from = options.rate > 0 ? due : sent;
+        if (from >= measureFrom) {
+            counts.requests[kind]++;
+            if (status == 503 || status == 429) counts.rejected[kind]++;
+            else if (status < 200 || status >= 400) counts.errors[kind]++;
+            counts.latency[kind].recordOwned(
+                (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(done - from).count());
+        }
+        due += interval;
+        n++;
+    }
+}
+
+struct StreamCounts {
+    uint64_t opened = 0;
+    uint64_t events = 0;
+    uint64_t bytes = 0;
+    uint64_t dropped = 0;       // closed by the server
+};
+
+// Opens the /events streams without waiting for their heads; the drain
+// thread reads those along with everything else.
+std::vector<socket_t> openSubscribers(const Options &options, const std::vector<User> &users) {
+    std::vector<socket_t> sockets;
+    for (unsigned i = 0; i < options.subscribers; i++) {
+        socket_t s = connectToServer(options.host.c_str(), options.port);
+        if (s == INVALID_SOCKET_HANDLE) {
+            fprintf(stderr, "subscriber %u: cannot connect\n", i);
+            break;
+        }
+        std::string request = get(options, "/events", users[i % users.size()].token);
+        if (sendSome(s, request.data(), request.size()) != (ssize_type)request.size()) {
+            closeSocket(s);
+            break;
+        }
+        setNonBlocking(s);
+        sockets.push_back(s);
+    }
+    return sockets;
+}
+
+// Reads every stream until `end`, counting "data:" lines received from
+// `measureFrom` on as events.
+void drainSubscribers(std::vector<socket_t> sockets, std::chrono::steady_clock::time_point measureFrom,
+                      std::chrono::steady_clock::time_point end, StreamCounts &counts) {
+    using Clock = std::chrono::steady_clock;
+    counts.opened = sockets.size();
+    std::vector<pollfd> fds;
+    for (socket_t s : sockets) fds.push_back(pollfd{s, POLLIN, 0});
+    std::unordered_map<socket_t, std::string> partial;
+    char chunk[16384];
+    while (Clock::now() < end && !fds.empty()) {
+#ifdef _WIN32
+        int n = WSAPoll(fds.data(), (ULONG)fds.size(), 100);
+#else
+        int n = poll(fds.data(), fds.size(), 100);
+#endif
+        if (n <= 0) continue;
+        bool measuring = Clock::now() >= measureFrom;
+        for (size_t i = 0; i < fds.size();) {
+            if (fds[i].revents == 0) {
+                i++;
+                continue;
+            }
+            socket_t s = fds[i].fd;
+            std::string &pending = partial[s];
+            bool closed = false;
+            while (true) {
+                ssize_type got = recvSome(s, chunk, sizeof(chunk));
+                if (got > 0) {
+                    if (measuring) counts.bytes += (uint64_t)got;
+                    pending.append(chunk, (size_t)got);
+                    continue;
+                }
+                closed = got == 0 || !isWouldBlock(lastSocketError());
+                break;
+            }
+            size_t line = 0;
+            for (size_t nl; (nl = pending.find('\n', line)) != std::string::npos; line = nl + 1) {
+                if (measuring && pending.compare(line, 5, "data:") == 0) counts.events++;
+            }
+            pending.erase(0, line);
+            fds[i].revents = 0;
+            if (!closed) {
+                i++;
+                continue;
+            }
+            counts.dropped++;
+            closeSocket(s);
+            partial.erase(s);
+            fds[i] = fds.back();
+            fds.pop_back();
+        }
+    }
+    for (const pollfd &p : fds) closeSocket(p.fd);
+}
+
+void addRow(BenchReport &report, const std::string &name, const LatencyHistogram::Snapshot &latency,
+            uint64_t requests, uint64_t errors, uint64_t rejected, double seconds) {
+    report.add(name)
+        .set("requests", (double)requests)
+        .set("rps", requests / seconds)
+        .set("errors", (double)errors)
+        .set("rejected", (double)rejected)
+        .set("p50_us", (double)latency.quantile(0.5))
+        .set("p99_us", (double)latency.quantile(0.99))
+        .set("p999_us", (double)latency.quantile(0.999))
+        .set("max_us", (double)latency.quantile(1.0))
+        .set("mean_us", latency.count ? (double)latency.sumMicros / latency.count : 0.0);
+}
+
+bool parseMix(const char* text, Options &options) {
+    unsigned mix[KINDS] = {};
+    std::string spec = text;
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t comma = spec.find(',', pos);
+        std::string item = spec.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        size_t eq = item.find('=');
+        int kind = 0;
+        while (kind < KINDS && item.substr(0, eq) != KIND_NAMES[kind]) kind++;
+        if (eq == std::string::npos || kind == KINDS) return false;
+        mix[kind] = (unsigned)atoi(item.c_str() + eq + 1);
+        pos = comma == std::string::npos ? spec.size() : comma + 1;
+    }
+    unsigned total = 0;
+    for (unsigned w : mix) total += w;
+    if (total == 0) return false;
+    std::copy(mix, mix + KINDS, options.mix);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        const char* value = argv[i + 1];
+        if (arg == "--host") options.host = value;
+        else if (arg == "--port") options.port = atoi(value);
+        else if (arg == "--connections") options.connections = (unsigned)std::max(1, atoi(value));
+        else if (arg == "--duration") options.duration = atof(value);
+        else if (arg == "--warmup") options.warmup = atof(value);
+        else if (arg == "--rate") options.rate = atof(value);
+        else if (arg == "--users") options.users = (unsigned)std::max(1, atoi(value));
+        else if (arg == "--seed-tasks") options.seedTasks = (unsigned)atoi(value);
+        else if (arg == "--subscribers") options.subscribers = (unsigned)atoi(value);
+        else if (arg == "--out") options.out = value;
+        else if (arg == "--baseline") options.baseline = value;
+        else if (arg == "--mix") {
+            if (!parseMix(value, options)) {
+                fprintf(stderr, "bad --mix %s\n", value);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "usage: load_gen [--host H] [--port P] [--connections C] [--duration S] [--warmup S]\n"
+                            "                [--rate R] [--mix schedule=W,add=W,toggle=W,login=W,static=W]\n"
+                            "                [--users N] [--seed-tasks N] [--subscribers N]\n"
+                            "                [--out FILE] [--baseline FILE]\n");
+            return 1;
+        }
+    }
+    if (!initNetworking()) return 1;
+
+    std::vector<User> users(options.users);
+    for (unsigned i = 0; i < options.users; i++) users[i].name = "loadgen" + std::to_string(i);
+    fprintf(stderr, "setting up %u users...\n", options.users);
+    if (!setUp(options, users)) return 1;
+
+    std::vector<socket_t> streams;
+    if (options.subscribers > 0) {
+        fprintf(stderr, "opening %u subscribers...\n", options.subscribers);
+        streams = openSubscribers(options, users);
+    }
+
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+    Clock::time_point measureFrom = start + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.warmup));
+    Clock::time_point end = measureFrom + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.duration));
+    fprintf(stderr, "%s loop, %u connections, %.0fs warmup + %.0fs...\n", options.rate > 0 ? "open" : "closed",
+            options.connections, options.warmup, options.duration);
+
+    std::vector<std::unique_ptr<Counts>> counts;
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < options.connections; i++) {
+        counts.emplace_back(new Counts());
+        Counts &c = *counts.back();
+        threads.emplace_back([&, i]() { runConnection(options, i, users, start, measureFrom, end, c); });
+    }
+    StreamCounts streamCounts;
+    if (!streams.empty()) {
+        threads.emplace_back([&]() { drainSubscribers(std::move(streams), measureFrom, end, streamCounts); });
+    }
+    for (std::thread &thread : threads) thread.join();
+
+    std::string mode = options.rate > 0 ? "load_open_" + std::to_string((long long)options.rate) : "load_closed";
+    mode += "/c" + std::to_string(options.connections);
+    BenchReport report;
+    LatencyHistogram::Snapshot all;
+    uint64_t requests = 0, errors = 0, rejected = 0;
+    for (int kind = 0; kind < KINDS; kind++) {
+        LatencyHistogram::Snapshot latency;
+        uint64_t r = 0, e = 0, x = 0;
+        for (const auto &c : counts) {
+            c->latency[kind].addTo(latency);
+            c->latency[kind].addTo(all);
+            r += c->requests[kind];
+            e += c->errors[kind];
+            x += c->rejected[kind];
+        }
+        requests += r;
+        errors += e;
+        rejected += x;
+        if (r > 0) addRow(report, mode + "/" + KIND_NAMES[kind], latency, r, e, x, options.duration);
+    }
+    addRow(report, mode + "/all", all, requests, errors, rejected, options.duration);
+    if (streamCounts.opened > 0) {
+        report.add(mode + "/events")
+            .set("subscribers", (double)streamCounts.opened)
+            .set("events", (double)streamCounts.events)
+            .set("events_per_s", streamCounts.events / options.duration)
+            .set("mb_per_s", streamCounts.bytes / options.duration / 1e6)
+            .set("dropped", (double)streamCounts.dropped);
+    }
+
+    report.write(stdout);
+    if (!options.out.empty() && !report.writeFile(options.out)) fprintf(stderr, "cannot write %s\n", options.out.c_str());
+    if (!options.baseline.empty()) {
+        BenchReport old;
+        if (!BenchReport::readFile(options.baseline, old)) {
+            fprintf(stderr, "cannot read %s\n", options.baseline.c_str());
+            return 1;
+        }
+        report.compare(old, stderr);
+    }
+    shutdownNetworking();
+    return 0;
+}
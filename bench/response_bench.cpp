@@ -0,0 +1,120 @@
+// Counts heap allocations and time per /schedule response for the string
+// concatenation the server used before and for the cached-fragment path.
+//
+//   g++ -std=c++17 -O2 -pthread -I.. response_bench.cpp -o response_bench
+
+#include "http.h"
+#include "json.h"
+#include "task_store.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+namespace {
+
+std::atomic<unsigned long long> allocations{0};
+
+} // namespace
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+const char* CORS_HEADERS =
+    "Access-Control-Allow-Origin: *\r\n"
+    "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n"
+    "Access-Control-Allow-Headers: Content-Type\r\n";
+
+// The /schedule body and response assembly from before the fragment cache.
+std::string legacySchedule(const TaskList &list) {
+    std::string json = "[";
+    for (size_t i = 0; i < list.tasks.size(); i++) {
+        Task t = list.tasks[i]->toTask();
+        if (i > 0) json += ",";
+        json += "{\"id\":" + std::to_string(t.id);
+        json += ",\"name\":\"" + jsonEscape(t.name);
+        json += "\",\"category\":\"" + jsonEscape(t.category);
+        json += "\",\"priority\":\"" + jsonEscape(t.priority);
+        json += "\",\"deadline\":\"" + jsonEscape(t.deadline);
+        json += "\",\"completed\":";
+        json += (t.completed ? "true" : "false");
+        json += "}";
+    }
+    json += "]";
+    std::string etag = "\"" + std::to_string(list.version) + "\"";
+    std::string headers = CORS_HEADERS;
+    headers += "ETag: " + etag + "\r\nCache-Control: no-cache\r\n";
+    std::string body = json;
+    return "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n" + headers +
+           "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: keep-alive\r\n\r\n" + body;
+}
+
+// What the server does now: shared body, headers in pooled buffers.
+size_t fragmentSchedule(const TaskList &list, std::string &out) {
+    HttpResponse response;
+    response.contentType = "application/json";
+    response.fixedHeaders = CORS_HEADERS;
+    response.headers = takeResponseBuffer();
+    response.headers += "ETag: \"";
+    appendInteger(response.headers, (long long)list.version);
+    response.headers += "\"\r\nCache-Control: no-cache\r\n";
+    response.sharedBody = list.json();
+    appendResponseHead(out, response, true);
+    size_t size = out.size() + response.sharedBody->size();
+    recycleResponseBuffer(std::move(response.headers));
+    return size;
+}
+
+template <typename F>
+void run(const char* name, int iterations, F f) {
+    unsigned long long before = allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    size_t bytes = 0;
+    for (int i = 0; i < iterations; i++) bytes += f();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    unsigned long long count = allocations.load() - before;
+    printf("%-26s %8.2f allocs/response %9.1f us/response %8.1f MB/s\n", name,
+           (double)count / iterations, seconds * 1e6 / iterations, bytes / seconds / 1e6);
+}
+
+} // namespace
+
+int main() {
+    const int TASKS = 200;
+    const int ITERATIONS = 20000;
+    TaskStore store;
+    for (int i = 0; i < TASKS; i++) {
+        Task t;
+        t.id = 1700000000000LL + i;
+        t.name = "Write the quarterly report, part " + std::to_string(i);
+        t.category = i % 3 ? "Work" : "Personal";
+        t.priority = i % 2 ? "High" : "Low";
+        t.deadline = "2026-03-14";
+        t.completed = i % 5 == 0;
+        t.username = "alice";
+        store.add(t);
+    }
+
+    RcuReadGuard guard;
+    const TaskList &list = *store.snapshot("alice");
+    printf("%d tasks, %zu byte body\n", TASKS, list.json()->size());
+
+    run("legacy concatenation", ITERATIONS, [&]() { return legacySchedule(list).size(); });
+    std::string out;
+    run("cached fragments", ITERATIONS, [&]() {
+        out.clear();
+        return fragmentSchedule(list, out);
+    });
+    return 0;
+}
@@ -0,0 +1,344 @@
+// Microbenchmarks for the data paths behind the server, at several store
+// sizes: tasks.json parsing and serializing, TaskStore loads, lookups,
+// writes and /schedule rendering, deadline timers, and persistence through snapshots and the
+// write-ahead log. Results are JSON lines (see bench_report.h).
+//
+//   g++ -std=c++17 -O2 -pthread -I.. store_bench.cpp -o store_bench
+//   ./store_bench [--sizes 10000,1000000,10000000] [--out results.json] [--baseline old.json]
+//
+// 10M tasks need about 6 GB of memory.
+
+#include "bench_report.h"
+#include "deadline_timers.h"
+#include "json.h"
+#include "snapshot.h"
+#include "task_json.h"
+#include "task_store.h"
+#include "wal.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace {
+
+const char* CATEGORIES[] = {"Work", "Personal", "Study", "Health", "Errands"};
+const char* PRIORITIES[] = {"High", "Medium", "Low"};
+
+double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Bytes the allocator has handed out and not had back, or 0 where that is
+// not known.
+size_t heapInUse() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+struct Random {
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+};
+
+// About a hundred tasks per user, as a busy account would have.
+Task makeTask(size_t i, size_t users) {
+    Task t;
+    t.id = 1700000000000LL + (long long)i;
+    t.name = "Task " + std::to_string(i) + " for the weekly review";
+    t.category = CATEGORIES[i % 5];
+    t.priority = PRIORITIES[i % 3];
+    char deadline[16];
+    snprintf(deadline, sizeof(deadline), "2026-%02d-%02d", (int)(i % 12) + 1, (int)(i % 28) + 1);
+    t.deadline = deadline;
+    t.completed = i % 4 == 0;
+    t.username = "user" + std::to_string(i % users);
+    return t;
+}
+
+std::string username(size_t user) {
+    return "user" + std::to_string(user);
+}
+
+void run(size_t count, const std::filesystem::path &dir, BenchReport &report) {
+    std::string size = std::to_string(count);
+    size_t users = std::max<size_t>(1, count / 100);
+    std::vector<Task> tasks;
+    tasks.reserve(count);
+    for (size_t i = 0; i < count; i++) tasks.push_back(makeTask(i, users));
+
+    // tasks.json as the first releases wrote it.
+    auto start = std::chrono::steady_clock::now();
+    std::string text = "[";
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) text += ',';
+        appendTaskJson(text, tasks[i]);
+        text.pop_back();
+        text += ",\"username\":\"";
+        appendJsonEscaped(text, tasks[i].username);
+        text += "\"}";
+    }
+    text += ']';
+    double t = seconds(start);
+    report.add("serialize_tasks_json/" + size).set("seconds", t).set("mb_per_s", text.size() / t / 1e6)
+        .set("ns_per_task", t * 1e9 / count);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<Task> parsed;
+    std::string error;
+    if (!parseTasksJson(text, parsed, error)) {
+        fprintf(stderr, "parse failed: %s\n", error.c_str());
+        exit(1);
+    }
+    t = seconds(start);
+    report.add("parse_tasks_json/" + size).set("seconds", t).set("mb_per_s", text.size() / t / 1e6)
+        .set("ns_per_task", t * 1e9 / count);
+    std::string().swap(text);
+    std::vector<Task>().swap(parsed);
+
+    size_t heapBefore = heapInUse();
+    TaskStore store;
+    start = std::chrono::steady_clock::now();
+    store.load(tasks);
+    t = seconds(start);
+    double heapPerTask = ((double)heapInUse() - (double)heapBefore) / count;
+    report.add("store_load/" + size).set("seconds", t).set("ns_per_task", t * 1e9 / count)
+        .set("heap_bytes_per_task", heapPerTask);
+
+    Random random;
+    const size_t LOOKUPS = 1000000;
+    volatile size_t sink = 0;
+    start = std::chrono::steady_clock::now();
+    {
+        RcuReadGuard guard;
+        for (size_t i = 0; i < LOOKUPS; i++) {
+            size_t task = random.next() % count;
+            const TaskList* list = store.snapshot(tasks[task].username);
+            if (list && list->find(tasks[task].id)) sink += 1;
+        }
+    }
+    t = seconds(start);
+    report.add("store_lookup/" + size).set("ns_per_op", t * 1e9 / LOOKUPS);
+
+    // A changed list renders its /schedule body on the next read.
+    const size_t RENDERS = std::min<size_t>(users, 2000);
+    size_t rendered = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < RENDERS; i++) {
+        Task &first = tasks[i];
+        store.toggle(first.username, first.id);
+        RcuReadGuard guard;
+        const TaskList* list = store.snapshot(first.username);
+        rendered += list->json()->size();
+    }
+    t = seconds(start);
+    report.add("schedule_render/" + size).set("us_per_list", t * 1e6 / RENDERS)
+        .set("mb_per_s", rendered / t / 1e6);
+
+    // The same for /stats, which reads the counts kept with the list.
+    int32_t today = todayDeadlineCode();
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < RENDERS; i++) {
+        Task &first = tasks[i];
+        store.toggle(first.username, first.id);
+        RcuReadGuard guard;
+        uint64_t version = 0;
+        sink += store.stats(first.username, version)->json(version, today)->size();
+    }
+    t = seconds(start);
+    report.add("stats_render/" + size).set("us_per_list", t * 1e6 / RENDERS);
+
+    const size_t WRITES = std::min<size_t>(count, 100000);
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < WRITES; i++) {
+        Task task = makeTask(count + i, users);
+        store.add(task);
+    }
+    t = seconds(start);
+    report.add("store_add/" + size).set("ns_per_op", t * 1e9 / WRITES);
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < WRITES; i++) {
+        const Task &task = tasks[random.next() % count];
+        store.toggle(task.username, task.id);
+    }
+    t = seconds(start);
+    report.add("store_toggle/" + size).set("ns_per_op", t * 1e9 / WRITES);
+
+    // Compaction: every list into a snapshot file, then startup from it.
+    std::string path = (dir / ("tasks-" + size + ".snap")).string();
+    start = std::chrono::steady_clock::now();
+    SnapshotBuilder builder;
+    store.forEachUser([&](const std::string &name, const TaskList &list) {
+        if (list.tasks.empty()) return;
+        builder.beginUser(name);
+        for (const StoredTask* task : list.tasks) builder.addTask(*task);
+    });
+    std::string image;
+    builder.finish(image);
+    std::ofstream(path, std::ios::binary).write(image.data(), (std::streamsize)image.size());
+    t = seconds(start);
+    report.add("snapshot_write/" + size).set("seconds", t).set("mb", image.size() / 1e6);
+    std::string().swap(image);
+
+    start = std::chrono::steady_clock::now();
+    std::shared_ptr<const TaskSnapshot> snap = TaskSnapshot::open(path, error);
+    if (!snap) {
+        fprintf(stderr, "snapshot open failed: %s\n", error.c_str());
+        exit(1);
+    }
+    TaskStore restored;
+    restored.attachSnapshot(snap);
+    t = seconds(start);
+    report.add("snapshot_startup/" + size).set("seconds", t);
+
+    // Arming a deadline timer for every pending task, as the server does at
+    // startup, straight from the snapshot; then running the days through.
+    int32_t yearStart;
+    parseDateDeadline("2026-01-01", yearStart);
+    DeadlineTimers deadlines(yearStart - 1);
+    size_t timerHeap = heapInUse();
+    start = std::chrono::steady_clock::now();
+    restored.forEachDeadline([&](uint32_t user, int64_t id, int32_t deadline, bool completed) {
+        deadlines.update(user, id, deadline, completed);
+    });
+    t = seconds(start);
+    size_t armed = deadlines.pending();
+    report.add("deadline_arm/" + size).set("seconds", t).set("ns_per_task", t * 1e9 / restored.size())
+          .set("timers", (double)armed).set("heap_bytes_per_timer", armed ? (double)(heapInUse() - timerHeap) / armed : 0.0);
+    std::vector<DeadlineTimers::Due> due;
+    start = std::chrono::steady_clock::now();
+    for (int32_t day = yearStart; day < yearStart + 366; day++) deadlines.advance(day, due);
+    t = seconds(start);
+    report.add("deadline_fire/" + size).set("seconds", t).set("ns_per_timer", armed ? t * 1e9 / armed : 0.0);
+
+    // Counting every user's tasks for /stats at startup, on one thread.
+    start = std::chrono::steady_clock::now();
+    for (size_t shard = 0; shard < TaskStore::SHARDS; shard++) restored.rebuildStats(shard);
+    t = seconds(start);
+    report.add("stats_rebuild/" + size).set("seconds", t).set("ns_per_task", t * 1e9 / restored.size());
+
+    const size_t FIRST_READS = std::min<size_t>(users, 1000);
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < FIRST_READS; i++) {
+        RcuReadGuard guard;
+        const TaskList* list = restored.snapshot(username(i));
+        if (list) sink += list->tasks.size();
+    }
+    t = seconds(start);
+    report.add("snapshot_first_read/" + size).set("us_per_user", t * 1e6 / FIRST_READS);
+    std::filesystem::remove(path);
+    (void)sink;
+}
+
+// Log appends with and without waiting for fdatasync. With several writers,
+// commits share syncs, so syncs_per_commit shows how well grouping works.
+void runLog(const std::filesystem::path &dir, BenchReport &report) {
+    std::string record = "{\"op\":\"put\",\"id\":1700000000123,\"name\":\"Task 123 for the weekly review\","
+                         "\"category\":\"Work\",\"priority\":\"High\",\"deadline\":\"2026-03-14\","
+                         "\"completed\":false,\"username\":\"user42\"}";
+    {
+        WriteAheadLog log((dir / "bench-none.wal").string(), SyncPolicy::None, 10);
+        log.open();
+        const size_t RECORDS = 200000;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < RECORDS; i++) {
+            log.append(record);
+            log.commit();
+        }
+        double t = seconds(start);
+        report.add("wal_append_nosync").set("ns_per_record", t * 1e9 / RECORDS);
+    }
+    for (unsigned writers : {1u, 8u}) {
+        WriteAheadLog log((dir / ("bench-always-" + std::to_string(writers) + ".wal")).string(), SyncPolicy::Always, 10);
+        log.open();
+        const size_t COMMITS = 200;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (unsigned w = 0; w < writers; w++) {
+            threads.emplace_back([&]() {
+                for (size_t i = 0; i < COMMITS; i++) {
+                    log.append(record);
+                    log.commit();
+                }
+            });
+        }
+        for (std::thread &thread : threads) thread.join();
+        double t = seconds(start);
+        size_t commits = COMMITS * writers;
+        LatencyHistogram::Snapshot wait;
+        log.commitLatency().addTo(wait);
+        report.add("wal_commit_fsync/" + std::to_string(writers) + "_writers")
+            .set("commits_per_s", commits / t)
+            .set("syncs_per_commit", (double)log.syncCount() / commits)
+            .set("p50_us", (double)wait.quantile(0.5))
+            .set("p99_us", (double)wait.quantile(0.99));
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<size_t> sizes = {10000, 1000000};
+    std::string out, baseline;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--sizes") {
+            sizes.clear();
+            for (const char* p = argv[i + 1]; *p;) {
+                char* end;
+                size_t count = (size_t)strtoull(p, &end, 10);
+                if (end == p) break;
+                sizes.push_back(count);
+                p = *end == ',' ? end + 1 : end;
+            }
+        } else if (arg == "--out") {
+            out = argv[i + 1];
+        } else if (arg == "--baseline") {
+            baseline = argv[i + 1];
+        } else {
+            fprintf(stderr, "usage: store_bench [--sizes N,N,...] [--out FILE] [--baseline FILE]\n");
+            return 1;
+        }
+    }
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "taskbuddy-store-bench";
+    std::filesystem::create_directories(dir);
+    BenchReport report;
+    for (size_t count : sizes) {
+        if (count == 0) continue;
+        fprintf(stderr, "%zu tasks...\n", count);
+        run(count, dir, report);
+    }
+    runLog(dir, report);
+    std::filesystem::remove_all(dir);
+
+    report.write(stdout);
+    if (!out.empty() && !report.writeFile(out)) fprintf(stderr, "cannot write %s\n", out.c_str());
+    if (!baseline.empty()) {
+        BenchReport old;
+        if (!BenchReport::readFile(baseline, old)) {
+            fprintf(stderr, "cannot read %s\n", baseline.c_str());
+            return 1;
+        }
+        report.compare(old, stderr);
+    }
+    return 0;
+}
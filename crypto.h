@@ -0,0 +1,317 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// SHA-256, HMAC-SHA256, PBKDF2 and scrypt (RFC 6234, 2104, 8018, 7914),
+// for password hashes and session token signatures. Self-contained so the
+// server keeps building without a crypto library.
+
+class Sha256 {
+public:
+    static const size_t DIGEST_SIZE = 32;
+    static const size_t BLOCK_SIZE = 64;
+
+    Sha256() {
+        static const uint32_t INITIAL[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+        };
+        memcpy(state, INITIAL, sizeof(state));
+    }
+
+    void update(const void* data, size_t len) {
+        const uint8_t* p = (const uint8_t*)data;
+        total += len;
+        if (buffered > 0) {
+            size_t take = std::min(len, BLOCK_SIZE - buffered);
+            memcpy(buffer + buffered, p, take);
+            buffered += take;
+            p += take;
+            len -= take;
+            if (buffered < BLOCK_SIZE) return;
+            compress(buffer);
+            buffered = 0;
+        }
+        for (; len >= BLOCK_SIZE; p += BLOCK_SIZE, len -= BLOCK_SIZE) compress(p);
+        memcpy(buffer, p, len);
+        buffered = len;
+    }
+
+    void finish(uint8_t digest[DIGEST_SIZE]) {
+        uint64_t bits = total * 8;
+        uint8_t pad = 0x80;
+        update(&pad, 1);
+        uint8_t zero = 0;
+        while (buffered != 56) update(&zero, 1);
+        uint8_t length[8];
+        for (int i = 0; i < 8; i++) length[i] = (uint8_t)(bits >> (56 - 8 * i));
+        update(length, 8);
+        for (int i = 0; i < 8; i++) {
+            digest[4 * i] = (uint8_t)(state[i] >> 24);
+            digest[4 * i + 1] = (uint8_t)(state[i] >> 16);
+            digest[4 * i + 2] = (uint8_t)(state[i] >> 8);
+            digest[4 * i + 3] = (uint8_t)state[i];
+        }
+    }
+
+private:
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress(const uint8_t* block) {
+        static const uint32_t K[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+                   (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+
+    uint32_t state[8];
+    uint8_t buffer[BLOCK_SIZE];
+    size_t buffered = 0;
+    uint64_t total = 0;
+};
+
+class HmacSha256 {
+public:
+    HmacSha256(const void* key, size_t keyLen) {
+        uint8_t block[Sha256::BLOCK_SIZE] = {0};
+        if (keyLen > Sha256::BLOCK_SIZE) {
+            Sha256 h;
+            h.update(key, keyLen);
+            h.finish(block);
+        } else {
+            memcpy(block, key, keyLen);
+        }
+        uint8_t pad[Sha256::BLOCK_SIZE];
+        for (size_t i = 0; i < Sha256::BLOCK_SIZE; i++) pad[i] = block[i] ^ 0x36;
+        inner.update(pad, sizeof(pad));
+        for (size_t i = 0; i < Sha256::BLOCK_SIZE; i++) pad[i] = block[i] ^ 0x5c;
+        outer.update(pad, sizeof(pad));
+    }
+
+    void update(const void* data, size_t len) { inner.update(data, len); }
+
+    void finish(uint8_t mac[Sha256::DIGEST_SIZE]) {
+        uint8_t innerDigest[Sha256::DIGEST_SIZE];
+        inner.finish(innerDigest);
+        outer.update(innerDigest, sizeof(innerDigest));
+        outer.finish(mac);
+    }
+
+private:
+    Sha256 inner;
+    Sha256 outer;
+};
+
+inline void pbkdf2HmacSha256(const uint8_t* password, size_t passwordLen, const uint8_t* salt, size_t saltLen,
+                             uint32_t iterations, uint8_t* out, size_t outLen) {
+    // The keyed pads are the same for every block, so they are set up once.
+    HmacSha256 keyed(password, passwordLen);
+    for (uint32_t block = 1; outLen > 0; block++) {
+        uint8_t counter[4] = {(uint8_t)(block >> 24), (uint8_t)(block >> 16), (uint8_t)(block >> 8), (uint8_t)block};
+        uint8_t u[Sha256::DIGEST_SIZE];
+        HmacSha256 first = keyed;
+        first.update(salt, saltLen);
+        first.update(counter, 4);
+        first.finish(u);
+        uint8_t t[Sha256::DIGEST_SIZE];
+        memcpy(t, u, sizeof(t));
+        for (uint32_t i = 1; i < iterations; i++) {
+            HmacSha256 next = keyed;
+            next.update(u, sizeof(u));
+            next.finish(u);
+            for (size_t j = 0; j < sizeof(t); j++) t[j] ^= u[j];
+        }
+        size_t take = std::min(outLen, sizeof(t));
+        memcpy(out, t, take);
+        out += take;
+        outLen -= take;
+    }
+}
+
+namespace cryptoimpl {
+
+inline uint32_t rotl(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+inline void salsa208(uint32_t b[16]) {
+    uint32_t x[16];
+    memcpy(x, b, sizeof(x));
+    for (int i = 0; i < 8; i += 2) {
+        x[4] ^= rotl(x[0] + x[12], 7);   x[8] ^= rotl(x[4] + x[0], 9);
+        x[12] ^= rotl(x[8] + x[4], 13);  x[0] ^= rotl(x[12] + x[8], 18);
+        x[9] ^= rotl(x[5] + x[1], 7);    x[13] ^= rotl(x[9] + x[5], 9);
+        x[1] ^= rotl(x[13] + x[9], 13);  x[5] ^= rotl(x[1] + x[13], 18);
+        x[14] ^= rotl(x[10] + x[6], 7);  x[2] ^= rotl(x[14] + x[10], 9);
+        x[6] ^= rotl(x[2] + x[14], 13);  x[10] ^= rotl(x[6] + x[2], 18);
+        x[3] ^= rotl(x[15] + x[11], 7);  x[7] ^= rotl(x[3] + x[15], 9);
+        x[11] ^= rotl(x[7] + x[3], 13);  x[15] ^= rotl(x[11] + x[7], 18);
+        x[1] ^= rotl(x[0] + x[3], 7);    x[2] ^= rotl(x[1] + x[0], 9);
+        x[3] ^= rotl(x[2] + x[1], 13);   x[0] ^= rotl(x[3] + x[2], 18);
+        x[6] ^= rotl(x[5] + x[4], 7);    x[7] ^= rotl(x[6] + x[5], 9);
+        x[4] ^= rotl(x[7] + x[6], 13);   x[5] ^= rotl(x[4] + x[7], 18);
+        x[11] ^= rotl(x[10] + x[9], 7);  x[8] ^= rotl(x[11] + x[10], 9);
+        x[9] ^= rotl(x[8] + x[11], 13);  x[10] ^= rotl(x[9] + x[8], 18);
+        x[12] ^= rotl(x[15] + x[14], 7); x[13] ^= rotl(x[12] + x[15], 9);
+        x[14] ^= rotl(x[13] + x[12], 13); x[15] ^= rotl(x[14] + x[13], 18);
+    }
+    for (int i = 0; i < 16; i++) b[i] += x[i];
+}
+
+// BlockMix over 2r 64-byte blocks, writing even blocks to the first half
+// of `out` and odd blocks to the second.
+inline void blockMix(const uint32_t* in, uint32_t* out, uint32_t r) {
+    uint32_t x[16];
+    memcpy(x, in + (2 * r - 1) * 16, sizeof(x));
+    for (uint32_t i = 0; i < 2 * r; i++) {
+        for (int j = 0; j < 16; j++) x[j] ^= in[i * 16 + j];
+        salsa208(x);
+        memcpy(out + ((i % 2) * r + i / 2) * 16, x, sizeof(x));
+    }
+}
+
+inline void roMix(uint8_t* block, uint32_t r, uint64_t n, std::vector<uint32_t> &v) {
+    size_t words = 32 * (size_t)r;
+    std::vector<uint32_t> x(words), y(words);
+    for (size_t i = 0; i < words; i++) {
+        const uint8_t* p = block + 4 * i;
+        x[i] = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+    v.resize(words * n);
+    for (uint64_t i = 0; i < n; i++) {
+        memcpy(&v[words * i], x.data(), words * 4);
+        blockMix(x.data(), y.data(), r);
+        x.swap(y);
+    }
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t j = x[words - 16] & (n - 1);
+        for (size_t k = 0; k < words; k++) x[k] ^= v[words * j + k];
+        blockMix(x.data(), y.data(), r);
+        x.swap(y);
+    }
+    for (size_t i = 0; i < words; i++) {
+        uint8_t* p = block + 4 * i;
+        p[0] = (uint8_t)x[i];
+        p[1] = (uint8_t)(x[i] >> 8);
+        p[2] = (uint8_t)(x[i] >> 16);
+        p[3] = (uint8_t)(x[i] >> 24);
+    }
+}
+
+} // namespace cryptoimpl
+
+// scrypt with cost N = 2^logN. Uses 128 * r * N bytes of memory.
+inline void scrypt(std::string_view password, std::string_view salt, int logN, uint32_t r, uint32_t p,
+                   uint8_t* out, size_t outLen) {
+    uint64_t n = 1ULL << logN;
+    size_t blockSize = 128 * (size_t)r;
+    std::vector<uint8_t> b(blockSize * p);
+    pbkdf2HmacSha256((const uint8_t*)password.data(), password.size(), (const uint8_t*)salt.data(), salt.size(),
+                     1, b.data(), b.size());
+    std::vector<uint32_t> scratch;
+    for (uint32_t i = 0; i < p; i++) cryptoimpl::roMix(b.data() + i * blockSize, r, n, scratch);
+    pbkdf2HmacSha256((const uint8_t*)password.data(), password.size(), b.data(), b.size(), 1, out, outLen);
+}
+
+inline bool constantTimeEquals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    unsigned char diff = 0;
+    for (size_t i = 0; i < a.size(); i++) diff |= (unsigned char)(a[i] ^ b[i]);
+    return diff == 0;
+}
+
+// Unpredictable bytes from the OS: /dev/urandom where it exists, otherwise
+// std::random_device, which is backed by the system generator on the
+// platforms the server builds for.
+inline std::string randomBytes(size_t n) {
+    std::string out(n, '\0');
+    std::ifstream urandom("/dev/urandom", std::ios::binary);
+    if (urandom.read(&out[0], (std::streamsize)n)) return out;
+    std::random_device device;
+    for (size_t i = 0; i < n; i++) out[i] = (char)(device() & 0xff);
+    return out;
+}
+
+// Unpadded base64url, safe in URLs, headers and JSON without escaping.
+inline std::string base64UrlEncode(std::string_view data) {
+    static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    std::string out;
+    out.reserve((data.size() * 4 + 2) / 3);
+    size_t i = 0;
+    for (; i + 2 < data.size(); i += 3) {
+        uint32_t v = (uint8_t)data[i] << 16 | (uint8_t)data[i + 1] << 8 | (uint8_t)data[i + 2];
+        out += ALPHABET[v >> 18];
+        out += ALPHABET[(v >> 12) & 63];
+        out += ALPHABET[(v >> 6) & 63];
+        out += ALPHABET[v & 63];
+    }
+    if (i < data.size()) {
+        uint32_t v = (uint8_t)data[i] << 16 | (i + 1 < data.size() ? (uint8_t)data[i + 1] << 8 : 0);
+        out += ALPHABET[v >> 18];
+        out += ALPHABET[(v >> 12) & 63];
+        if (i + 1 < data.size()) out += ALPHABET[(v >> 6) & 63];
+    }
+    return out;
+}
+
+inline bool base64UrlDecode(std::string_view text, std::string &out) {
+    auto value = [](char c) {
+        if (c >= 'A' && c <= 'Z') return c - 'A';
+        if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+        if (c >= '0' && c <= '9') return c - '0' + 52;
+        if (c == '-') return 62;
+        if (c == '_') return 63;
+        return -1;
+    };
+    if (text.size() % 4 == 1) return false;
+    out.clear();
+    uint32_t acc = 0;
+    int bits = 0;
+    for (char c : text) {
+        int v = value(c);
+        if (v < 0) return false;
+        acc = (acc << 6) | (uint32_t)v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out += (char)((acc >> bits) & 0xff);
+        }
+    }
+    return true;
+}
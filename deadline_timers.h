@@ -0,0 +1,113 @@
+#pragma once
+
+#include "task.h"
+#include "timer_wheel.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// One timer per pending task whose deadline is a date still to come, in
+// wheels that tick once per day, so the tasks falling due when a day begins
+// come out without looking at any other task. Arming, moving and cancelling
+// a timer is a hash lookup and a relink. Timers are split by user across
+// independently locked shards, so writers on different event loops rarely
+// meet here.
+class DeadlineTimers {
+public:
+    struct Due {
+        uint32_t user;          // interned username
+        int64_t id;
+        int32_t deadline;
+    };
+
+    explicit DeadlineTimers(int32_t today = todayDeadlineCode()) {
+        for (size_t i = 0; i < SHARDS; i++) shards[i].reset(new Shard(today + 1));
+    }
+
+    // Brings the task's timer in line with its current state: armed for the
+    // deadline if it is pending with a date after the last day advanced
+    // through, otherwise gone.
+    void update(uint32_t user, int64_t id, int32_t deadline, bool completed) {
+        Shard &shard = *shards[user % SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Key key{user, id};
+        bool wanted = !completed && deadline > 0 && (uint64_t)deadline >= shard.wheel.now();
+        auto it = shard.timers.find(key);
+        if (!wanted) {
+            if (it == shard.timers.end()) return;
+            shard.wheel.cancel(it->second.node);
+            shard.timers.erase(it);
+            return;
+        }
+        if (it == shard.timers.end()) {
+            it = shard.timers.emplace(key, Timer()).first;
+            it->second.node.owner = &it->second;
+            it->second.key = key;
+        } else if (it->second.node.expires == (uint64_t)deadline) {
+            return;
+        }
+        shard.wheel.schedule(it->second.node, (uint64_t)deadline);
+    }
+
+    void remove(uint32_t user, int64_t id) {
+        update(user, id, 0, true);
+    }
+
+    // Appends the tasks due on or before `today` to `due` and forgets them.
+    void advance(int32_t today, std::vector<Due> &due) {
+        for (size_t i = 0; i < SHARDS; i++) {
+            Shard &shard = *shards[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.wheel.advance((uint64_t)today, [&](TimerNode &node) {
+                const Key key = ((Timer*)node.owner)->key;
+                due.push_back(Due{key.user, key.id, (int32_t)node.expires});
+                shard.timers.erase(key);
+            });
+        }
+    }
+
+    size_t pending() const {
+        size_t total = 0;
+        for (size_t i = 0; i < SHARDS; i++) {
+            std::lock_guard<std::mutex> lock(shards[i]->mutex);
+            total += shards[i]->timers.size();
+        }
+        return total;
+    }
+
+private:
+    static const size_t SHARDS = 16;
+
+    struct Key {
+        uint32_t user;
+        int64_t id;
+        bool operator==(const Key &other) const { return user == other.user && id == other.id; }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &k) const {
+            uint64_t h = (uint64_t)k.id * 0x9E3779B97F4A7C15ULL ^ k.user;
+            return (size_t)(h ^ (h >> 29));
+        }
+    };
+
+    struct Timer {
+        TimerNode node;
+        Key key;
+    };
+
+    struct Shard {
+        explicit Shard(int32_t firstDay) : wheel((uint64_t)firstDay) {}
+
+        mutable std::mutex mutex;
+        TimerWheel wheel;       // in days, as deadline codes
+        // Elements of an unordered_map never move, so the wheel can link
+        // the nodes in place.
+        std::unordered_map<Key, Timer, KeyHash> timers;
+    };
+
+    std::unique_ptr<Shard> shards[SHARDS];
+};
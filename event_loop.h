@@ -0,0 +1,839 @@
+#pragma once
+
+#include "platform.h"
+#include "events.h"
+#include "http.h"
+#include "timer_wheel.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif !defined(_WIN32)
+#include <poll.h>
+#endif
+
+struct PollEvent {
+    socket_t fd;
+    bool readable;
+    bool writable;
+    bool error;
+};
+
+#ifdef __linux__
+// Edge-triggered epoll. Every descriptor is registered once for both
+// directions and callers always drain until EAGAIN, so interest never has to
+// be modified after the initial add.
+class Poller {
+public:
+    Poller() : epollFd(epoll_create1(EPOLL_CLOEXEC)) {}
+    ~Poller() {
+        if (epollFd >= 0) close(epollFd);
+    }
+    Poller(const Poller&) = delete;
+    Poller& operator=(const Poller&) = delete;
+
+    bool valid() const { return epollFd >= 0; }
+
+    bool add(socket_t fd) {
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+
+    void setWantWrite(socket_t, bool) {}
+
+    void remove(socket_t fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    int wait(std::vector<PollEvent> &out, int timeoutMs) {
+        out.clear();
+        int n = epoll_wait(epollFd, events, MAX_EVENTS, timeoutMs);
+        for (int i = 0; i < n; i++) {
+            PollEvent e;
+            e.fd = events[i].data.fd;
+            e.readable = (events[i].events & (EPOLLIN | EPOLLRDHUP)) != 0;
+            e.writable = (events[i].events & EPOLLOUT) != 0;
+            e.error = (events[i].events & (EPOLLERR | EPOLLHUP)) != 0;
+            out.push_back(e);
+        }
+        return n;
+    }
+
+private:
+    static const int MAX_EVENTS = 1024;
+    int epollFd;
+    epoll_event events[MAX_EVENTS];
+};
+#else
+// Level-triggered WSAPoll/poll fallback for Windows and non-Linux systems.
+// Write interest is only requested while a connection has unsent output,
+// otherwise every idle socket would report writable on each wakeup.
+class Poller {
+public:
+    bool valid() const { return true; }
+
+    bool add(socket_t fd) {
+        pollfd p;
+        p.fd = fd;
+        p.events = POLLIN;
+        p.revents = 0;
+        index[fd] = fds.size();
+        fds.push_back(p);
+        return true;
+    }
+
+    void setWantWrite(socket_t fd, bool wantWrite) {
+        auto it = index.find(fd);
+        if (it == index.end()) return;
+        fds[it->second].events = (short)(POLLIN | (wantWrite ? POLLOUT : 0));
+    }
+
+    void remove(socket_t fd) {
+        auto it = index.find(fd);
+        if (it == index.end()) return;
+        size_t slot = it->second;
+        index.erase(it);
+        if (slot != fds.size() - 1) {
+            fds[slot] = fds.back();
+            index[fds[slot].fd] = slot;
+        }
+        fds.pop_back();
+    }
+
+    int wait(std::vector<PollEvent> &out, int timeoutMs) {
+        out.clear();
+#ifdef _WIN32
+        int n = WSAPoll(fds.data(), (ULONG)fds.size(), timeoutMs);
+#else
+        int n = poll(fds.data(), fds.size(), timeoutMs);
+#endif
+        if (n <= 0) return n;
+        for (const pollfd &p : fds) {
+            if (p.revents == 0) continue;
+            PollEvent e;
+            e.fd = p.fd;
+            e.readable = (p.revents & POLLIN) != 0;
+            e.writable = (p.revents & POLLOUT) != 0;
+            e.error = (p.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0;
+            out.push_back(e);
+        }
+        return (int)out.size();
+    }
+
+private:
+    std::vector<pollfd> fds;
+    std::unordered_map<socket_t, size_t> index;
+};
+#endif
+
+typedef std::function<HttpResponse(const HttpRequest&)> RequestHandler;
+
+// A run of pending output: bytes the connection owns, or a body shared with
+// a cache that is sent from where it lives.
+struct OutputSegment {
+    std::string owned;
+    std::shared_ptr<const std::string> shared;
+
+    const char* data() const { return shared ? shared->data() : owned.data(); }
+    size_t size() const { return shared ? shared->size() : owned.size(); }
+};
+
+// Which of the limits in HttpLimits a connection's timer enforces.
+enum class TimeoutPhase : uint8_t { None, Idle, Header, Body };
+
+struct Connection {
+    socket_t fd;
+    uint64_t id = 0;            // tells a reused descriptor from the one a deferred response was for
+    char peer[INET_ADDRSTRLEN] = {};
+    uint64_t receivedAt = 0;    // kernel arrival time of the last bytes read, CLOCK_REALTIME microseconds
+    std::string in;
+    RequestParser parser;       // state of the request at the front of `in`
+    std::deque<OutputSegment> out;
+    size_t outOffset = 0;       // bytes of out.front() already sent
+    size_t outBytes = 0;        // unsent bytes across all segments
+    bool readPending = false;
+    bool peerClosed = false;
+    bool closeAfterWrite = false;
+    bool awaiting = false;      // a deferred response is being computed; later requests wait
+    bool streaming = false;     // answering with an event stream; input is only read to notice EOF
+    std::string topic;          // what a streaming connection is subscribed to
+    size_t streamSlot = 0;      // its position in the loop's subscriber list for `topic`
+    TimerNode timer;            // in the loop's wheel while a timeout applies
+    TimeoutPhase phase = TimeoutPhase::None;
+};
+
+// Responses finished on a worker thread, handed back to the loop that owns
+// the connection. Shared with the jobs, so a job that outlives its loop
+// still has somewhere to put its result.
+class CompletionQueue {
+public:
+    struct Completion {
+        socket_t fd;
+        uint64_t connectionId;
+        HttpResponse response;
+        bool keepAlive;
+    };
+
+#ifdef __linux__
+    CompletionQueue() : wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+    ~CompletionQueue() {
+        if (wakeFd >= 0) close(wakeFd);
+    }
+#else
+    CompletionQueue() {}
+#endif
+    CompletionQueue(const CompletionQueue&) = delete;
+    CompletionQueue& operator=(const CompletionQueue&) = delete;
+
+    void push(Completion &&completion) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.push_back(std::move(completion));
+        }
+#ifdef __linux__
+        uint64_t one = 1;
+        ssize_t ignored = write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+#endif
+    }
+
+    void takeAll(std::vector<Completion> &out) {
+#ifdef __linux__
+        uint64_t count;
+        ssize_t ignored = read(wakeFd, &count, sizeof(count));
+        (void)ignored;
+#endif
+        std::lock_guard<std::mutex> lock(mutex);
+        out.swap(ready);
+    }
+
+#ifdef __linux__
+    // Becomes readable when a completion is pushed. Elsewhere the loop polls
+    // with a short timeout while it has jobs outstanding.
+    int wakeFd;
+#endif
+
+private:
+    std::mutex mutex;
+    std::vector<Completion> ready;
+};
+
+// Single-threaded non-blocking HTTP/1.1 server loop. Connections are kept
+// alive between requests, pipelined requests are answered in order, and
+// responses that do not fit in the socket buffer are finished on the next
+// writable event.
+//
+// Responses with deferred work are computed on `pool`, or on the pool the
+// response names; the connection stops taking requests until the result
+// comes back, which keeps responses in order. Without a pool the work runs
+// inline.
+//
+// A response with `stream` set turns its connection into a subscriber of
+// `hub`. Events reach the loop through its inbox and are queued by
+// reference on every local subscriber; a subscriber that falls more than
+// MAX_STREAM_BACKLOG behind is disconnected. Idle subscribers cost no work
+// at all until something is published for them.
+//
+// Every other connection has one timer in the loop's wheel, for whichever
+// limit applies: idle between requests or while output makes no progress,
+// the header timeout from a request's first byte, and the body timeout once
+// its headers are in. The header and body timers are not pushed back as
+// bytes trickle in, so a client sending a byte at a time still runs out of
+// time. Connections waiting on deferred work have none. The poll timeout is
+// the next tick with timers due, so a quiet loop sleeps until then.
+//
+// Each request carries how long it had been ready when the loop got to it,
+// so the handler can shed load: the time since the kernel received its last
+// bytes where sockets are timestamped (Linux), which includes the time they
+// sat in the socket while the loop served other connections; elsewhere the
+// time since the wakeup that found it. Connections past
+// limits.maxConnections are refused with a 503 before anything is read.
+class EventLoop {
+public:
+    EventLoop(socket_t listener, RequestHandler handler, HttpLimits limits = HttpLimits(),
+              WorkerPool* pool = nullptr, EventHub* hub = nullptr)
+        : listener(listener), handler(std::move(handler)), limits(limits),
+          maxInputBytes(limits.maxHeaderBytes + limits.maxBodyBytes + INPUT_SLACK),
+          pool(pool), completions(std::make_shared<CompletionQueue>()), hub(hub),
+          inbox(hub ? std::make_shared<EventInbox>() : nullptr), timers(currentTick()) {}
+
+    bool run() {
+        if (!poller.valid() || !poller.add(listener)) return false;
+#ifdef __linux__
+        if (completions->wakeFd < 0 || !poller.add(completions->wakeFd)) return false;
+        if (inbox && (inbox->wakeFd < 0 || !poller.add(inbox->wakeFd))) return false;
+#endif
+
+        std::vector<PollEvent> events;
+        while (true) {
+#ifdef __linux__
+            int n = poller.wait(events, pollTimeout(-1));
+            bool eventsReady = false;
+#else
+            int n = poller.wait(events, pollTimeout(outstanding > 0 || !streams.empty() ? COMPLETION_POLL_MS : -1));
+            bool eventsReady = !streams.empty();
+#endif
+            if (n < 0) {
+                if (isInterrupted(lastSocketError())) continue;
+                return false;
+            }
+            wokeAt = nowMicros();
+            if (timers.size() > 0) expireTimers();
+            for (const PollEvent &e : events) {
+                if (e.fd == listener) {
+                    acceptAll();
+                    continue;
+                }
+#ifdef __linux__
+                if (e.fd == completions->wakeFd) continue;
+                if (inbox && e.fd == inbox->wakeFd) {
+                    eventsReady = true;
+                    continue;
+                }
+#endif
+                auto it = connections.find(e.fd);
+                if (it == connections.end()) continue;
+                Connection &conn = *it->second;
+                uint64_t id = conn.id;
+                if (e.error && !e.readable) {
+                    closeConnection(conn);
+                    continue;
+                }
+                if (e.writable && !flush(conn)) continue;
+                // A drained connection may still hold requests that were held
+                // back by output backpressure.
+                bool resume = e.writable && conn.out.empty() && (conn.readPending || !conn.in.empty());
+                if (e.readable || resume) onReadable(conn);
+                if (Connection* open = findConnection(e.fd, id)) updateTimer(*open);
+            }
+            if (outstanding > 0) finishDeferred();
+            if (eventsReady) deliverEvents();
+        }
+    }
+
+    size_t connectionCount() const { return connections.size(); }
+
+    // Open connections across every loop in the process.
+    static std::atomic<long long> &openConnections() {
+        static std::atomic<long long> count{0};
+        return count;
+    }
+
+    // Connections closed by each timeout across every loop, indexed by
+    // TimeoutPhase.
+    static std::atomic<unsigned long long> (&timeouts())[4] {
+        static std::atomic<unsigned long long> counts[4] = {};
+        return counts;
+    }
+
+    // Connections refused past limits.maxConnections, and requests answered
+    // 503 because the worker pool's queue was full, across every loop.
+    static std::atomic<unsigned long long> &refusedConnections() {
+        static std::atomic<unsigned long long> count{0};
+        return count;
+    }
+
+    static std::atomic<unsigned long long> &busyRejections() {
+        static std::atomic<unsigned long long> count{0};
+        return count;
+    }
+
+private:
+    // Unsent responses beyond this size stop the connection from being read
+    // until it drains, and input is buffered only up to the largest request
+    // the limits allow, plus room for chunk framing, so one client cannot
+    // grow memory without bound.
+    static const size_t MAX_PENDING_OUTPUT = 1 << 20;
+    static const size_t MAX_STREAM_BACKLOG = 256 * 1024;
+    static const size_t INPUT_SLACK = 64 * 1024;
+    static const int COMPLETION_POLL_MS = 5;
+    static const int TIMER_TICK_MS = 100;
+
+    static uint64_t nowMicros() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static uint64_t realtimeMicros() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    uint64_t queuedFor(const Connection &conn) const {
+        if (conn.receivedAt != 0) {
+            uint64_t now = realtimeMicros();
+            return now > conn.receivedAt ? now - conn.receivedAt : 0;
+        }
+        uint64_t now = nowMicros();
+        return now > wokeAt ? now - wokeAt : 0;
+    }
+
+    static uint64_t currentTick() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count() / TIMER_TICK_MS;
+    }
+
+    // `fallback`, shortened to the time left until the next timer tick due.
+    int pollTimeout(int fallback) const {
+        uint64_t next = timers.nextTick();
+        if (next == TimerWheel::NEVER) return fallback;
+        uint64_t now = currentTick();
+        int wait = next <= now ? 0 : (int)std::min<uint64_t>((next - now) * TIMER_TICK_MS, 60000);
+        return fallback < 0 ? wait : std::min(wait, fallback);
+    }
+
+    // Which timeout the connection is subject to in its current state.
+    TimeoutPhase phaseOf(const Connection &conn) const {
+        if (conn.streaming || conn.awaiting) return TimeoutPhase::None;
+        if (!conn.out.empty() || conn.in.empty()) return TimeoutPhase::Idle;
+        return conn.parser.inBody() ? TimeoutPhase::Body : TimeoutPhase::Header;
+    }
+
+    int timeoutMs(TimeoutPhase phase) const {
+        switch (phase) {
+        case TimeoutPhase::Idle: return limits.idleTimeoutMs;
+        case TimeoutPhase::Header: return limits.headerTimeoutMs;
+        case TimeoutPhase::Body: return limits.bodyTimeoutMs;
+        default: return 0;
+        }
+    }
+
+    // Called after every event on a connection. The idle timer restarts
+    // with any activity; the header and body timers only when the
+    // connection moves into that phase.
+    void updateTimer(Connection &conn) {
+        TimeoutPhase phase = phaseOf(conn);
+        if (phase == conn.phase && phase != TimeoutPhase::Idle) return;
+        conn.phase = phase;
+        int ms = timeoutMs(phase);
+        if (ms <= 0) {
+            timers.cancel(conn.timer);
+            return;
+        }
+        timers.schedule(conn.timer, currentTick() + ((uint64_t)ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS);
+    }
+
+    // A request that ran out of time is answered with 408; an idle
+    // connection is just closed. Either way nothing more is read.
+    void expireTimers() {
+        timers.advance(currentTick(), [this](TimerNode &node) {
+            Connection &conn = *(Connection*)node.owner;
+            timeouts()[(int)conn.phase].fetch_add(1, std::memory_order_relaxed);
+            if (conn.phase == TimeoutPhase::Idle) {
+                closeConnection(conn);
+                return;
+            }
+            HttpResponse timedOut;
+            timedOut.status = 408;
+            timedOut.body = "Request timeout";
+            queueResponse(conn, timedOut, false);
+            conn.closeAfterWrite = true;
+            // If the 408 does not fit in the socket, the idle timeout still
+            // bounds how long the connection can linger.
+            if (flush(conn)) updateTimer(conn);
+        });
+    }
+
+    void acceptAll() {
+        while (true) {
+            char peer[INET_ADDRSTRLEN] = {};
+            socket_t client = acceptClient(listener, peer, sizeof(peer));
+            if (client == INVALID_SOCKET_HANDLE) {
+                int err = lastSocketError();
+                if (isInterrupted(err)) continue;
+                return;
+            }
+            if (limits.maxConnections > 0 &&
+                openConnections().load(std::memory_order_relaxed) >= (long long)limits.maxConnections) {
+                refuse(client);
+                continue;
+            }
+            if (!poller.add(client)) {
+                closeSocket(client);
+                continue;
+            }
+            std::unique_ptr<Connection> conn(new Connection());
+            conn->fd = client;
+            conn->id = ++lastConnectionId;
+            memcpy(conn->peer, peer, sizeof(peer));
+            enableReceiveTimestamps(client);
+            conn->parser = RequestParser(limits);
+            conn->timer.owner = conn.get();
+            updateTimer(*conn);
+            connections[client] = std::move(conn);
+            openConnections().fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Best effort: a fresh socket has room for the few bytes, and if not
+    // the client sees the close.
+    void refuse(socket_t client) {
+        static const char RESPONSE[] =
+            "HTTP/1.1 503 Service Unavailable\r\nContent-Type: text/plain\r\nRetry-After: 1\r\n"
+            "Content-Length: 11\r\nConnection: close\r\n\r\nServer busy";
+        ssize_type ignored = sendSome(client, RESPONSE, sizeof(RESPONSE) - 1);
+        (void)ignored;
+        closeSocket(client);
+        refusedConnections().fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void onReadable(Connection &conn) {
+        while (true) {
+            conn.readPending = false;
+            while (true) {
+                if (conn.in.size() >= maxInputBytes) {
+                    conn.readPending = true;
+                    break;
+                }
+                uint64_t received;
+                ssize_type n = recvStamped(conn.fd, scratch, sizeof(scratch), received);
+                if (n > 0) {
+                    conn.in.append(scratch, (size_t)n);
+                    conn.receivedAt = received;
+                    continue;
+                }
+                if (n == 0) {
+                    conn.peerClosed = true;
+                    break;
+                }
+                int err = lastSocketError();
+                if (isInterrupted(err)) continue;
+                if (isWouldBlock(err)) break;
+                closeConnection(conn);
+                return;
+            }
+
+            if (conn.streaming) {
+                // Nothing after the request that opened a stream is answered.
+                conn.in.clear();
+                if (conn.peerClosed) {
+                    closeConnection(conn);
+                    return;
+                }
+                if (conn.readPending) continue;
+                return;
+            }
+
+            size_t buffered = conn.in.size();
+            if (!processInput(conn)) return;
+            // Edge-triggered readiness will not fire again for data we left in
+            // the kernel, so keep going while requests make room in the buffer.
+            if (!conn.readPending || conn.in.size() >= buffered) return;
+        }
+    }
+
+    // Answers every complete request in the input buffer. Returns false when
+    // the connection was closed.
+    bool processInput(Connection &conn) {
+        while (true) {
+            size_t offset = 0;
+            bool blocked = false;
+            while (!conn.closeAfterWrite && !conn.awaiting && !conn.streaming) {
+                if (conn.outBytes >= MAX_PENDING_OUTPUT) {
+                    blocked = true;
+                    break;
+                }
+
+                HttpRequest request;
+                size_t consumed = 0;
+                ParseResult result = conn.parser.parse(&conn.in[offset], conn.in.size() - offset, request, consumed);
+                if (result == ParseResult::Incomplete && conn.in.size() - offset >= maxInputBytes) {
+                    result = ParseResult::BodyTooLarge;
+                }
+                if (result == ParseResult::Incomplete) {
+                    if (conn.peerClosed) conn.closeAfterWrite = true;
+                    break;
+                }
+                if (result != ParseResult::Complete) {
+                    // The rest of the stream cannot be framed, so answer and close.
+                    HttpResponse rejected;
+                    if (result == ParseResult::HeadersTooLarge) {
+                        rejected.status = 431;
+                        rejected.body = "Request headers too large";
+                    } else if (result == ParseResult::BodyTooLarge) {
+                        rejected.status = 413;
+                        rejected.body = "Request too large";
+                    } else {
+                        rejected.status = 400;
+                        rejected.body = "Malformed request";
+                    }
+                    queueResponse(conn, rejected, false);
+                    conn.closeAfterWrite = true;
+                    break;
+                }
+
+                offset += consumed;
+                // The next request gets its own header timeout.
+                conn.phase = TimeoutPhase::None;
+                request.peer = conn.peer;
+                request.queuedMicros = queuedFor(conn);
+                HttpResponse response = handler(request);
+                if (!response.stream.empty()) {
+                    startStream(conn, response);
+                    break;
+                }
+                bool keepAlive = request.keepAlive && !response.close;
+                if (response.deferred) {
+                    std::function<HttpResponse()> work = std::move(response.deferred);
+                    WorkerPool* target = response.deferredPool ? response.deferredPool : pool;
+                    if (!target) {
+                        response = work();
+                    } else if (submit(conn, *target, std::move(work), keepAlive)) {
+                        conn.awaiting = true;
+                        break;
+                    } else {
+                        response = HttpResponse();
+                        response.status = 503;
+                        response.headers = "Retry-After: 1\r\n";
+                        response.body = "Server busy";
+                        busyRejections().fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                queueResponse(conn, response, keepAlive);
+                recycleResponseBuffer(std::move(response.body));
+                recycleResponseBuffer(std::move(response.headers));
+                if (!keepAlive) conn.closeAfterWrite = true;
+            }
+
+            conn.in.erase(0, offset);
+            if (!flush(conn)) return false;
+            if (!blocked || !conn.out.empty()) return true;
+        }
+    }
+
+    bool submit(const Connection &conn, WorkerPool &target, std::function<HttpResponse()> work, bool keepAlive) {
+        std::shared_ptr<CompletionQueue> queue = completions;
+        socket_t fd = conn.fd;
+        uint64_t id = conn.id;
+        bool accepted = target.trySubmit([queue, fd, id, keepAlive, work = std::move(work)]() {
+            queue->push(CompletionQueue::Completion{fd, id, work(), keepAlive});
+        });
+        if (accepted) outstanding++;
+        return accepted;
+    }
+
+    // Sends the deferred responses that are ready and resumes their
+    // connections. Results for connections closed meanwhile are dropped.
+    void finishDeferred() {
+        finished.clear();
+        completions->takeAll(finished);
+        for (CompletionQueue::Completion &c : finished) {
+            outstanding--;
+            auto it = connections.find(c.fd);
+            if (it == connections.end() || it->second->id != c.connectionId) continue;
+            Connection &conn = *it->second;
+            conn.awaiting = false;
+            bool keepAlive = c.keepAlive && !c.response.close;
+            queueResponse(conn, c.response, keepAlive);
+            if (!keepAlive) conn.closeAfterWrite = true;
+            // Picks up requests that were pipelined behind this one.
+            onReadable(conn);
+            if (Connection* open = findConnection(c.fd, c.connectionId)) updateTimer(*open);
+        }
+        finished.clear();
+    }
+
+    // Subscribes the connection to the response's topic and sends the head.
+    // Without a hub the stream simply ends after the head.
+    void startStream(Connection &conn, const HttpResponse &response) {
+        if (!hub) {
+            queueResponse(conn, response, false);
+            conn.closeAfterWrite = true;
+            return;
+        }
+        conn.streaming = true;
+        conn.topic = response.stream;
+        std::vector<Connection*> &subscribers = streams[conn.topic];
+        if (subscribers.empty()) hub->subscribe(conn.topic, inbox);
+        conn.streamSlot = subscribers.size();
+        subscribers.push_back(&conn);
+        hub->subscribers.fetch_add(1, std::memory_order_relaxed);
+        queueResponse(conn, response, true);
+        timers.cancel(conn.timer);
+        conn.phase = TimeoutPhase::None;
+    }
+
+    void dropSubscriber(Connection &conn) {
+        auto it = streams.find(conn.topic);
+        std::vector<Connection*> &subscribers = it->second;
+        Connection* last = subscribers.back();
+        subscribers[conn.streamSlot] = last;
+        last->streamSlot = conn.streamSlot;
+        subscribers.pop_back();
+        if (subscribers.empty()) {
+            streams.erase(it);
+            hub->unsubscribe(conn.topic, inbox.get());
+        }
+        hub->subscribers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Queues each event on the topic's subscribers, sharing the payload.
+    // Connections are flushed and evicted afterwards, by descriptor and id,
+    // so closing one cannot disturb the lists being walked.
+    void deliverEvents() {
+        delivered.clear();
+        inbox->takeAll(delivered);
+        for (const EventInbox::Event &event : delivered) {
+            auto it = streams.find(event.topic);
+            if (it == streams.end()) continue;
+            size_t size = event.payload->size();
+            for (Connection* conn : it->second) {
+                if (conn->closeAfterWrite) continue;
+                if (conn->outBytes + size > MAX_STREAM_BACKLOG) {
+                    conn->closeAfterWrite = true;
+                    evicted.emplace_back(conn->fd, conn->id);
+                    continue;
+                }
+                // A connection with output already queued is waiting for
+                // its socket to drain and will be flushed then.
+                if (conn->out.empty()) touched.emplace_back(conn->fd, conn->id);
+                OutputSegment segment;
+                segment.shared = event.payload;
+                conn->out.push_back(std::move(segment));
+                conn->outBytes += size;
+            }
+        }
+        delivered.clear();
+
+        for (const auto &entry : touched) {
+            if (Connection* conn = findConnection(entry.first, entry.second)) flush(*conn);
+        }
+        for (const auto &entry : evicted) {
+            if (Connection* conn = findConnection(entry.first, entry.second)) {
+                hub->evictions.fetch_add(1, std::memory_order_relaxed);
+                closeConnection(*conn);
+            }
+        }
+        touched.clear();
+        evicted.clear();
+    }
+
+    Connection* findConnection(socket_t fd, uint64_t id) {
+        auto it = connections.find(fd);
+        return it == connections.end() || it->second->id != id ? nullptr : it->second.get();
+    }
+
+    // Headers and owned bodies are coalesced into the last owned segment;
+    // shared bodies are queued by reference. Owned segments come from and
+    // return to the per-thread buffer pool.
+    void queueResponse(Connection &conn, const HttpResponse &response, bool keepAlive) {
+        if (conn.out.empty() || conn.out.back().shared) {
+            conn.out.emplace_back();
+            conn.out.back().owned = takeResponseBuffer();
+        }
+        std::string &tail = conn.out.back().owned;
+        size_t before = tail.size();
+        if (response.sharedBody) {
+            appendResponseHead(tail, response, keepAlive);
+            conn.outBytes += tail.size() - before;
+            if (response.sharedBody->empty()) return;
+            OutputSegment body;
+            body.shared = response.sharedBody;
+            conn.out.push_back(std::move(body));
+            conn.outBytes += response.sharedBody->size();
+        } else {
+            appendResponse(tail, response, keepAlive);
+            conn.outBytes += tail.size() - before;
+        }
+    }
+
+    void consumeOutput(Connection &conn, size_t sent) {
+        conn.outBytes -= sent;
+        while (sent > 0) {
+            size_t remaining = conn.out.front().size() - conn.outOffset;
+            if (sent < remaining) {
+                conn.outOffset += sent;
+                return;
+            }
+            sent -= remaining;
+            recycleResponseBuffer(std::move(conn.out.front().owned));
+            conn.out.pop_front();
+            conn.outOffset = 0;
+        }
+    }
+
+    // Writes as much pending output as the socket accepts, gathering several
+    // segments per call. Returns false when the connection was closed.
+    bool flush(Connection &conn) {
+        bool hadOutput = !conn.out.empty();
+        while (!conn.out.empty()) {
+            IoSlice slices[MAX_IO_SLICES];
+            int count = 0;
+            size_t skip = conn.outOffset;
+            for (auto it = conn.out.begin(); it != conn.out.end() && count < MAX_IO_SLICES; ++it) {
+                slices[count].data = it->data() + skip;
+                slices[count].len = it->size() - skip;
+                count++;
+                skip = 0;
+            }
+            ssize_type n = count == 1 ? sendSome(conn.fd, slices[0].data, slices[0].len)
+                                      : sendVector(conn.fd, slices, count);
+            if (n > 0) {
+                consumeOutput(conn, (size_t)n);
+                continue;
+            }
+            int err = lastSocketError();
+            if (n < 0 && isInterrupted(err)) continue;
+            if (n < 0 && isWouldBlock(err)) {
+                poller.setWantWrite(conn.fd, true);
+                return true;
+            }
+            closeConnection(conn);
+            return false;
+        }
+
+        if (hadOutput) {
+            poller.setWantWrite(conn.fd, false);
+        }
+
+        if (conn.closeAfterWrite) {
+            closeConnection(conn);
+            return false;
+        }
+        return true;
+    }
+
+    void closeConnection(Connection &conn) {
+        if (conn.streaming) dropSubscriber(conn);
+        timers.cancel(conn.timer);
+        socket_t fd = conn.fd;
+        poller.remove(fd);
+        closeSocket(fd);
+        connections.erase(fd);
+        openConnections().fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    socket_t listener;
+    RequestHandler handler;
+    HttpLimits limits;
+    size_t maxInputBytes;
+    WorkerPool* pool;
+    std::shared_ptr<CompletionQueue> completions;
+    std::vector<CompletionQueue::Completion> finished;
+    size_t outstanding = 0;     // deferred jobs submitted and not yet finished
+    EventHub* hub;
+    std::shared_ptr<EventInbox> inbox;
+    std::unordered_map<std::string, std::vector<Connection*>> streams;     // topic -> local subscribers
+    std::vector<EventInbox::Event> delivered;
+    std::vector<std::pair<socket_t, uint64_t>> touched;
+    std::vector<std::pair<socket_t, uint64_t>> evicted;
+    uint64_t lastConnectionId = 0;
+    uint64_t wokeAt = 0;        // when the poller last returned, in microseconds
+    TimerWheel timers;          // in TIMER_TICK_MS ticks
+    Poller poller;
+    std::unordered_map<socket_t, std::unique_ptr<Connection>> connections;
+    char scratch[64 * 1024];
+};
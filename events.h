@@ -0,0 +1,132 @@
+#pragma once
+
+#include "platform.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// Encoded events waiting for the event loop that holds subscribers for
+// their topic. The loop is woken only when the inbox goes from empty to
+// non-empty, so a burst of events costs one wakeup.
+class EventInbox {
+public:
+    struct Event {
+        std::string topic;
+        std::shared_ptr<const std::string> payload;
+    };
+
+#ifdef __linux__
+    EventInbox() : wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+    ~EventInbox() {
+        if (wakeFd >= 0) close(wakeFd);
+    }
+#else
+    EventInbox() {}
+#endif
+    EventInbox(const EventInbox&) = delete;
+    EventInbox& operator=(const EventInbox&) = delete;
+
+    void push(const std::string &topic, const std::shared_ptr<const std::string> &payload) {
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            wake = pending.empty();
+            pending.push_back(Event{topic, payload});
+        }
+#ifdef __linux__
+        if (wake) {
+            uint64_t one = 1;
+            ssize_t ignored = write(wakeFd, &one, sizeof(one));
+            (void)ignored;
+        }
+#else
+        (void)wake;
+#endif
+    }
+
+    void takeAll(std::vector<Event> &out) {
+#ifdef __linux__
+        uint64_t count;
+        ssize_t ignored = read(wakeFd, &count, sizeof(count));
+        (void)ignored;
+#endif
+        std::lock_guard<std::mutex> lock(mutex);
+        out.swap(pending);
+    }
+
+#ifdef __linux__
+    // Becomes readable when events arrive. Elsewhere the loop polls with a
+    // short timeout while it has subscribers.
+    int wakeFd;
+#endif
+
+private:
+    std::mutex mutex;
+    std::vector<Event> pending;
+};
+
+// Routes events published for a topic (here, a username) to the event loops
+// that have subscribers for it. A loop keeps its own list of subscribed
+// connections and registers here only when a topic gains its first local
+// subscriber, so publishing costs one inbox push per interested loop and
+// the payload is encoded once however many connections receive it.
+class EventHub {
+public:
+    void subscribe(const std::string &topic, const std::shared_ptr<EventInbox> &inbox) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::shared_ptr<EventInbox>> &inboxes = topics[topic];
+        if (inboxes.empty()) topicCount.fetch_add(1, std::memory_order_relaxed);
+        inboxes.push_back(inbox);
+    }
+
+    void unsubscribe(const std::string &topic, const EventInbox* inbox) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = topics.find(topic);
+        if (it == topics.end()) return;
+        std::vector<std::shared_ptr<EventInbox>> &inboxes = it->second;
+        inboxes.erase(std::remove_if(inboxes.begin(), inboxes.end(),
+                                     [inbox](const std::shared_ptr<EventInbox> &i) { return i.get() == inbox; }),
+                      inboxes.end());
+        if (inboxes.empty()) {
+            topics.erase(it);
+            topicCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Lets publishers skip encoding an event nobody would receive. Without
+    // any subscriber at all this takes no lock.
+    bool hasSubscribers(const std::string &topic) const {
+        if (topicCount.load(std::memory_order_relaxed) == 0) return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        return topics.count(topic) != 0;
+    }
+
+    void publish(const std::string &topic, std::shared_ptr<const std::string> payload) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = topics.find(topic);
+        if (it == topics.end()) return;
+        for (const std::shared_ptr<EventInbox> &inbox : it->second) inbox->push(topic, payload);
+        published.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Kept up to date by the event loops, for /metrics.
+    std::atomic<long long> subscribers{0};
+    std::atomic<unsigned long long> evictions{0};
+
+    unsigned long long publishedCount() const { return published.load(std::memory_order_relaxed); }
+
+private:
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::vector<std::shared_ptr<EventInbox>>> topics;
+    std::atomic<size_t> topicCount{0};
+    std::atomic<unsigned long long> published{0};
+};
@@ -0,0 +1,144 @@
+// Fuzzes RequestParser by parsing each input twice: all at once, and fed in
+// pieces the way reads arrive, with the buffer reallocated between pieces.
+// Both must frame the same requests with the same fields, and neither may
+// read outside the buffer.
+//
+// With libFuzzer:
+//   clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address,undefined -DTASKBUDDY_LIBFUZZER -I.. request_parser_fuzz.cpp -o request_parser_fuzz
+// Standalone (mutates built-in seeds):
+//   g++ -std=c++17 -g -O1 -fsanitize=address,undefined -I.. request_parser_fuzz.cpp -o request_parser_fuzz
+//   ./request_parser_fuzz [iterations]
+
+#include "http.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Framed {
+    ParseResult result;
+    std::string method, path, query, body, acceptEncoding, ifNoneMatch, authorization;
+    bool keepAlive;
+
+    bool operator==(const Framed &o) const {
+        return result == o.result && method == o.method && path == o.path && query == o.query &&
+               body == o.body && acceptEncoding == o.acceptEncoding && ifNoneMatch == o.ifNoneMatch &&
+               authorization == o.authorization && keepAlive == o.keepAlive;
+    }
+};
+
+Framed capture(ParseResult result, const HttpRequest &r) {
+    Framed f{result, "", "", "", "", "", "", "", false};
+    if (result != ParseResult::Complete) return f;
+    f.method = std::string(r.method);
+    f.path = std::string(r.path);
+    f.query = std::string(r.query);
+    f.body = std::string(r.body);
+    f.acceptEncoding = std::string(r.acceptEncoding);
+    f.ifNoneMatch = std::string(r.ifNoneMatch);
+    f.authorization = std::string(r.authorization);
+    f.keepAlive = r.keepAlive;
+    return f;
+}
+
+// Parses `input` arriving in pieces of the given sizes (the last piece
+// takes the rest), consuming requests the way EventLoop does.
+std::vector<Framed> frame(const std::string &input, const std::vector<size_t> &pieces, HttpLimits limits) {
+    std::vector<Framed> out;
+    RequestParser parser(limits);
+    std::string buffer;
+    size_t fed = 0;
+    size_t piece = 0;
+    while (true) {
+        size_t n = piece < pieces.size() ? pieces[piece++] : input.size() - fed;
+        n = std::min(n, input.size() - fed);
+        // A fresh copy moves the buffer, as a growing std::string may.
+        std::string moved = buffer + input.substr(fed, n);
+        buffer.swap(moved);
+        fed += n;
+        while (true) {
+            HttpRequest request;
+            size_t consumed = 0;
+            ParseResult r = parser.parse(&buffer[0], buffer.size(), request, consumed);
+            if (r == ParseResult::Incomplete) break;
+            out.push_back(capture(r, request));
+            if (r != ParseResult::Complete) return out;
+            if (consumed == 0 || consumed > buffer.size()) abort();
+            buffer.erase(0, consumed);
+        }
+        if (fed == input.size()) break;
+    }
+    return out;
+}
+
+void check(const uint8_t* data, size_t size) {
+    if (size < 2) return;
+    // The first two bytes choose the limits and how the input is split.
+    HttpLimits limits;
+    limits.maxHeaderBytes = 64 + data[0] * 4;
+    limits.maxBodyBytes = 16 + data[1] * 8;
+    std::string input((const char*)data + 2, size - 2);
+
+    std::vector<Framed> whole = frame(input, {}, limits);
+    std::vector<size_t> pieces;
+    uint32_t seed = data[0] * 31u + data[1];
+    for (size_t total = 0; total < input.size();) {
+        seed = seed * 1103515245u + 12345u;
+        size_t n = 1 + (seed >> 16) % 17;
+        pieces.push_back(n);
+        total += n;
+    }
+    std::vector<Framed> split = frame(input, pieces, limits);
+    if (!(whole == split)) {
+        fprintf(stderr, "whole and split parses differ (%zu vs %zu results)\n", whole.size(), split.size());
+        abort();
+    }
+}
+
+} // namespace
+
+#ifdef TASKBUDDY_LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    check(data, size);
+    return 0;
+}
+#else
+int main(int argc, char* argv[]) {
+    const char* seeds[] = {
+        "GET /schedule?since=0 HTTP/1.1\r\nHost: x\r\nIf-None-Match: \"42\"\r\nAuthorization: Bearer YWxpY2U.1.x\r\n\r\n",
+        "POST /add_task HTTP/1.1\r\nContent-Length: 17\r\n\r\n{\"id\":1,\"name\":1}",
+        "POST /batch HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n4\r\n{\"op\r\n3;x=y\r\n\":1\r\n1\r\n}\r\n0\r\nX: y\r\n\r\n",
+        "\r\nGET / HTTP/1.0\r\nConnection: keep-alive, Upgrade\r\nAccept-Encoding: br, gzip\r\n\r\n"
+        "GET /style.css HTTP/1.1\r\nConnection: close\r\n\r\n",
+    };
+    long iterations = argc > 1 ? atol(argv[1]) : 200000;
+    std::mt19937 rng(12345);
+    const char alphabet[] = "\r\n :;,0123456789abcdefABCDEF{}\"/?&=-GETPOSTHTTP/1.1chunkedContent-Length";
+    for (long i = 0; i < iterations; i++) {
+        std::string input = seeds[rng() % (sizeof(seeds) / sizeof(seeds[0]))];
+        if (rng() % 2) input += seeds[rng() % (sizeof(seeds) / sizeof(seeds[0]))];
+        int edits = (int)(rng() % 6);
+        for (int e = 0; e < edits && !input.empty(); e++) {
+            size_t at = rng() % input.size();
+            switch (rng() % 4) {
+                case 0: input[at] = alphabet[rng() % (sizeof(alphabet) - 1)]; break;
+                case 1: input.erase(at, 1 + rng() % 4); break;
+                case 2: input.insert(at, 1, alphabet[rng() % (sizeof(alphabet) - 1)]); break;
+                case 3: input.insert(at, input.substr(rng() % input.size(), rng() % 16)); break;
+            }
+        }
+        std::string data(2, '\0');
+        data[0] = (char)(rng() % 256);
+        data[1] = (char)(rng() % 256);
+        data += input;
+        check((const uint8_t*)data.data(), data.size());
+    }
+    printf("%ld inputs, no differences\n", iterations);
+    return 0;
+}
+#endif
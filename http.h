@@ -0,0 +1,476 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+// Views into the connection's input buffer, valid until the handler
+// returns.
+struct HttpRequest {
+    std::string_view method;
+    std::string_view path;          // target up to any '?'
+    std::string_view query;         // after the '?', still URL-encoded
+    std::string_view body;
+    std::string_view acceptEncoding;
+    std::string_view ifNoneMatch;
+    std::string_view authorization;
+    size_t wireBytes = 0;           // request line, headers and framed body as received
+    bool keepAlive = true;
+    // Filled in by the event loop: the client's address, and how long the
+    // request had been ready before the loop got to it.
+    std::string_view peer;
+    uint64_t queuedMicros = 0;
+};
+
+class WorkerPool;
+
+struct HttpResponse {
+    int status = 200;
+    const char* contentType = "text/plain";
+    const char* fixedHeaders = "";  // constant header lines, each terminated by \r\n
+    std::string headers;            // per-response header lines, same format
+    std::string body;
+    // Sent instead of `body` when set, straight from the shared buffer.
+    std::shared_ptr<const std::string> sharedBody;
+    bool close = false;
+    // Slow work the event loop hands to its worker pool; the response it
+    // returns is sent in place of this one. It runs after the request's
+    // views are gone, so it must own everything it reads.
+    std::function<HttpResponse()> deferred;
+    // Runs `deferred` on this pool instead of the loop's, for work that
+    // waits rather than computes and should not queue behind it.
+    WorkerPool* deferredPool = nullptr;
+    // Set by endpoints that answer with a Server-Sent Events stream: the
+    // head and `body` are sent without a length, and the connection then
+    // stays open receiving every event published to this topic.
+    std::string stream;
+};
+
+inline const char* statusText(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 204: return "No Content";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 408: return "Request Timeout";
+        case 413: return "Payload Too Large";
+        case 429: return "Too Many Requests";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default: return "Unknown";
+    }
+}
+
+// Response bodies and header strings are built in buffers taken from a small
+// per-thread pool and handed back once the response is queued, so a busy
+// loop keeps reusing the same capacity instead of allocating per request.
+namespace httpimpl {
+
+const size_t MAX_POOLED_BUFFERS = 16;
+const size_t MAX_POOLED_CAPACITY = 256 * 1024;
+
+inline std::vector<std::string>& bufferPool() {
+    thread_local std::vector<std::string> pool;
+    return pool;
+}
+
+inline void appendNumber(std::string &out, unsigned long long value) {
+    char digits[24];
+    char* end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+    out.append(digits, end);
+}
+
+} // namespace httpimpl
+
+inline std::string takeResponseBuffer() {
+    std::vector<std::string> &pool = httpimpl::bufferPool();
+    if (pool.empty()) return std::string();
+    std::string buffer = std::move(pool.back());
+    pool.pop_back();
+    buffer.clear();
+    return buffer;
+}
+
+inline void recycleResponseBuffer(std::string &&buffer) {
+    std::vector<std::string> &pool = httpimpl::bufferPool();
+    if (buffer.capacity() <= 15 || buffer.capacity() > httpimpl::MAX_POOLED_CAPACITY) return;
+    if (pool.size() >= httpimpl::MAX_POOLED_BUFFERS) return;
+    if (pool.capacity() == 0) pool.reserve(httpimpl::MAX_POOLED_BUFFERS);
+    pool.push_back(std::move(buffer));
+}
+
+inline size_t bodyLength(const HttpResponse &response) {
+    return response.sharedBody ? response.sharedBody->size() : response.body.size();
+}
+
+// Status line and headers only; 304 and 204 carry no Content-Length.
+inline void appendResponseHead(std::string &out, const HttpResponse &response, bool keepAlive) {
+    out += "HTTP/1.1 ";
+    httpimpl::appendNumber(out, (unsigned long long)response.status);
+    out += ' ';
+    out += statusText(response.status);
+    out += "\r\nContent-Type: ";
+    out += response.contentType;
+    out += "\r\n";
+    out += response.fixedHeaders;
+    out += response.headers;
+    if (response.status != 304 && response.status != 204 && response.stream.empty()) {
+        out += "Content-Length: ";
+        httpimpl::appendNumber(out, bodyLength(response));
+        out += "\r\n";
+    }
+    out += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+}
+
+inline void appendResponse(std::string &out, const HttpResponse &response, bool keepAlive) {
+    appendResponseHead(out, response, keepAlive);
+    if (response.sharedBody) out += *response.sharedBody;
+    else out += response.body;
+}
+
+// Decodes a query-string component: %XX escapes and '+' for space.
+// Malformed escapes are kept as they are.
+inline std::string urlDecode(std::string_view text) {
+    auto hex = [](char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    std::string out;
+    out.reserve(text.size());
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c == '+') {
+            out += ' ';
+        } else if (c == '%' && i + 2 < text.size() && hex(text[i + 1]) >= 0 && hex(text[i + 2]) >= 0) {
+            out += (char)(hex(text[i + 1]) * 16 + hex(text[i + 2]));
+            i += 2;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+inline bool headerEquals(const char* value, size_t len, const char* expected) {
+    size_t n = strlen(expected);
+    if (len != n) return false;
+    for (size_t i = 0; i < n; i++) {
+        char c = value[i];
+        if (c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
+        if (c != expected[i]) return false;
+    }
+    return true;
+}
+
+// True if an If-None-Match value lists `etag` (quoted) or is "*". The
+// comparison is weak, so a W/ prefix is ignored.
+inline bool etagMatches(std::string_view header, std::string_view etag) {
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t end = header.find(',', pos);
+        if (end == std::string_view::npos) end = header.size();
+        std::string_view item = header.substr(pos, end - pos);
+        pos = end + 1;
+        while (!item.empty() && item.front() == ' ') item.remove_prefix(1);
+        while (!item.empty() && item.back() == ' ') item.remove_suffix(1);
+        if (item == "*") return true;
+        if (item.size() > 2 && item[0] == 'W' && item[1] == '/') item.remove_prefix(2);
+        if (item == etag) return true;
+    }
+    return false;
+}
+
+// Finds `name` in a query string and stores its decoded value.
+inline bool findQueryParam(std::string_view query, const char* name, std::string &value) {
+    size_t nameLength = strlen(name);
+    size_t pos = 0;
+    while (pos < query.size()) {
+        size_t end = query.find('&', pos);
+        if (end == std::string_view::npos) end = query.size();
+        std::string_view item = query.substr(pos, end - pos);
+        if (item.size() > nameLength && item.compare(0, nameLength, name) == 0 && item[nameLength] == '=') {
+            value = urlDecode(item.substr(nameLength + 1));
+            return true;
+        }
+        pos = end + 1;
+    }
+    return false;
+}
+
+struct HttpLimits {
+    size_t maxHeaderBytes = 16 * 1024;     // request line and headers; 431 beyond
+    size_t maxBodyBytes = 4 << 20;         // decoded body; 413 beyond
+    // How long a connection may take, in milliseconds; 0 disables. Past the
+    // header or body timeout the client gets a 408.
+    int idleTimeoutMs = 60000;             // between requests, or without write progress
+    int headerTimeoutMs = 10000;           // from a request's first byte to the end of its headers
+    int bodyTimeoutMs = 30000;             // from the end of the headers to the end of the body
+    // Open connections across the process; past it new ones are answered
+    // with 503 and closed. 0 means no limit.
+    size_t maxConnections = 10000;
+};
+
+enum class ParseResult { Complete, Incomplete, Invalid, HeadersTooLarge, BodyTooLarge };
+
+// Resumable HTTP/1.1 request parser. It is fed the bytes of one request as
+// they arrive, always from the request's first byte, and picks up where the
+// previous call stopped, so a request split across reads is scanned once.
+// Positions are kept as offsets because the caller's buffer may move
+// between calls. Chunked bodies are decoded in place, which is why the
+// buffer is writable: the chunk data is moved down to follow the headers,
+// and request.body is a single view over it.
+//
+// On Complete the request's fields are views into the buffer, `consumed`
+// is the number of bytes it occupied (pipelined requests follow it), and
+// the parser is ready for the next request. Any other failure is final for
+// the connection.
+class RequestParser {
+public:
+    explicit RequestParser(HttpLimits limits = HttpLimits()) : limits(limits) {}
+
+    ParseResult parse(char* data, size_t len, HttpRequest &request, size_t &consumed) {
+        while (true) {
+            switch (state) {
+            case RequestLine:
+            case HeaderLine:
+            case Trailer: {
+                // Headers are limited as a whole, trailers line by line. The
+                // limit is checked against where the line ends, so the
+                // outcome does not depend on how the bytes were split.
+                size_t lineEnd;
+                bool found = findLine(data, len, lineEnd);
+                size_t extent = (found ? scanned : len) - (state == Trailer ? pos : 0);
+                if (extent > limits.maxHeaderBytes) return ParseResult::HeadersTooLarge;
+                if (!found) return ParseResult::Incomplete;
+                if (lineEnd == SIZE_MAX) return ParseResult::Invalid;
+                std::string_view line(data + pos, lineEnd - pos);
+                size_t lineStart = pos;
+                pos = lineEnd + 2;
+                if (state == Trailer) {
+                    if (line.empty()) return finish(data, request, consumed);
+                    continue;
+                }
+                ParseResult r = state == RequestLine ? requestLine(line, lineStart) : headerLine(line, lineStart);
+                if (r != ParseResult::Incomplete) return r;
+                if (state == Done) return finish(data, request, consumed);
+                break;
+            }
+            case FixedBody:
+                if (len - bodyStart < contentLength) return ParseResult::Incomplete;
+                bodyLength = contentLength;
+                pos = bodyStart + contentLength;
+                return finish(data, request, consumed);
+            case ChunkSize: {
+                size_t lineEnd;
+                bool found = findLine(data, len, lineEnd);
+                if ((found ? scanned : len) - pos > MAX_CHUNK_LINE) return ParseResult::Invalid;
+                if (!found) return ParseResult::Incomplete;
+                if (lineEnd == SIZE_MAX || lineEnd == pos) return ParseResult::Invalid;
+                size_t size = 0;
+                size_t i = pos;
+                for (; i < lineEnd && data[i] != ';'; i++) {
+                    int digit = hexDigit(data[i]);
+                    if (digit < 0 || size > (SIZE_MAX >> 4)) return ParseResult::Invalid;
+                    size = size * 16 + (size_t)digit;
+                }
+                if (i == pos) return ParseResult::Invalid;
+                pos = lineEnd + 2;
+                if (size == 0) {
+                    state = Trailer;
+                    break;
+                }
+                if (size > limits.maxBodyBytes - bodyLength) return ParseResult::BodyTooLarge;
+                chunkRemaining = size;
+                state = ChunkData;
+                break;
+            }
+            case ChunkData: {
+                size_t available = std::min(len - pos, chunkRemaining);
+                memmove(data + bodyStart + bodyLength, data + pos, available);
+                bodyLength += available;
+                pos += available;
+                chunkRemaining -= available;
+                if (chunkRemaining > 0) return ParseResult::Incomplete;
+                state = ChunkEnd;
+                break;
+            }
+            case ChunkEnd:
+                if (len - pos < 2) return ParseResult::Incomplete;
+                if (data[pos] != '\r' || data[pos + 1] != '\n') return ParseResult::Invalid;
+                pos += 2;
+                state = ChunkSize;
+                break;
+            case Done:
+                return finish(data, request, consumed);
+            }
+        }
+    }
+
+    void reset() {
+        *this = RequestParser(limits);
+    }
+
+    // Whether the request being parsed has all its headers and is waiting
+    // for (the rest of) its body.
+    bool inBody() const {
+        return state != RequestLine && state != HeaderLine;
+    }
+
+private:
+    static const size_t MAX_CHUNK_LINE = 1024;
+
+    enum State { RequestLine, HeaderLine, FixedBody, ChunkSize, ChunkData, ChunkEnd, Trailer, Done };
+
+    struct Span {
+        size_t start = 0;
+        size_t length = 0;
+        std::string_view in(const char* data) const { return std::string_view(data + start, length); }
+    };
+
+    static int hexDigit(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    // Finds the CRLF ending the line at `pos`, resuming the search where the
+    // last call gave up. lineEnd is SIZE_MAX for a bare LF.
+    bool findLine(const char* data, size_t len, size_t &lineEnd) {
+        size_t from = std::max(pos, scanned);
+        const char* nl = from < len ? (const char*)memchr(data + from, '\n', len - from) : nullptr;
+        if (!nl) {
+            scanned = len;
+            return false;
+        }
+        size_t at = nl - data;
+        scanned = at + 1;
+        lineEnd = (at > pos && data[at - 1] == '\r') ? at - 1 : SIZE_MAX;
+        return true;
+    }
+
+    ParseResult requestLine(std::string_view line, size_t start) {
+        // Empty lines before a request are allowed and skipped.
+        if (line.empty()) return ParseResult::Incomplete;
+        size_t methodEnd = line.find(' ');
+        if (methodEnd == std::string_view::npos || methodEnd == 0) return ParseResult::Invalid;
+        size_t targetEnd = line.find(' ', methodEnd + 1);
+        if (targetEnd == std::string_view::npos || targetEnd == methodEnd + 1) return ParseResult::Invalid;
+        std::string_view version = line.substr(targetEnd + 1);
+        if (version == "HTTP/1.1") keepAlive = true;
+        else if (version == "HTTP/1.0") keepAlive = false;
+        else return ParseResult::Invalid;
+        method = Span{start, methodEnd};
+        target = Span{start + methodEnd + 1, targetEnd - methodEnd - 1};
+        state = HeaderLine;
+        return ParseResult::Incomplete;
+    }
+
+    ParseResult headerLine(std::string_view line, size_t start) {
+        if (line.empty()) return endOfHeaders();
+        // Folded continuation lines are obsolete and a smuggling vector.
+        if (line[0] == ' ' || line[0] == '\t') return ParseResult::Invalid;
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos || colon == 0) return ParseResult::Invalid;
+        if (line[colon - 1] == ' ' || line[colon - 1] == '\t') return ParseResult::Invalid;
+        size_t value = colon + 1;
+        size_t valueEnd = line.size();
+        while (value < valueEnd && (line[value] == ' ' || line[value] == '\t')) value++;
+        while (valueEnd > value && (line[valueEnd - 1] == ' ' || line[valueEnd - 1] == '\t')) valueEnd--;
+        const char* name = line.data();
+        std::string_view v = line.substr(value, valueEnd - value);
+
+        if (headerEquals(name, colon, "content-length")) {
+            size_t n = 0;
+            std::from_chars_result r = std::from_chars(v.data(), v.data() + v.size(), n);
+            if (v.empty() || r.ec != std::errc() || r.ptr != v.data() + v.size()) return ParseResult::Invalid;
+            if (hasContentLength && n != contentLength) return ParseResult::Invalid;
+            hasContentLength = true;
+            contentLength = n;
+        } else if (headerEquals(name, colon, "transfer-encoding")) {
+            if (!headerEquals(v.data(), v.size(), "chunked") || chunked) return ParseResult::Invalid;
+            chunked = true;
+        } else if (headerEquals(name, colon, "connection")) {
+            size_t from = 0;
+            while (from <= v.size()) {
+                size_t end = v.find(',', from);
+                if (end == std::string_view::npos) end = v.size();
+                std::string_view token = v.substr(from, end - from);
+                while (!token.empty() && token.front() == ' ') token.remove_prefix(1);
+                while (!token.empty() && token.back() == ' ') token.remove_suffix(1);
+                if (headerEquals(token.data(), token.size(), "close")) keepAlive = false;
+                else if (headerEquals(token.data(), token.size(), "keep-alive")) keepAlive = true;
+                from = end + 1;
+            }
+        } else if (headerEquals(name, colon, "accept-encoding")) {
+            acceptEncoding = Span{start + value, v.size()};
+        } else if (headerEquals(name, colon, "if-none-match")) {
+            ifNoneMatch = Span{start + value, v.size()};
+        } else if (headerEquals(name, colon, "authorization")) {
+            authorization = Span{start + value, v.size()};
+        }
+        return ParseResult::Incomplete;
+    }
+
+    ParseResult endOfHeaders() {
+        bodyStart = pos;
+        // A length alongside chunked framing is how requests get smuggled.
+        if (chunked && hasContentLength) return ParseResult::Invalid;
+        if (chunked) {
+            state = ChunkSize;
+        } else if (contentLength > 0) {
+            if (contentLength > limits.maxBodyBytes) return ParseResult::BodyTooLarge;
+            state = FixedBody;
+        } else {
+            state = Done;
+        }
+        return ParseResult::Incomplete;
+    }
+
+    ParseResult finish(const char* data, HttpRequest &request, size_t &consumed) {
+        std::string_view t = target.in(data);
+        size_t question = t.find('?');
+        request.method = method.in(data);
+        request.path = t.substr(0, question);
+        request.query = question == std::string_view::npos ? std::string_view() : t.substr(question + 1);
+        request.body = std::string_view(data + bodyStart, bodyLength);
+        request.acceptEncoding = acceptEncoding.in(data);
+        request.ifNoneMatch = ifNoneMatch.in(data);
+        request.authorization = authorization.in(data);
+        request.keepAlive = keepAlive;
+        request.wireBytes = pos;
+        consumed = pos;
+        reset();
+        return ParseResult::Complete;
+    }
+
+    HttpLimits limits;
+    State state = RequestLine;
+    size_t pos = 0;             // first byte not yet parsed
+    size_t scanned = 0;         // bytes already searched for a line end
+    Span method;
+    Span target;
+    Span acceptEncoding;
+    Span ifNoneMatch;
+    Span authorization;
+    bool keepAlive = true;
+    bool chunked = false;
+    bool hasContentLength = false;
+    size_t contentLength = 0;
+    size_t bodyStart = 0;
+    size_t bodyLength = 0;      // decoded body bytes so far
+    size_t chunkRemaining = 0;
+};
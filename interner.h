@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Process-wide table of the strings that repeat across many tasks:
+// usernames, categories, priorities and deadlines that are not plain dates.
+// Each distinct string gets a 32-bit id on first use. Ids are never reused
+// and strings never freed, so text() takes no lock and its result stays
+// valid for the life of the process.
+//
+// Strings clients send go through tryIntern(), which stops adding once the
+// table holds BUDGET_BYTES, so a client inventing endless categories cannot
+// grow it without bound. Strings already stored (loaded data, usernames)
+// use intern(), which is only limited by the id space.
+//
+// The first ids are fixed: "" is EMPTY and the three priorities the client
+// offers are HIGH, MEDIUM and LOW, in rank order.
+class StringInterner {
+public:
+    static const uint32_t EMPTY = 0;
+    static const uint32_t HIGH = 1;
+    static const uint32_t MEDIUM = 2;
+    static const uint32_t LOW = 3;
+
+    static StringInterner& instance() {
+        static StringInterner interner;
+        return interner;
+    }
+
+    ~StringInterner() {
+        for (std::string_view* chunk : chunks) delete[] chunk;
+    }
+
+    StringInterner(const StringInterner&) = delete;
+    StringInterner& operator=(const StringInterner&) = delete;
+
+    uint32_t intern(std::string_view s) {
+        uint32_t id;
+        if (find(s, id)) return id;
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (!addLocked(s, SIZE_MAX, id)) throw std::length_error("string interner is full");
+        return id;
+    }
+
+    // Like intern(), but false instead of adding `s` once the table holds
+    // BUDGET_BYTES. Never throws.
+    bool tryIntern(std::string_view s, uint32_t &id) {
+        if (find(s, id)) return true;
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        return addLocked(s, BUDGET_BYTES, id);
+    }
+
+    // Looks a string up without adding it, for values that come from
+    // queries rather than from stored tasks.
+    bool find(std::string_view s, uint32_t &id) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = ids.find(s);
+        if (it == ids.end()) return false;
+        id = it->second;
+        return true;
+    }
+
+    // `id` must have come from intern(). Whoever handed it over published
+    // it after interning, so the chunk it lives in is visible here.
+    std::string_view text(uint32_t id) const {
+        return chunks[id / CHUNK][id % CHUNK];
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return count;
+    }
+
+    // Bytes the table may hold before tryIntern() refuses new strings,
+    // counting ENTRY_BYTES for each string's bookkeeping.
+    static constexpr size_t BUDGET_BYTES = 64 << 20;
+
+private:
+    static const uint32_t CHUNK = 4096;
+    static const uint32_t MAX_CHUNKS = 65536;
+    static constexpr size_t ENTRY_BYTES = 64;
+
+    // Adds `s` unless it is there already; false if that would take the
+    // table past `limit` bytes or out of ids.
+    bool addLocked(std::string_view s, size_t limit, uint32_t &id) {
+        auto it = ids.find(s);
+        if (it != ids.end()) {
+            id = it->second;
+            return true;
+        }
+        size_t cost = s.size() + ENTRY_BYTES;
+        if (count == (size_t)CHUNK * MAX_CHUNKS || cost > limit || bytes > limit - cost) return false;
+        id = (uint32_t)count;
+        storage.emplace_back(s);
+        std::string_view stored = storage.back();
+        if (id % CHUNK == 0) chunks[id / CHUNK] = new std::string_view[CHUNK];
+        chunks[id / CHUNK][id % CHUNK] = stored;
+        ids.emplace(stored, id);
+        count++;
+        bytes += cost;
+        return true;
+    }
+
+    StringInterner() {
+        for (const char* s : {"", "High", "Medium", "Low"}) intern(s);
+    }
+
+    mutable std::shared_mutex mutex;
+    std::deque<std::string> storage;    // deque: elements never move
+    std::unordered_map<std::string_view, uint32_t> ids;
+    std::string_view* chunks[MAX_CHUNKS] = {};
+    size_t count = 0;
+    size_t bytes = 0;
+};
@@ -0,0 +1,647 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// JSON parser in two stages, after simdjson. Stage one classifies 64 bytes
+// at a time with SIMD compares and produces the offsets of every structural
+// character outside strings, every unescaped quote and every scalar start.
+// Stage two walks only those offsets and builds a flat token array in which
+// each value knows where its successor starts, so lookups skip whole
+// subtrees. Strings stay in the input; escapes are decoded on demand.
+//
+// A JsonDocument reuses its buffers, so parsing in a long-lived (e.g.
+// thread_local) document does not allocate once it has warmed up.
+
+enum class JsonType : uint8_t { Null, Bool, Number, String, Object, Array };
+
+struct JsonToken {
+    JsonType type;
+    bool escaped;       // string contains backslash escapes
+    uint32_t start;     // strings: first byte after the opening quote
+    uint32_t end;       // strings: the closing quote; others: one past the end
+    uint32_t next;      // index of the token after this value and its children
+};
+
+namespace jsonimpl {
+
+struct BlockMasks {
+    uint64_t backslash;
+    uint64_t quote;
+    uint64_t op;            // { } [ ] : ,
+    uint64_t whitespace;
+    uint64_t control;       // bytes below 0x20, which strings must escape
+};
+
+#if defined(__AVX2__)
+inline uint64_t eq64(__m256i lo, __m256i hi, char c) {
+    __m256i v = _mm256_set1_epi8(c);
+    uint32_t a = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, v));
+    uint32_t b = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, v));
+    return (uint64_t)a | ((uint64_t)b << 32);
+}
+
+inline BlockMasks classify(const char* p) {
+    __m256i lo = _mm256_loadu_si256((const __m256i*)p);
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+    BlockMasks m;
+    m.backslash = eq64(lo, hi, '\\');
+    m.quote = eq64(lo, hi, '"');
+    // '{' and '}' differ from '[' and ']' only in bit 5, so folding that bit
+    // lets one compare cover each pair.
+    __m256i fold = _mm256_set1_epi8(0x20);
+    __m256i loF = _mm256_or_si256(lo, fold);
+    __m256i hiF = _mm256_or_si256(hi, fold);
+    m.op = eq64(loF, hiF, '{') | eq64(loF, hiF, '}') | eq64(lo, hi, ':') | eq64(lo, hi, ',');
+    m.whitespace = eq64(lo, hi, ' ') | eq64(lo, hi, '\n') | eq64(lo, hi, '\r') | eq64(lo, hi, '\t');
+    // Unsigned v <= 0x1F exactly when min(v, 0x1F) == v.
+    __m256i limit = _mm256_set1_epi8(0x1F);
+    uint32_t a = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(lo, limit), lo));
+    uint32_t b = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(hi, limit), hi));
+    m.control = (uint64_t)a | ((uint64_t)b << 32);
+    return m;
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+inline uint64_t eq64(const __m128i v[4], char c) {
+    __m128i k = _mm_set1_epi8(c);
+    uint64_t r = 0;
+    for (int i = 0; i < 4; i++) {
+        r |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v[i], k)) << (16 * i);
+    }
+    return r;
+}
+
+inline BlockMasks classify(const char* p) {
+    __m128i v[4], f[4];
+    __m128i fold = _mm_set1_epi8(0x20);
+    for (int i = 0; i < 4; i++) {
+        v[i] = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+        f[i] = _mm_or_si128(v[i], fold);
+    }
+    BlockMasks m;
+    m.backslash = eq64(v, '\\');
+    m.quote = eq64(v, '"');
+    m.op = eq64(f, '{') | eq64(f, '}') | eq64(v, ':') | eq64(v, ',');
+    m.whitespace = eq64(v, ' ') | eq64(v, '\n') | eq64(v, '\r') | eq64(v, '\t');
+    __m128i limit = _mm_set1_epi8(0x1F);
+    m.control = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i low = _mm_cmpeq_epi8(_mm_min_epu8(v[i], limit), v[i]);
+        m.control |= (uint64_t)(uint16_t)_mm_movemask_epi8(low) << (16 * i);
+    }
+    return m;
+}
+#else
+inline BlockMasks classify(const char* p) {
+    BlockMasks m = {0, 0, 0, 0, 0};
+    for (int i = 0; i < 64; i++) {
+        uint64_t bit = 1ULL << i;
+        if ((unsigned char)p[i] < 0x20) m.control |= bit;
+        switch (p[i]) {
+            case '\\': m.backslash |= bit; break;
+            case '"': m.quote |= bit; break;
+            case '{': case '}': case '[': case ']': case ':': case ',': m.op |= bit; break;
+            case ' ': case '\n': case '\r': case '\t': m.whitespace |= bit; break;
+            default: break;
+        }
+    }
+    return m;
+}
+#endif
+
+// Bit i of the result is the XOR of bits 0..i: 1 from an opening quote up
+// to, but not including, its closing quote.
+inline uint64_t prefixXor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+inline int countTrailingZeros(uint64_t x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+inline bool isScalarEnd(char c) {
+    return c == ',' || c == '}' || c == ']' || c == ':' || c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '"';
+}
+
+inline int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+inline bool readHex4(const char* p, const char* end, uint32_t &out) {
+    if (end - p < 4) return false;
+    out = 0;
+    for (int i = 0; i < 4; i++) {
+        int h = hexValue(p[i]);
+        if (h < 0) return false;
+        out = (out << 4) | (uint32_t)h;
+    }
+    return true;
+}
+
+inline void appendUtf8(std::string &out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += (char)cp;
+    } else if (cp < 0x800) {
+        out += (char)(0xC0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += (char)(0xE0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else {
+        out += (char)(0xF0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3F));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+// Decodes the escapes in a string body. Returns false on an invalid escape
+// or an unpaired surrogate.
+inline bool unescape(const char* p, const char* end, std::string &out) {
+    out.clear();
+    while (p < end) {
+        const char* bs = (const char*)memchr(p, '\\', end - p);
+        if (!bs) {
+            out.append(p, end);
+            return true;
+        }
+        out.append(p, bs);
+        if (bs + 1 >= end) return false;
+        char c = bs[1];
+        p = bs + 2;
+        switch (c) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                uint32_t cp;
+                if (!readHex4(p, end, cp)) return false;
+                p += 4;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    uint32_t low;
+                    if (end - p < 6 || p[0] != '\\' || p[1] != 'u' || !readHex4(p + 2, end, low) ||
+                        low < 0xDC00 || low > 0xDFFF) {
+                        return false;
+                    }
+                    p += 6;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    return false;
+                }
+                appendUtf8(out, cp);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+inline bool validNumber(const char* p, const char* end) {
+    if (p < end && *p == '-') p++;
+    if (p == end) return false;
+    if (*p == '0') {
+        p++;
+    } else if (*p >= '1' && *p <= '9') {
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    } else {
+        return false;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        if (p == end || *p < '0' || *p > '9') return false;
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        if (p == end || *p < '0' || *p > '9') return false;
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    }
+    return p == end;
+}
+
+} // namespace jsonimpl
+
+class JsonDocument;
+
+// Read-only view of one value in a parsed JsonDocument. Default-constructed
+// and not-found values are invalid; every accessor on them fails softly.
+class JsonValue {
+public:
+    JsonValue() {}
+
+    bool valid() const { return doc != nullptr; }
+    JsonType type() const;
+    bool isNull() const { return valid() && type() == JsonType::Null; }
+    bool isObject() const { return valid() && type() == JsonType::Object; }
+    bool isArray() const { return valid() && type() == JsonType::Array; }
+    bool isString() const { return valid() && type() == JsonType::String; }
+
+    // Accepts a JSON integer or a string holding one, as older clients sent
+    // ids both ways.
+    bool getInt64(long long &out) const;
+    bool getBool(bool &out) const;
+
+    // Decoded string. The view points into the document when the string has
+    // no escapes and into `scratch` otherwise.
+    bool getString(std::string_view &out, std::string &scratch) const;
+    // Convenience copy; returns `fallback` if this is not a string.
+    std::string string(const std::string &fallback = "") const;
+
+    // Object member lookup; invalid if absent or not an object.
+    JsonValue operator[](std::string_view key) const;
+
+    // First element of an array or first value of an object; then next().
+    JsonValue first() const;
+    JsonValue next() const;
+    // Key of an object member obtained through first()/next().
+    std::string_view rawKey() const;
+
+    // Bytes of the value exactly as they appear in the input.
+    std::string_view raw() const;
+
+private:
+    friend class JsonDocument;
+    JsonValue(const JsonDocument* doc, uint32_t index, uint32_t limit, bool member)
+        : doc(doc), index(index), limit(limit), member(member) {}
+
+    const JsonToken &token() const;
+
+    const JsonDocument* doc = nullptr;
+    uint32_t index = 0;
+    uint32_t limit = 0;     // `next` of the enclosing container
+    bool member = false;    // value of an object member; the key precedes it
+};
+
+class JsonDocument {
+public:
+    static const size_t MAX_DEPTH = 1024;
+
+    // Parses `input`, which must outlive every JsonValue taken from this
+    // document. Returns false and sets error() on malformed input.
+    bool parse(std::string_view input) {
+        text = input;
+        tokens.clear();
+        structurals.clear();
+        errorMessage = nullptr;
+        if (input.size() >= UINT32_MAX) return fail("document too large");
+        if (!indexStructurals()) return false;
+        return buildTokens();
+    }
+
+    JsonValue root() const {
+        return tokens.empty() ? JsonValue() : JsonValue(this, 0, (uint32_t)tokens.size(), false);
+    }
+
+    const char* error() const { return errorMessage ? errorMessage : ""; }
+
+    // Structural offsets found by stage one; exposed for benchmarks.
+    size_t structuralCount() const { return structurals.size(); }
+
+private:
+    friend class JsonValue;
+
+    bool fail(const char* message) {
+        errorMessage = message;
+        tokens.clear();
+        return false;
+    }
+
+    bool indexStructurals() {
+        using namespace jsonimpl;
+        const char* data = text.data();
+        size_t len = text.size();
+        structurals.reserve(len / 4 + 8);
+
+        uint64_t prevEscaped = 0;
+        uint64_t prevInString = 0;
+        uint64_t prevScalar = 0;
+        uint64_t rawControl = 0;
+        char tail[64];
+
+        for (size_t base = 0; base < len; base += 64) {
+            const char* block = data + base;
+            if (len - base < 64) {
+                memset(tail, ' ', sizeof(tail));
+                memcpy(tail, block, len - base);
+                block = tail;
+            }
+            BlockMasks m = classify(block);
+
+            // Escaped characters: every character preceded by an odd-length
+            // run of backslashes, carried across block boundaries.
+            uint64_t backslash = m.backslash & ~prevEscaped;
+            uint64_t followsEscape = (backslash << 1) | prevEscaped;
+            const uint64_t evenBits = 0x5555555555555555ULL;
+            uint64_t oddStarts = backslash & ~evenBits & ~followsEscape;
+            uint64_t evenSequences = oddStarts + backslash;
+            prevEscaped = evenSequences < oddStarts ? 1 : 0;
+            uint64_t invertMask = evenSequences << 1;
+            uint64_t escaped = (evenBits ^ invertMask) & followsEscape;
+
+            uint64_t quote = m.quote & ~escaped;
+            uint64_t inString = prefixXor(quote) ^ prevInString;
+            prevInString = (uint64_t)((int64_t)inString >> 63);
+            // RFC 8259 requires control characters in strings to be escaped;
+            // a raw one would end up in task names, logs and event streams.
+            rawControl |= m.control & inString;
+
+            uint64_t op = m.op & ~inString;
+            uint64_t scalar = ~(m.op | m.whitespace | quote) & ~inString;
+            uint64_t scalarStart = scalar & ~((scalar << 1) | prevScalar);
+            prevScalar = scalar >> 63;
+
+            uint64_t bits = op | quote | scalarStart;
+            if (len - base < 64) bits &= (1ULL << (len - base)) - 1;
+            while (bits) {
+                structurals.push_back((uint32_t)(base + countTrailingZeros(bits)));
+                bits &= bits - 1;
+            }
+        }
+        if (prevInString != 0) return fail("unterminated string");
+        if (rawControl != 0) return fail("unescaped control character in string");
+        return true;
+    }
+
+    uint32_t addToken(JsonType type, uint32_t start, uint32_t end) {
+        JsonToken t;
+        t.type = type;
+        t.escaped = false;
+        t.start = start;
+        t.end = end;
+        t.next = (uint32_t)tokens.size() + 1;
+        tokens.push_back(t);
+        return (uint32_t)tokens.size() - 1;
+    }
+
+    // Stage one guarantees the closing quote is the next structural.
+    bool parseString(size_t &i) {
+        if (i + 1 >= structurals.size() || text[structurals[i]] != '"') return false;
+        uint32_t open = structurals[i];
+        uint32_t close = structurals[i + 1];
+        uint32_t t = addToken(JsonType::String, open + 1, close);
+        if (memchr(text.data() + open + 1, '\\', close - open - 1)) {
+            tokens[t].escaped = true;
+            if (!jsonimpl::unescape(text.data() + open + 1, text.data() + close, scratch)) return false;
+        }
+        i += 2;
+        return true;
+    }
+
+    bool parseScalar(size_t &i) {
+        uint32_t start = structurals[i];
+        uint32_t end = start;
+        while (end < text.size() && !jsonimpl::isScalarEnd(text[end])) end++;
+        std::string_view s = text.substr(start, end - start);
+        JsonType type;
+        if (s == "true" || s == "false") type = JsonType::Bool;
+        else if (s == "null") type = JsonType::Null;
+        else if (jsonimpl::validNumber(s.data(), s.data() + s.size())) type = JsonType::Number;
+        else return false;
+        addToken(type, start, end);
+        i++;
+        return true;
+    }
+
+    // Parses `"key" :` for the next object member.
+    bool parseKey(size_t &i) {
+        if (i >= structurals.size() || text[structurals[i]] != '"' || !parseString(i)) return false;
+        if (i >= structurals.size() || text[structurals[i]] != ':') return false;
+        i++;
+        return true;
+    }
+
+    bool buildTokens() {
+        size_t n = structurals.size();
+        size_t i = 0;
+        stack.clear();
+        if (n == 0) return fail("empty document");
+
+        bool expectValue = true;
+        while (true) {
+            if (expectValue) {
+                if (i >= n) return fail("unexpected end of document");
+                uint32_t at = structurals[i];
+                char c = text[at];
+                if (c == '{' || c == '[') {
+                    if (stack.size() >= MAX_DEPTH) return fail("nesting too deep");
+                    bool object = (c == '{');
+                    stack.push_back(addToken(object ? JsonType::Object : JsonType::Array, at, 0));
+                    i++;
+                    if (i < n && text[structurals[i]] == (object ? '}' : ']')) {
+                        closeContainer(i);
+                        expectValue = false;
+                    } else if (object && !parseKey(i)) {
+                        return fail("expected object key");
+                    }
+                    continue;
+                }
+                if (c == '"') {
+                    if (!parseString(i)) return fail("invalid string");
+                } else if (c == '}' || c == ']' || c == ',' || c == ':') {
+                    return fail("expected a value");
+                } else if (!parseScalar(i)) {
+                    return fail("invalid literal");
+                }
+                expectValue = false;
+            }
+
+            if (stack.empty()) {
+                if (i != n) return fail("trailing content after document");
+                return true;
+            }
+            if (i >= n) return fail("unexpected end of document");
+
+            char c = text[structurals[i]];
+            bool object = tokens[stack.back()].type == JsonType::Object;
+            if (c == ',') {
+                i++;
+                if (object && !parseKey(i)) return fail("expected object key");
+                expectValue = true;
+            } else if (c == (object ? '}' : ']')) {
+                closeContainer(i);
+            } else {
+                return fail("expected ',' or closing bracket");
+            }
+        }
+    }
+
+    void closeContainer(size_t &i) {
+        JsonToken &t = tokens[stack.back()];
+        t.end = structurals[i] + 1;
+        t.next = (uint32_t)tokens.size();
+        stack.pop_back();
+        i++;
+    }
+
+    std::string_view text;
+    std::vector<uint32_t> structurals;
+    std::vector<JsonToken> tokens;
+    std::vector<uint32_t> stack;
+    std::string scratch;
+    const char* errorMessage = nullptr;
+};
+
+inline const JsonToken &JsonValue::token() const {
+    return doc->tokens[index];
+}
+
+inline JsonType JsonValue::type() const {
+    return token().type;
+}
+
+inline std::string_view JsonValue::raw() const {
+    if (!valid()) return std::string_view();
+    const JsonToken &t = token();
+    if (t.type == JsonType::String) return doc->text.substr(t.start - 1, t.end - t.start + 2);
+    return doc->text.substr(t.start, t.end - t.start);
+}
+
+inline bool JsonValue::getInt64(long long &out) const {
+    if (!valid()) return false;
+    const JsonToken &t = token();
+    if (t.type != JsonType::Number && t.type != JsonType::String) return false;
+    const char* begin = doc->text.data() + t.start;
+    const char* end = doc->text.data() + t.end;
+    std::from_chars_result r = std::from_chars(begin, end, out);
+    return r.ec == std::errc() && r.ptr == end && begin != end;
+}
+
+inline bool JsonValue::getBool(bool &out) const {
+    if (!valid() || type() != JsonType::Bool) return false;
+    out = doc->text[token().start] == 't';
+    return true;
+}
+
+inline bool JsonValue::getString(std::string_view &out, std::string &scratch) const {
+    if (!valid() || type() != JsonType::String) return false;
+    const JsonToken &t = token();
+    const char* begin = doc->text.data() + t.start;
+    const char* end = doc->text.data() + t.end;
+    if (!t.escaped) {
+        out = std::string_view(begin, end - begin);
+        return true;
+    }
+    jsonimpl::unescape(begin, end, scratch);
+    out = scratch;
+    return true;
+}
+
+inline std::string JsonValue::string(const std::string &fallback) const {
+    std::string scratch;
+    std::string_view view;
+    if (!getString(view, scratch)) return fallback;
+    return std::string(view);
+}
+
+inline JsonValue JsonValue::operator[](std::string_view key) const {
+    if (!isObject()) return JsonValue();
+    const JsonToken &obj = token();
+    std::string scratch;
+    for (uint32_t k = index + 1; k < obj.next; k = doc->tokens[k + 1].next) {
+        const JsonToken &keyToken = doc->tokens[k];
+        std::string_view name(doc->text.data() + keyToken.start, keyToken.end - keyToken.start);
+        if (keyToken.escaped) {
+            jsonimpl::unescape(name.data(), name.data() + name.size(), scratch);
+            name = scratch;
+        }
+        if (name == key) return JsonValue(doc, k + 1, obj.next, true);
+    }
+    return JsonValue();
+}
+
+inline JsonValue JsonValue::first() const {
+    if (!isObject() && !isArray()) return JsonValue();
+    const JsonToken &t = token();
+    uint32_t child = index + 1;
+    if (child >= t.next) return JsonValue();
+    bool object = t.type == JsonType::Object;
+    if (object) child++;    // skip the key
+    return JsonValue(doc, child, t.next, object);
+}
+
+inline JsonValue JsonValue::next() const {
+    if (!valid()) return JsonValue();
+    uint32_t sibling = token().next;
+    if (sibling >= limit) return JsonValue();
+    // Inside an object the sibling is a key; the value follows it.
+    return JsonValue(doc, member ? sibling + 1 : sibling, limit, member);
+}
+
+inline std::string_view JsonValue::rawKey() const {
+    if (!valid() || !member) return std::string_view();
+    const JsonToken &k = doc->tokens[index - 1];
+    return doc->text.substr(k.start, k.end - k.start);
+}
+
+inline void appendInteger(std::string &out, long long value) {
+    char digits[24];
+    std::to_chars_result r = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, r.ptr - digits);
+}
+
+// Escapes `s` for inclusion between double quotes in JSON output.
+inline void appendJsonEscaped(std::string &out, std::string_view s) {
+    static const char HEX[] = "0123456789abcdef";
+    size_t run = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        out.append(s.data() + run, i - run);
+        run = i + 1;
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            default:
+                out += "\\u00";
+                out += HEX[c >> 4];
+                out += HEX[c & 0xF];
+        }
+    }
+    out.append(s.data() + run, s.size() - run);
+}
+
+inline std::string jsonEscape(std::string_view s) {
+    std::string out;
+    out.reserve(s.size());
+    appendJsonEscaped(out, s);
+    return out;
+}
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+enum class LogLevel { Debug, Info, Warn, Error, Off };
+
+inline bool parseLogLevel(const std::string &name, LogLevel &level) {
+    if (name == "debug") level = LogLevel::Debug;
+    else if (name == "info") level = LogLevel::Info;
+    else if (name == "warn") level = LogLevel::Warn;
+    else if (name == "error") level = LogLevel::Error;
+    else if (name == "off") level = LogLevel::Off;
+    else return false;
+    return true;
+}
+
+class Logger;
+
+// One log line under construction, in logfmt: the message, then key=value
+// fields. It is built in place and handed to the logger when it goes out of
+// scope, so a whole line costs one bounded copy and no allocation. A line
+// for a disabled level does nothing. Lines longer than the slot are cut.
+class LogEntry {
+public:
+    static const size_t CAPACITY = 240;
+
+    LogEntry(Logger *logger, LogLevel level, const char* message) : logger(logger), level(level) {
+        if (logger) text("msg=", 4).value(message);
+    }
+
+    ~LogEntry();
+
+    LogEntry(const LogEntry&) = delete;
+    LogEntry& operator=(const LogEntry&) = delete;
+
+    LogEntry &kv(const char* key, std::string_view value) {
+        if (logger) field(key).value(value);
+        return *this;
+    }
+
+    LogEntry &kv(const char* key, const char* value) { return kv(key, std::string_view(value)); }
+    LogEntry &kv(const char* key, const std::string &value) { return kv(key, std::string_view(value)); }
+
+    LogEntry &kv(const char* key, long long value) {
+        if (!logger) return *this;
+        field(key);
+        char digits[24];
+        char* end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+        return text(digits, end - digits);
+    }
+
+    LogEntry &kv(const char* key, unsigned long long value) { return kv(key, (long long)value); }
+    LogEntry &kv(const char* key, int value) { return kv(key, (long long)value); }
+    LogEntry &kv(const char* key, unsigned value) { return kv(key, (long long)value); }
+    LogEntry &kv(const char* key, long value) { return kv(key, (long long)value); }
+    LogEntry &kv(const char* key, unsigned long value) { return kv(key, (long long)value); }
+
+private:
+    LogEntry &text(const char* s, size_t n) {
+        n = std::min(n, CAPACITY - length);
+        memcpy(line + length, s, n);
+        length += n;
+        return *this;
+    }
+
+    LogEntry &field(const char* key) {
+        text(" ", 1);
+        return text(key, strlen(key)).text("=", 1);
+    }
+
+    // Bare if it is a plain token, otherwise quoted with \" \\ and control
+    // characters escaped.
+    LogEntry &value(std::string_view v) {
+        bool plain = !v.empty();
+        for (char c : v) {
+            if ((unsigned char)c <= ' ' || c == '"' || c == '=' || c == '\\' || c == 0x7f) {
+                plain = false;
+                break;
+            }
+        }
+        if (plain) return text(v.data(), v.size());
+        text("\"", 1);
+        for (char c : v) {
+            if (c == '"' || c == '\\') {
+                char escaped[2] = {'\\', c};
+                text(escaped, 2);
+            } else if ((unsigned char)c < ' ' || c == 0x7f) {
+                text("?", 1);
+            } else {
+                text(&c, 1);
+            }
+        }
+        return text("\"", 1);
+    }
+
+    Logger *logger;
+    LogLevel level;
+    size_t length = 0;
+    char line[CAPACITY];
+};
+
+// Asynchronous logger. Threads format a line into a LogEntry and push it
+// into a bounded lock-free ring (a Vyukov multi-producer queue); a
+// background thread adds the timestamp and level and writes whole batches
+// with one fwrite. Logging never blocks or takes a lock: when the ring is
+// full the line is dropped and counted.
+//
+// Per-request lines go through sample(), which keeps one in every N per
+// thread; warnings and errors are never sampled.
+class Logger {
+public:
+    static const size_t SLOTS = 8192;
+
+    Logger() : slots(new Slot[SLOTS]) {
+        for (size_t i = 0; i < SLOTS; i++) slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    ~Logger() {
+        stopping.store(true);
+        if (writer.joinable()) writer.join();
+    }
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    // Until start(), lines are written synchronously by the calling thread.
+    void start(FILE* out) {
+        output = out;
+        writer = std::thread([this]() { drainLoop(); });
+        started.store(true, std::memory_order_release);
+    }
+
+    void setLevel(LogLevel level) { minLevel.store((int)level, std::memory_order_relaxed); }
+    void setSampleEvery(uint32_t n) { sampleEvery.store(std::max(n, 1u), std::memory_order_relaxed); }
+
+    bool enabled(LogLevel level) const {
+        return (int)level >= minLevel.load(std::memory_order_relaxed) && level != LogLevel::Off;
+    }
+
+    LogEntry debug(const char* message) { return entry(LogLevel::Debug, message); }
+    LogEntry info(const char* message) { return entry(LogLevel::Info, message); }
+    LogEntry warn(const char* message) { return entry(LogLevel::Warn, message); }
+    LogEntry error(const char* message) { return entry(LogLevel::Error, message); }
+
+    LogEntry sample(LogLevel level, const char* message) {
+        thread_local uint32_t counter = 0;
+        if (!enabled(level) || counter++ % sampleEvery.load(std::memory_order_relaxed) != 0) {
+            return LogEntry(nullptr, level, message);
+        }
+        return LogEntry(this, level, message);
+    }
+
+    uint64_t droppedLines() const { return dropped.load(std::memory_order_relaxed); }
+    uint64_t writtenLines() const { return written.load(std::memory_order_relaxed); }
+
+private:
+    friend class LogEntry;
+
+    struct Slot {
+        std::atomic<size_t> sequence;
+        int64_t timeNanos;
+        LogLevel level;
+        uint16_t length;
+        char line[LogEntry::CAPACITY];
+    };
+
+    LogEntry entry(LogLevel level, const char* message) {
+        return LogEntry(enabled(level) ? this : nullptr, level, message);
+    }
+
+    void push(LogLevel level, const char* line, size_t length) {
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        if (!started.load(std::memory_order_acquire)) {
+            std::string out;
+            format(out, now, level, line, length);
+            fwrite(out.data(), 1, out.size(), stdout);
+            fflush(stdout);
+            return;
+        }
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & (SLOTS - 1)];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+        slot->timeNanos = now;
+        slot->level = level;
+        slot->length = (uint16_t)length;
+        memcpy(slot->line, line, length);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+    }
+
+    // The only consumer. Sleeps briefly when the ring is empty rather than
+    // making producers signal it.
+    void drainLoop() {
+        std::string batch;
+        while (true) {
+            batch.clear();
+            size_t lines = 0;
+            while (lines < SLOTS) {
+                Slot &slot = slots[head & (SLOTS - 1)];
+                if (slot.sequence.load(std::memory_order_acquire) != head + 1) break;
+                format(batch, slot.timeNanos, slot.level, slot.line, slot.length);
+                slot.sequence.store(head + SLOTS, std::memory_order_release);
+                head++;
+                lines++;
+            }
+            if (lines > 0) {
+                fwrite(batch.data(), 1, batch.size(), output);
+                fflush(output);
+                written.fetch_add(lines, std::memory_order_relaxed);
+                continue;
+            }
+            if (stopping.load()) return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_IDLE_MS));
+        }
+    }
+
+    static void format(std::string &out, int64_t timeNanos, LogLevel level, const char* line, size_t length) {
+        static const char* const NAMES[] = {"debug", "info", "warn", "error", "off"};
+        time_t seconds = (time_t)(timeNanos / 1000000000);
+        struct tm utc;
+#ifdef _WIN32
+        gmtime_s(&utc, &seconds);
+#else
+        gmtime_r(&seconds, &utc);
+#endif
+        char stamp[48];
+        size_t n = strftime(stamp, sizeof(stamp), "ts=%Y-%m-%dT%H:%M:%S", &utc);
+        snprintf(stamp + n, sizeof(stamp) - n, ".%06dZ level=", (int)(timeNanos / 1000 % 1000000));
+        out += stamp;
+        out += NAMES[(int)level];
+        out += ' ';
+        out.append(line, length);
+        out += '\n';
+    }
+
+    static constexpr int DRAIN_IDLE_MS = 5;
+
+    std::unique_ptr<Slot[]> slots;
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) size_t head = 0;
+    std::atomic<int> minLevel{(int)LogLevel::Info};
+    std::atomic<uint32_t> sampleEvery{1};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> written{0};
+    std::atomic<bool> started{false};
+    std::atomic<bool> stopping{false};
+    FILE* output = stdout;
+    std::thread writer;
+};
+
+inline LogEntry::~LogEntry() {
+    if (logger) logger->push(level, line, length);
+}
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace metricsimpl {
+
+inline int floorLog2(uint64_t x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(x);
+#endif
+}
+
+// Adds to a counter only this thread writes: a plain load and store instead
+// of a locked read-modify-write.
+inline void bump(std::atomic<uint64_t> &counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void appendDouble(std::string &out, double value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", value);
+    out += buf;
+}
+
+} // namespace metricsimpl
+
+inline uint64_t monotonicMicros() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Counts of latencies in microseconds, in log-linear buckets like an HDR
+// histogram: exact below 16 us, then eight buckets per power of two, so any
+// recorded value is known to within 12.5% up to about nine hours. Bucket
+// edges include every power of two, which the Prometheus buckets use.
+//
+// record() is a relaxed atomic add, so any thread may record; hot callers
+// keep one histogram per thread and merge them when read.
+class LatencyHistogram {
+public:
+    static constexpr int LINEAR = 16;
+    static constexpr int SUB_BUCKETS = 8;
+    static constexpr int MAX_EXPONENT = 35;
+    static constexpr int BUCKETS = LINEAR + (MAX_EXPONENT - 3) * SUB_BUCKETS;
+
+    static int bucketOf(uint64_t micros) {
+        if (micros < (uint64_t)LINEAR) return (int)micros;
+        int exponent = std::min(metricsimpl::floorLog2(micros), MAX_EXPONENT);
+        uint64_t sub = std::min<uint64_t>((micros >> (exponent - 3)) - SUB_BUCKETS, SUB_BUCKETS - 1);
+        return LINEAR + (exponent - 4) * SUB_BUCKETS + (int)sub;
+    }
+
+    // First value past the bucket.
+    static uint64_t upperBound(int bucket) {
+        if (bucket < LINEAR) return (uint64_t)bucket + 1;
+        int exponent = (bucket - LINEAR) / SUB_BUCKETS + 4;
+        uint64_t sub = (uint64_t)((bucket - LINEAR) % SUB_BUCKETS);
+        return (SUB_BUCKETS + sub + 1) << (exponent - 3);
+    }
+
+    void record(uint64_t micros) {
+        buckets[bucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(micros, std::memory_order_relaxed);
+    }
+
+    // record() for a histogram only the calling thread writes.
+    void recordOwned(uint64_t micros) {
+        metricsimpl::bump(buckets[bucketOf(micros)], 1);
+        metricsimpl::bump(sum, micros);
+    }
+
+    // A plain copy to read from, possibly summed over several histograms.
+    struct Snapshot {
+        uint64_t buckets[BUCKETS] = {};
+        uint64_t count = 0;
+        uint64_t sumMicros = 0;
+
+        // Upper edge of the bucket holding the q-th quantile.
+        uint64_t quantile(double q) const {
+            if (count == 0) return 0;
+            uint64_t rank = (uint64_t)(q * (double)(count - 1)) + 1;
+            uint64_t seen = 0;
+            for (int i = 0; i < BUCKETS; i++) {
+                seen += buckets[i];
+                if (seen >= rank) return upperBound(i);
+            }
+            return upperBound(BUCKETS - 1);
+        }
+
+        uint64_t countBelow(uint64_t micros) const {
+            uint64_t n = 0;
+            for (int i = 0; i < BUCKETS && upperBound(i) <= micros; i++) n += buckets[i];
+            return n;
+        }
+    };
+
+    void addTo(Snapshot &out) const {
+        for (int i = 0; i < BUCKETS; i++) {
+            uint64_t n = buckets[i].load(std::memory_order_relaxed);
+            out.buckets[i] += n;
+            out.count += n;
+        }
+        out.sumMicros += sum.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> sum{0};
+};
+
+// Writes the series of a histogram in Prometheus text format, with buckets
+// at powers of two from 16 us to about 17 s. `labels` is empty or like
+// `route="/x"`.
+inline void appendHistogramSeries(std::string &out, const char* name, const std::string &labels,
+                                  const LatencyHistogram::Snapshot &h) {
+    std::string sep = labels.empty() ? "" : ",";
+    for (int exponent = 4; exponent <= 24; exponent++) {
+        uint64_t edge = 1ULL << exponent;
+        out += name;
+        out += "_bucket{" + labels + sep + "le=\"";
+        metricsimpl::appendDouble(out, edge / 1e6);
+        out += "\"} " + std::to_string(h.countBelow(edge)) + "\n";
+    }
+    out += name;
+    out += "_bucket{" + labels + sep + "le=\"+Inf\"} " + std::to_string(h.count) + "\n";
+    out += name;
+    out += "_sum{" + labels + "} ";
+    metricsimpl::appendDouble(out, h.sumMicros / 1e6);
+    out += "\n";
+    out += name;
+    out += "_count{" + labels + "} " + std::to_string(h.count) + "\n";
+}
+
+// Percentiles read from the fine buckets, which Prometheus could not
+// recover from the coarse ones. Written as a gauge family of their own.
+inline void appendQuantileSeries(std::string &out, const char* name, const std::string &labels,
+                                 const LatencyHistogram::Snapshot &h) {
+    std::string sep = labels.empty() ? "" : ",";
+    for (const char* q : {"0.5", "0.9", "0.99", "0.999"}) {
+        out += name;
+        out += "{" + labels + sep + "quantile=\"" + q + "\"} ";
+        metricsimpl::appendDouble(out, h.quantile(atof(q)) / 1e6);
+        out += "\n";
+    }
+}
+
+// A histogram and its percentiles as two complete families.
+inline void appendPrometheusHistogram(std::string &out, const char* name, const LatencyHistogram::Snapshot &h) {
+    std::string quantiles = std::string(name) + "_quantile";
+    out += "# TYPE " + std::string(name) + " histogram\n";
+    appendHistogramSeries(out, name, "", h);
+    out += "# TYPE " + quantiles + " gauge\n";
+    appendQuantileSeries(out, quantiles.c_str(), "", h);
+}
+
+// Request counts, latencies and bytes per route. Every thread that records
+// gets its own shard on first use, so recording never shares a cache line
+// with another thread; a scrape sums the shards. Routes are a fixed list
+// given at construction, which keeps label cardinality bounded.
+class RouteMetrics {
+public:
+    explicit RouteMetrics(std::vector<const char*> routes) : routes(std::move(routes)) {}
+
+    RouteMetrics(const RouteMetrics&) = delete;
+    RouteMetrics& operator=(const RouteMetrics&) = delete;
+
+    size_t routeCount() const { return routes.size(); }
+
+    void record(size_t route, int status, uint64_t micros, size_t bytesIn, size_t bytesOut) {
+        Shard &shard = localShard();
+        Route &r = shard.routes[route];
+        metricsimpl::bump(r.statusClass[std::min(std::max(status / 100, 1), 5) - 1], 1);
+        metricsimpl::bump(r.bytesIn, bytesIn);
+        metricsimpl::bump(r.bytesOut, bytesOut);
+        r.latency.recordOwned(micros);
+    }
+
+    void render(std::string &out) const {
+        std::vector<Shard*> current;
+        {
+            std::lock_guard<std::mutex> lock(shardsLock);
+            for (const std::unique_ptr<Shard> &s : shards) current.push_back(s.get());
+        }
+        out += "# TYPE taskbuddy_http_requests_total counter\n";
+        for (size_t i = 0; i < routes.size(); i++) {
+            for (int c = 0; c < 5; c++) {
+                uint64_t n = 0;
+                for (Shard* s : current) n += s->routes[i].statusClass[c].load(std::memory_order_relaxed);
+                if (n == 0) continue;
+                out += "taskbuddy_http_requests_total{route=\"" + std::string(routes[i]) + "\",code=\"" +
+                       std::to_string(c + 1) + "xx\"} " + std::to_string(n) + "\n";
+            }
+        }
+        appendTotals(out, current, "taskbuddy_http_request_bytes_total", &Route::bytesIn);
+        appendTotals(out, current, "taskbuddy_http_response_bytes_total", &Route::bytesOut);
+        std::vector<LatencyHistogram::Snapshot> latencies(routes.size());
+        for (size_t i = 0; i < routes.size(); i++) {
+            for (Shard* s : current) s->routes[i].latency.addTo(latencies[i]);
+        }
+        out += "# TYPE taskbuddy_http_request_duration_seconds histogram\n";
+        for (size_t i = 0; i < routes.size(); i++) {
+            if (latencies[i].count == 0) continue;
+            appendHistogramSeries(out, "taskbuddy_http_request_duration_seconds",
+                                  "route=\"" + std::string(routes[i]) + "\"", latencies[i]);
+        }
+        out += "# TYPE taskbuddy_http_request_duration_seconds_quantile gauge\n";
+        for (size_t i = 0; i < routes.size(); i++) {
+            if (latencies[i].count == 0) continue;
+            appendQuantileSeries(out, "taskbuddy_http_request_duration_seconds_quantile",
+                                 "route=\"" + std::string(routes[i]) + "\"", latencies[i]);
+        }
+    }
+
+private:
+    struct Route {
+        std::atomic<uint64_t> statusClass[5] = {};
+        std::atomic<uint64_t> bytesIn{0};
+        std::atomic<uint64_t> bytesOut{0};
+        LatencyHistogram latency;
+    };
+
+    struct Shard {
+        explicit Shard(size_t routes) : routes(new Route[routes]) {}
+        std::unique_ptr<Route[]> routes;
+    };
+
+    // Shards live as long as the metrics, even after their thread exits.
+    Shard &localShard() {
+        thread_local std::vector<std::pair<const RouteMetrics*, Shard*>> owned;
+        for (const auto &entry : owned) {
+            if (entry.first == this) return *entry.second;
+        }
+        std::lock_guard<std::mutex> lock(shardsLock);
+        shards.emplace_back(new Shard(routes.size()));
+        owned.emplace_back(this, shards.back().get());
+        return *shards.back();
+    }
+
+    void appendTotals(std::string &out, const std::vector<Shard*> &current, const char* name,
+                      std::atomic<uint64_t> Route::*field) const {
+        out += "# TYPE ";
+        out += name;
+        out += " counter\n";
+        for (size_t i = 0; i < routes.size(); i++) {
+            uint64_t n = 0;
+            for (Shard* s : current) n += (s->routes[i].*field).load(std::memory_order_relaxed);
+            if (n == 0) continue;
+            out += name;
+            out += "{route=\"" + std::string(routes[i]) + "\"} " + std::to_string(n) + "\n";
+        }
+    }
+
+    std::vector<const char*> routes;
+    mutable std::mutex shardsLock;
+    std::vector<std::unique_ptr<Shard>> shards;
+};
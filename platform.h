@@ -0,0 +1,426 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#pragma comment(lib, "ws2_32.lib")
+
+typedef SOCKET socket_t;
+typedef int ssize_type;
+const socket_t INVALID_SOCKET_HANDLE = INVALID_SOCKET;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef int socket_t;
+typedef ssize_t ssize_type;
+const socket_t INVALID_SOCKET_HANDLE = -1;
+#endif
+
+inline bool initNetworking() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+#else
+    // A peer that resets mid-response must not kill the whole server.
+    signal(SIGPIPE, SIG_IGN);
+
+    // Every keep-alive connection holds a descriptor, so lift the soft limit
+    // as far as the hard limit allows.
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    return true;
+#endif
+}
+
+inline void shutdownNetworking() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+inline void closeSocket(socket_t s) {
+#ifdef _WIN32
+    closesocket(s);
+#else
+    close(s);
+#endif
+}
+
+inline int lastSocketError() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+inline bool isWouldBlock(int err) {
+#ifdef _WIN32
+    return err == WSAEWOULDBLOCK;
+#else
+    return err == EAGAIN || err == EWOULDBLOCK;
+#endif
+}
+
+inline bool isInterrupted(int err) {
+#ifdef _WIN32
+    return err == WSAEINTR;
+#else
+    return err == EINTR;
+#endif
+}
+
+inline bool setNonBlocking(socket_t s) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    return flags >= 0 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+inline void setNoDelay(socket_t s) {
+    int opt = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char*)&opt, sizeof(opt));
+}
+
+inline ssize_type recvSome(socket_t s, char* data, size_t len) {
+    return recv(s, data, (int)len, 0);
+}
+
+// Asks the kernel to stamp received data with its arrival time, which
+// recvStamped() reports. Linux only; elsewhere nothing is stamped.
+inline void enableReceiveTimestamps(socket_t s) {
+#ifdef __linux__
+    int opt = 1;
+    setsockopt(s, SOL_SOCKET, SO_TIMESTAMP, (char*)&opt, sizeof(opt));
+#else
+    (void)s;
+#endif
+}
+
+// recvSome, also setting `receivedMicros` to when the kernel received the
+// data read (CLOCK_REALTIME), or 0 if it was not stamped.
+inline ssize_type recvStamped(socket_t s, char* data, size_t len, uint64_t &receivedMicros) {
+    receivedMicros = 0;
+#ifdef __linux__
+    iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = len;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(timeval))];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_type n = recvmsg(s, &msg, 0);
+    if (n <= 0) return n;
+    for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMP) {
+            timeval tv;
+            memcpy(&tv, CMSG_DATA(c), sizeof(tv));
+            receivedMicros = (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+        }
+    }
+    return n;
+#else
+    return recvSome(s, data, len);
+#endif
+}
+
+inline ssize_type sendSome(socket_t s, const char* data, size_t len) {
+#ifdef _WIN32
+    return send(s, data, (int)len, 0);
+#else
+    return send(s, data, len, MSG_NOSIGNAL);
+#endif
+}
+
+struct IoSlice {
+    const char* data;
+    size_t len;
+};
+
+const int MAX_IO_SLICES = 16;
+
+// Gathers up to MAX_IO_SLICES buffers into one send, so response headers
+// and bodies held elsewhere go out without being copied together first.
+inline ssize_type sendVector(socket_t s, const IoSlice* slices, int count) {
+    if (count > MAX_IO_SLICES) count = MAX_IO_SLICES;
+#ifdef _WIN32
+    WSABUF bufs[MAX_IO_SLICES];
+    for (int i = 0; i < count; i++) {
+        bufs[i].buf = (CHAR*)slices[i].data;
+        bufs[i].len = (ULONG)slices[i].len;
+    }
+    DWORD sent = 0;
+    if (WSASend(s, bufs, (DWORD)count, &sent, 0, nullptr, nullptr) != 0) return -1;
+    return (ssize_type)sent;
+#else
+    iovec iov[MAX_IO_SLICES];
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = (void*)slices[i].data;
+        iov[i].iov_len = slices[i].len;
+    }
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    return sendmsg(s, &msg, MSG_NOSIGNAL);
+#endif
+}
+
+// Accepts one pending connection and returns it already in non-blocking mode,
+// or INVALID_SOCKET_HANDLE when nothing is pending.
+// With `peer` given, the client's address is written there as text.
+inline socket_t acceptClient(socket_t listener, char* peer = nullptr, size_t peerSize = 0) {
+    sockaddr_in clientAddr;
+#ifdef _WIN32
+    int clientAddrSize = sizeof(clientAddr);
+    socket_t client = accept(listener, (sockaddr*)&clientAddr, &clientAddrSize);
+    if (client != INVALID_SOCKET_HANDLE && !setNonBlocking(client)) {
+        closeSocket(client);
+        return INVALID_SOCKET_HANDLE;
+    }
+#elif defined(__linux__)
+    socklen_t clientAddrSize = sizeof(clientAddr);
+    socket_t client = accept4(listener, (sockaddr*)&clientAddr, &clientAddrSize, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    socklen_t clientAddrSize = sizeof(clientAddr);
+    socket_t client = accept(listener, (sockaddr*)&clientAddr, &clientAddrSize);
+    if (client != INVALID_SOCKET_HANDLE && !setNonBlocking(client)) {
+        closeSocket(client);
+        return INVALID_SOCKET_HANDLE;
+    }
+#endif
+    if (client != INVALID_SOCKET_HANDLE) {
+        setNoDelay(client);
+        if (peer && !inet_ntop(AF_INET, &clientAddr.sin_addr, peer, (socklen_t)peerSize)) peer[0] = '\0';
+    }
+    return client;
+}
+
+// With reusePort set (Linux), several sockets can listen on the same port
+// and the kernel balances incoming connections between them.
+inline socket_t createListenSocket(int port, int backlog, bool reusePort = false) {
+    socket_t serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (serverSocket == INVALID_SOCKET_HANDLE) {
+        return INVALID_SOCKET_HANDLE;
+    }
+
+    int opt = 1;
+    if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt)) < 0) {
+        closeSocket(serverSocket);
+        return INVALID_SOCKET_HANDLE;
+    }
+#ifdef SO_REUSEPORT
+    if (reusePort && setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, (char*)&opt, sizeof(opt)) < 0) {
+        closeSocket(serverSocket);
+        return INVALID_SOCKET_HANDLE;
+    }
+#else
+    (void)reusePort;
+#endif
+
+    sockaddr_in serverAddr;
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = INADDR_ANY;
+    serverAddr.sin_port = htons((unsigned short)port);
+
+    if (bind(serverSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) != 0 ||
+        listen(serverSocket, backlog) != 0 ||
+        !setNonBlocking(serverSocket)) {
+        closeSocket(serverSocket);
+        return INVALID_SOCKET_HANDLE;
+    }
+
+    return serverSocket;
+}
+
+// A blocking client connection, for tools that drive the server. Returns
+// INVALID_SOCKET_HANDLE when the host does not resolve or refuses.
+inline socket_t connectToServer(const char* host, int port) {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &found) != 0 || !found) {
+        return INVALID_SOCKET_HANDLE;
+    }
+    socket_t s = socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+    if (s != INVALID_SOCKET_HANDLE && connect(s, found->ai_addr, (int)found->ai_addrlen) != 0) {
+        closeSocket(s);
+        s = INVALID_SOCKET_HANDLE;
+    }
+    freeaddrinfo(found);
+    if (s != INVALID_SOCKET_HANDLE) {
+        setNoDelay(s);
+    }
+    return s;
+}
+
+// Unbuffered file access for the persistence layer, which needs to control
+// exactly when data reaches the disk.
+inline int openFileForAppend(const char* path) {
+#ifdef _WIN32
+    return _open(path, _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+}
+
+inline int openFileForWrite(const char* path) {
+#ifdef _WIN32
+    return _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+}
+
+inline bool writeFully(int fd, const char* data, size_t len) {
+    while (len > 0) {
+#ifdef _WIN32
+        int n = _write(fd, data, (unsigned)len);
+#else
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) return false;
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+inline bool syncFile(int fd) {
+#ifdef _WIN32
+    return _commit(fd) == 0;
+#elif defined(__linux__)
+    return fdatasync(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+// Makes the entries of directory `path` durable, such as a file just
+// created or renamed into it. Windows offers no way to do this and does
+// not need it for NTFS metadata, so there it does nothing.
+inline bool syncDirectory(const char* path) {
+#ifdef _WIN32
+    (void)path;
+    return true;
+#else
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+#endif
+}
+
+inline void closeFile(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    MappedFile() {}
+    ~MappedFile() { unmap(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool map(const char* path) {
+        unmap();
+#ifdef _WIN32
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            unmap();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) {
+            unmap();
+            return false;
+        }
+        data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        size = (size_t)fileSize.QuadPart;
+#else
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) return false;
+        data = (const char*)p;
+        size = (size_t)st.st_size;
+#endif
+        return data != nullptr;
+    }
+
+    const char* bytes() const { return data; }
+    size_t length() const { return size; }
+
+private:
+    void unmap() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap((void*)data, size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
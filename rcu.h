@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Epoch-based reclamation. Readers publish the global epoch they entered in
+// and never block; writers swap pointers and retire the old object, which is
+// freed once every reader that could still see it has left.
+class EpochDomain {
+public:
+    static const int MAX_THREADS = 256;
+
+    static EpochDomain& instance() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    // Nested read sections keep the outermost epoch.
+    void enter() {
+        if (readDepth()++ > 0) return;
+        std::atomic<uint64_t> &slot = localSlot();
+        slot.store(globalEpoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    }
+
+    void exit() {
+        if (--readDepth() > 0) return;
+        localSlot().store(0, std::memory_order_release);
+    }
+
+    void retire(std::function<void()> deleter) {
+        std::lock_guard<std::mutex> lock(retireLock);
+        uint64_t epoch = globalEpoch.fetch_add(1, std::memory_order_seq_cst);
+        retired.push_back(Retired{epoch, std::move(deleter)});
+        reclaimLocked();
+    }
+
+    ~EpochDomain() {
+        for (Retired &r : retired) r.deleter();
+    }
+
+private:
+    struct Retired {
+        uint64_t epoch;
+        std::function<void()> deleter;
+    };
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0};
+        std::atomic<bool> inUse{false};
+    };
+
+    // Claims a slot for the calling thread and gives it back when the thread
+    // exits, so short-lived threads do not exhaust the table.
+    struct SlotOwner {
+        int index;
+        explicit SlotOwner(EpochDomain &domain) : index(domain.claimSlot()) {}
+        ~SlotOwner() {
+            EpochDomain &domain = EpochDomain::instance();
+            domain.slots[index].epoch.store(0);
+            domain.slots[index].inUse.store(false);
+        }
+    };
+
+    static int &readDepth() {
+        thread_local int depth = 0;
+        return depth;
+    }
+
+    std::atomic<uint64_t> &localSlot() {
+        thread_local SlotOwner owner(*this);
+        return slots[owner.index].epoch;
+    }
+
+    int claimSlot() {
+        while (true) {
+            for (int i = 0; i < MAX_THREADS; i++) {
+                bool expected = false;
+                if (!slots[i].inUse.load() && slots[i].inUse.compare_exchange_strong(expected, true)) {
+                    int high = highWater.load();
+                    while (high < i + 1 && !highWater.compare_exchange_weak(high, i + 1)) {}
+                    return i;
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    void reclaimLocked() {
+        uint64_t oldestActive = UINT64_MAX;
+        int used = highWater.load();
+        for (int i = 0; i < used; i++) {
+            uint64_t e = slots[i].epoch.load(std::memory_order_seq_cst);
+            if (e != 0 && e < oldestActive) oldestActive = e;
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < retired.size(); i++) {
+            if (retired[i].epoch < oldestActive) {
+                retired[i].deleter();
+            } else {
+                retired[kept++] = std::move(retired[i]);
+            }
+        }
+        retired.resize(kept);
+    }
+
+    std::atomic<uint64_t> globalEpoch{1};
+    std::atomic<int> highWater{0};
+    Slot slots[MAX_THREADS];
+    std::mutex retireLock;
+    std::vector<Retired> retired;
+};
+
+struct RcuReadGuard {
+    RcuReadGuard() { EpochDomain::instance().enter(); }
+    ~RcuReadGuard() { EpochDomain::instance().exit(); }
+    RcuReadGuard(const RcuReadGuard&) = delete;
+    RcuReadGuard& operator=(const RcuReadGuard&) = delete;
+};
+
+// Pointer to an immutable object that is replaced wholesale by writers.
+// load() must be called under an RcuReadGuard; the result stays valid until
+// the guard is destroyed.
+template <typename T>
+class RcuPtr {
+public:
+    explicit RcuPtr(const T* initial = nullptr) : ptr(initial) {}
+
+    ~RcuPtr() {
+        delete ptr.load();
+    }
+
+    RcuPtr(const RcuPtr&) = delete;
+    RcuPtr& operator=(const RcuPtr&) = delete;
+
+    const T* load() const {
+        return ptr.load(std::memory_order_acquire);
+    }
+
+    void publish(const T* next) {
+        const T* old = ptr.exchange(next, std::memory_order_seq_cst);
+        if (old) {
+            EpochDomain::instance().retire([old]() { delete old; });
+        }
+    }
+
+private:
+    std::atomic<const T*> ptr;
+};
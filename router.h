@@ -0,0 +1,219 @@
+#pragma once
+
+#include "http.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class HttpMethod : uint8_t { Get, Head, Post, Put, Delete, Patch, Options, Other };
+
+const size_t HTTP_METHODS = (size_t)HttpMethod::Other;
+
+inline HttpMethod methodOf(std::string_view method) {
+    switch (method.size()) {
+        case 3:
+            if (method == "GET") return HttpMethod::Get;
+            if (method == "PUT") return HttpMethod::Put;
+            break;
+        case 4:
+            if (method == "POST") return HttpMethod::Post;
+            if (method == "HEAD") return HttpMethod::Head;
+            break;
+        case 5:
+            if (method == "PATCH") return HttpMethod::Patch;
+            break;
+        case 6:
+            if (method == "DELETE") return HttpMethod::Delete;
+            break;
+        case 7:
+            if (method == "OPTIONS") return HttpMethod::Options;
+            break;
+    }
+    return HttpMethod::Other;
+}
+
+inline const char* methodName(HttpMethod method) {
+    static const char* NAMES[] = {"GET", "HEAD", "POST", "PUT", "DELETE", "PATCH", "OPTIONS", "OTHER"};
+    return NAMES[(size_t)method];
+}
+
+// Maps a request's method and path to its handler, through a chain of
+// middleware that every request passes on the way in.
+//
+// Paths live in an open-addressed table whose size and hash seed are picked
+// by freeze() so that no two paths share a slot: a lookup hashes the path
+// once, compares the single entry it lands on, and indexes that entry's
+// handlers by method. Handlers and middleware are plain function pointers,
+// so dispatch allocates nothing. Routes are added and frozen before the
+// event loops start; after that the router is only read.
+template <typename Context>
+class Router {
+public:
+    class Chain;
+    typedef HttpResponse (*Handler)(Context&);
+    // Does its work around the rest of the chain, which it runs by calling
+    // chain(ctx) at most once, or answers by itself without calling it.
+    typedef HttpResponse (*Middleware)(Context&, Chain&);
+    // Answers requests no route matched. `allow` lists the methods the path
+    // does have, for 405, or is null if the path is unknown.
+    typedef HttpResponse (*Unmatched)(Context&, const char* allow);
+
+    struct Route {
+        HttpMethod method;
+        Handler handler;
+        size_t label;           // the owner's, e.g. a metrics series
+        uint32_t flags;         // the owner's, read by middleware
+    };
+
+    // What a middleware sees of the request's route, and the rest of the
+    // chain.
+    class Chain {
+    public:
+        // nullptr when no route matched.
+        const Route* route() const { return matched; }
+
+        HttpResponse operator()(Context &ctx) {
+            if (next < router.middleware.size()) return router.middleware[next++](ctx, *this);
+            return matched ? matched->handler(ctx) : router.unmatched(ctx, allow);
+        }
+
+    private:
+        friend class Router;
+        Chain(const Router &router, const Route* matched, const char* allow)
+            : router(router), matched(matched), allow(allow) {}
+
+        const Router &router;
+        const Route* matched;
+        const char* allow;
+        size_t next = 0;
+    };
+
+    explicit Router(Unmatched unmatched) : unmatched(unmatched) {}
+
+    Router(const Router&) = delete;
+    Router& operator=(const Router&) = delete;
+
+    void add(HttpMethod method, const std::string &path, Handler handler, size_t label, uint32_t flags = 0) {
+        size_t e = 0;
+        while (e < entries.size() && entries[e].path != path) e++;
+        if (e == entries.size()) entries.emplace_back(path);
+        entries[e].routes[(size_t)method] = Route{method, handler, label, flags};
+        entries[e].has[(size_t)method] = true;
+        frozen = false;
+    }
+
+    // Middleware runs in the order added, the first outermost.
+    void use(Middleware m) {
+        middleware.push_back(m);
+    }
+
+    // Builds the lookup table. Must be called after the last add().
+    void freeze() {
+        for (Entry &e : entries) {
+            e.allow.clear();
+            for (size_t m = 0; m < HTTP_METHODS; m++) {
+                if (!e.has[m]) continue;
+                if (!e.allow.empty()) e.allow += ", ";
+                e.allow += methodName((HttpMethod)m);
+            }
+        }
+        size_t size = 8;
+        while (size < entries.size() * 2) size <<= 1;
+        while (!place(size)) size <<= 1;
+        frozen = true;
+    }
+
+    // The route for `method` on `path`, or nullptr. When the path exists
+    // under other methods only, `allow` is set to their list.
+    const Route* find(std::string_view method, std::string_view path, const char* &allow) const {
+        allow = nullptr;
+        if (!frozen) return nullptr;
+        uint32_t e = slots[hash(path, seed) & mask];
+        if (e == EMPTY || entries[e].path != path) return nullptr;
+        const Entry &entry = entries[e];
+        HttpMethod m = methodOf(method);
+        if (m != HttpMethod::Other && entry.has[(size_t)m]) return &entry.routes[(size_t)m];
+        allow = entry.allow.c_str();
+        return nullptr;
+    }
+
+    HttpResponse dispatch(Context &ctx, std::string_view method, std::string_view path) const {
+        const char* allow;
+        const Route* route = find(method, path, allow);
+        Chain chain(*this, route, allow);
+        return chain(ctx);
+    }
+
+    size_t routeCount() const {
+        size_t count = 0;
+        for (const Entry &e : entries) {
+            for (size_t m = 0; m < HTTP_METHODS; m++) count += e.has[m];
+        }
+        return count;
+    }
+
+private:
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    struct Entry {
+        explicit Entry(const std::string &path) : path(path) {}
+        std::string path;
+        Route routes[HTTP_METHODS] = {};
+        bool has[HTTP_METHODS] = {};
+        std::string allow;      // e.g. "GET, POST"
+    };
+
+    // By default only the length and three bytes of the path are hashed,
+    // as gperf does, so a lookup costs the same for any path; when no seed
+    // separates the paths that way, all bytes are.
+    uint64_t hash(std::string_view s, uint64_t seed) const {
+        uint64_t h = (seed + 1) * 0x9E3779B97F4A7C15ULL;
+        if (sampled) {
+            uint64_t key = s.size();
+            if (!s.empty()) {
+                key |= (uint64_t)(unsigned char)s[s.size() > 1] << 16 |
+                       (uint64_t)(unsigned char)s[s.size() / 2] << 24 |
+                       (uint64_t)(unsigned char)s[s.size() - 1] << 32;
+            }
+            h = (h ^ key) * 0xC2B2AE3D27D4EB4FULL;
+        } else {
+            for (char c : s) h = (h ^ (unsigned char)c) * 0x100000001b3ULL;
+        }
+        return h ^ (h >> 29);
+    }
+
+    // Looks for a seed under which every path gets its own slot in a table
+    // of `size`; with the table at least twice the number of paths a few
+    // hundred tries are plenty, and otherwise the caller doubles it.
+    bool place(size_t size) {
+        for (int mode = 0; mode < 2; mode++) {
+            sampled = mode == 0;
+            for (uint64_t s = 0; s < 1024; s++) {
+                std::vector<uint32_t> table(size, EMPTY);
+                bool clash = false;
+                for (size_t e = 0; e < entries.size() && !clash; e++) {
+                    uint32_t &slot = table[hash(entries[e].path, s) & (size - 1)];
+                    if (slot != EMPTY) clash = true;
+                    else slot = (uint32_t)e;
+                }
+                if (clash) continue;
+                slots.swap(table);
+                mask = size - 1;
+                seed = s;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<Entry> entries;
+    std::vector<uint32_t> slots;
+    size_t mask = 0;
+    uint64_t seed = 0;
+    bool sampled = true;
+    bool frozen = false;
+    std::vector<Middleware> middleware;
+    Unmatched unmatched;
+};
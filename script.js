@@ -3,14 +3,53 @@ const API_BASE = "http://127.0.0.1:8080";
 class TaskManager {
     constructor() {
         this.tasks = [];
+        this.version = null;
         this.currentUser = localStorage.getItem("username") || "default";
+        this.token = localStorage.getItem("token");
         this.init();
     }
 
+    // fetch() with the session token from /login. An expired or missing
+    // session sends the user back to the login page.
+    async api(path, options = {}) {
+        const headers = Object.assign({}, options.headers, { "Authorization": `Bearer ${this.token}` });
+        const response = await fetch(`${API_BASE}${path}`, Object.assign({}, options, { headers }));
+        if (response.status === 401) {
+            localStorage.removeItem("loggedIn");
+            localStorage.removeItem("token");
+            window.location.href = "login.html";
+        }
+        return response;
+    }
+
     async init() {
         await this.fetchTasks();
         this.setupEventListeners();
         this.updateAllDisplays();
+        this.subscribe();
+    }
+
+    // Changes made elsewhere (another tab, another device) are pushed over
+    // Server-Sent Events. Each event is a delta from the version in `since`;
+    // one that does not follow the version we hold means something was
+    // missed, and the regular delta fetch catches up. EventSource cannot
+    // send headers, so the token goes in the query string.
+    subscribe() {
+        if (!window.EventSource || !this.token) return;
+        const source = new EventSource(`${API_BASE}/events?token=${encodeURIComponent(this.token)}`);
+        source.addEventListener("open", () => this.fetchTasks());
+        source.addEventListener("tasks", (e) => {
+            const changes = JSON.parse(e.data);
+            if (changes.resync || changes.since !== this.version) {
+                if (this.version === null || changes.version > this.version) this.fetchTasks();
+                return;
+            }
+            this.applyChanges(changes);
+            this.updateAllDisplays();
+        });
+        // Sent when a day begins with some of our tasks due on it; the
+        // upcoming list and trackers depend on the date, so redraw them.
+        source.addEventListener("due", () => this.updateAllDisplays());
     }
 
     setupEventListeners() {
@@ -20,32 +59,54 @@ class TaskManager {
         }
     }
 
+    // Syncs this.tasks with the server. The first call loads everything;
+    // later calls send the version we hold and receive only what changed.
     async fetchTasks() {
         try {
             console.log("Fetching tasks for user:", this.currentUser);
-            const response = await fetch(`${API_BASE}/schedule?user=${this.currentUser}`);
+            const since = this.version === null ? 0 : this.version;
+            const response = await this.api(`/schedule?since=${since}`);
             
+            if (response.status === 304) {
+                return;
+            }
             if (!response.ok) {
                 throw new Error(`Server returned ${response.status}`);
             }
             
-            const tasksData = await response.json();
-            console.log("Fetched tasks:", tasksData);
+            const changes = await response.json();
+            console.log("Fetched task changes:", changes);
             
-  
-            this.tasks = Array.isArray(tasksData) ? tasksData : [];
+            const firstLoad = this.version === null;
+            this.applyChanges(changes);
             
             this.updateAllDisplays();
-            this.showSuccess("Tasks loaded successfully!");
+            if (firstLoad) {
+                this.showSuccess("Tasks loaded successfully!");
+            }
             
         } catch (error) {
             console.error("Error loading tasks:", error);
             this.tasks = [];
+            this.version = null;
             this.updateAllDisplays();
             this.showError("Failed to load tasks. Make sure server is running on port 8080.");
         }
     }
 
+    applyChanges(changes) {
+        const upserts = Array.isArray(changes.upserts) ? changes.upserts : [];
+        if (changes.full) {
+            this.tasks = upserts;
+        } else {
+            const byId = new Map(this.tasks.map(task => [task.id, task]));
+            (changes.deletes || []).forEach(id => byId.delete(id));
+            upserts.forEach(task => byId.set(task.id, task));
+            this.tasks = Array.from(byId.values());
+        }
+        this.version = changes.version;
+    }
+
     async handleAddTask(e) {
         e.preventDefault();
 
@@ -70,14 +131,13 @@ class TaskManager {
             category: category.value,
             priority: priority.value.replace('📊 ', '').replace('📈 ', '').replace('🚨 ', '').replace(' Priority', ''),
             deadline: deadline.value,
-            completed: false,
-            username: this.currentUser
+            completed: false
         };
 
         try {
             console.log("Adding new task:", newTask);
 
-            const response = await fetch(`${API_BASE}/add_task`, {
+            const response = await this.api("/add_task", {
                 method: "POST",
                 headers: { 
                     "Content-Type": "application/json"
@@ -103,15 +163,12 @@ class TaskManager {
 
     async toggleComplete(id) {
         try {
-            const response = await fetch(`${API_BASE}/toggle_complete`, {
+            const response = await this.api("/toggle_complete", {
                 method: "POST",
                 headers: { 
                     "Content-Type": "application/json"
                 },
-                body: JSON.stringify({ 
-                    id: Number(id),
-                    username: this.currentUser
-                })
+                body: JSON.stringify({ id: Number(id) })
             });
 
             if (!response.ok) throw new Error('Failed to update task');
@@ -129,15 +186,12 @@ class TaskManager {
         }
 
         try {
-            const response = await fetch(`${API_BASE}/delete_task`, {
+            const response = await this.api("/delete_task", {
                 method: "POST",
                 headers: { 
                     "Content-Type": "application/json"
                 },
-                body: JSON.stringify({ 
-                    id: Number(id),
-                    username: this.currentUser
-                })
+                body: JSON.stringify({ id: Number(id) })
             });
 
             if (!response.ok) throw new Error('Failed to delete task');
@@ -286,16 +340,25 @@ class TaskManager {
         modal.style.display = 'block';
     }
 
-    updateTrackers() {
-        const totalTasks = this.tasks.length;
-        const completedTasks = this.tasks.filter(task => task.completed).length;
-        const pendingTasks = totalTasks - completedTasks;
+    // The tracker counts come from /stats, which the server keeps up to
+    // date as tasks change, rather than from counting this.tasks. Its ETag
+    // lets the browser revalidate instead of downloading them again.
+    async updateTrackers() {
+        let stats;
+        try {
+            const response = await this.api("/stats");
+            if (!response.ok) {
+                throw new Error(`Server returned ${response.status}`);
+            }
+            stats = await response.json();
+        } catch (error) {
+            console.error("Error loading stats:", error);
+            return;
+        }
         
-        const completionRate = totalTasks > 0 ? Math.round((completedTasks / totalTasks) * 100) : 0;
+        const completionRate = stats.total > 0 ? Math.round((stats.completed / stats.total) * 100) : 0;
         const streak = this.calculateStreak();
-        const upcomingCount = this.tasks.filter(task => 
-            !task.completed && new Date(task.deadline) >= new Date().setHours(0,0,0,0)
-        ).length;
+        const upcomingCount = stats.deadlines.today + stats.deadlines.week + stats.deadlines.later;
 
         this.updateTrackerElement('upcoming-tracker', upcomingCount, 'Upcoming');
         this.updateTrackerElement('streak-tracker', streak, 'Day Streak');
@@ -1,553 +1,1678 @@
-
-#include <iostream>
-#include <sstream>
-#include <string>
-#include <vector>
-#include <map>
-#include <fstream>
-#include <algorithm>
-#include <cstring>
-#include <ctime>
-#include <winsock2.h>
-#include <ws2tcpip.h>
-
-#pragma comment(lib, "ws2_32.lib")
-
-struct Task {
-    long long id;
-    std::string name;
-    std::string category;
-    std::string priority;
-    std::string deadline;
-    bool completed;
-    std::string username;
-};
-
-struct User {
-    std::string username;
-    std::string password;
-};
-
-std::vector<Task> tasks;
-std::vector<User> users;
-
-std::string getMimeType(const std::string& path) {
-    if (path.find(".html") != std::string::npos) return "text/html";
-    if (path.find(".css") != std::string::npos) return "text/css";
-    if (path.find(".js") != std::string::npos) return "application/javascript";
-    if (path.find(".json") != std::string::npos) return "application/json";
-    return "text/plain";
-}
-
-std::string serveFile(const std::string& filename) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
-        std::string notFound = "File not found: " + filename;
-        std::string response = "HTTP/1.1 404 Not Found\r\n";
-        response += "Content-Type: text/plain\r\n";
-        response += "Content-Length: " + std::to_string(notFound.length()) + "\r\n";
-        response += "Connection: close\r\n\r\n";
-        response += notFound;
-        return response;
-    }
-    
-    std::string content((std::istreambuf_iterator<char>(file)), 
-                       std::istreambuf_iterator<char>());
-    file.close();
-    
-    std::string response = "HTTP/1.1 200 OK\r\n";
-    response += "Content-Type: " + getMimeType(filename) + "\r\n";
-    response += "Content-Length: " + std::to_string(content.length()) + "\r\n";
-    response += "Connection: close\r\n\r\n";
-    response += content;
-    return response;
-}
-
-std::string createResponse(const std::string &content, const std::string &contentType = "application/json") {
-    std::string response = "HTTP/1.1 200 OK\r\n";
-    response += "Content-Type: " + contentType + "\r\n";
-    response += "Access-Control-Allow-Origin: *\r\n";
-    response += "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n";
-    response += "Access-Control-Allow-Headers: Content-Type\r\n";
-    response += "Content-Length: " + std::to_string(content.length()) + "\r\n";
-    response += "Connection: close\r\n\r\n";
-    response += content;
-    return response;
-}
-
-std::string createErrorResponse(const std::string &error, int statusCode = 400) {
-    std::string content = "{\"error\":\"" + error + "\"}";
-    std::string response = "HTTP/1.1 " + std::to_string(statusCode) + " Bad Request\r\n";
-    response += "Content-Type: application/json\r\n";
-    response += "Access-Control-Allow-Origin: *\r\n";
-    response += "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n";
-    response += "Access-Control-Allow-Headers: Content-Type\r\n";
-    response += "Content-Length: " + std::to_string(content.length()) + "\r\n";
-    response += "Connection: close\r\n\r\n";
-    response += content;
-    return response;
-}
-
-void loadUsers() {
-    std::ifstream file("users.json");
-    if (!file.is_open()) {
-        std::cout << "No users.json found, starting fresh.\n";
-        return;
-    }
-    
-    std::string content((std::istreambuf_iterator<char>(file)), 
-                       std::istreambuf_iterator<char>());
-    file.close();
-    
-    users.clear();
-    
-    size_t pos = 0;
-    while ((pos = content.find("\"username\"", pos)) != std::string::npos) {
-        User user;
-        
-        size_t user_start = content.find(":", pos) + 1;
-        user_start = content.find("\"", user_start) + 1;
-        size_t user_end = content.find("\"", user_start);
-        user.username = content.substr(user_start, user_end - user_start);
-        
-        size_t pass_pos = content.find("\"password\"", user_end);
-        if (pass_pos == std::string::npos) break;
-        
-        size_t pass_start = content.find(":", pass_pos) + 1;
-        pass_start = content.find("\"", pass_start) + 1;
-        size_t pass_end = content.find("\"", pass_start);
-        user.password = content.substr(pass_start, pass_end - pass_start);
-        
-        users.push_back(user);
-        pos = pass_end;
-    }
-}
-
-void saveUsers() {
-    std::ofstream file("users.json");
-    if (!file.is_open()) {
-        std::cerr << "Failed to create users.json\n";
-        return;
-    }
-    
-    file << "[\n";
-    for (size_t i = 0; i < users.size(); i++) {
-        const User &u = users[i];
-        file << "  {\n";
-        file << "    \"username\": \"" << u.username << "\",\n";
-        file << "    \"password\": \"" << u.password << "\"\n";
-        file << "  }";
-        if (i < users.size() - 1) file << ",";
-        file << "\n";
-    }
-    file << "]";
-    file.close();
-}
-
-bool userExists(const std::string& username) {
-    for (const auto& user : users) {
-        if (user.username == username) {
-            return true;
-        }
-    }
-    return false;
-}
-
-bool validateUser(const std::string& username, const std::string& password) {
-    loadUsers();
-    
-    for (const auto& user : users) {
-        if (user.username == username && user.password == password) {
-            return true;
-        }
-    }
-    return false;
-}
-
-void saveTasks() {
-    std::ofstream file("tasks.json");
-    if (!file.is_open()) {
-        std::cerr << "Failed to create tasks.json\n";
-        return;
-    }
-    
-    file << "[\n";
-    for (size_t i = 0; i < tasks.size(); i++) {
-        const Task &t = tasks[i];
-        file << "  {\n";
-        file << "    \"id\": " << t.id << ",\n";
-        file << "    \"name\": \"" << t.name << "\",\n";
-        file << "    \"category\": \"" << t.category << "\",\n";
-        file << "    \"priority\": \"" << t.priority << "\",\n";
-        file << "    \"deadline\": \"" << t.deadline << "\",\n";
-        file << "    \"completed\": " << (t.completed ? "true" : "false") << ",\n";
-        file << "    \"username\": \"" << t.username << "\"\n";
-        file << "  }";
-        if (i < tasks.size() - 1) file << ",";
-        file << "\n";
-    }
-    file << "]";
-    file.close();
-}
-
-void loadTasks() {
-    std::ifstream file("tasks.json");
-    if (!file.is_open()) {
-        std::cout << "No tasks.json found, starting fresh.\n";
-        return;
-    }
-    
-    std::string content((std::istreambuf_iterator<char>(file)), 
-                       std::istreambuf_iterator<char>());
-    file.close();
-    
-    tasks.clear();
-    
-    size_t pos = 0;
-    while ((pos = content.find("\"id\"", pos)) != std::string::npos) {
-        Task task;
-        
-        size_t id_start = content.find(":", pos) + 1;
-        size_t id_end = content.find(",", id_start);
-        task.id = std::stoll(content.substr(id_start, id_end - id_start));
-        
-        size_t name_start = content.find("\"name\"", id_end);
-        name_start = content.find(":", name_start) + 1;
-        name_start = content.find("\"", name_start) + 1;
-        size_t name_end = content.find("\"", name_start);
-        task.name = content.substr(name_start, name_end - name_start);
-        
-        size_t category_start = content.find("\"category\"", name_end);
-        if (category_start != std::string::npos) {
-            category_start = content.find(":", category_start) + 1;
-            category_start = content.find("\"", category_start) + 1;
-            size_t category_end = content.find("\"", category_start);
-            task.category = content.substr(category_start, category_end - category_start);
-        }
-        
-        size_t priority_start = content.find("\"priority\"", name_end);
-        priority_start = content.find(":", priority_start) + 1;
-        priority_start = content.find("\"", priority_start) + 1;
-        size_t priority_end = content.find("\"", priority_start);
-        task.priority = content.substr(priority_start, priority_end - priority_start);
-        
-        size_t deadline_start = content.find("\"deadline\"", priority_end);
-        deadline_start = content.find(":", deadline_start) + 1;
-        deadline_start = content.find("\"", deadline_start) + 1;
-        size_t deadline_end = content.find("\"", deadline_start);
-        task.deadline = content.substr(deadline_start, deadline_end - deadline_start);
-        
-        size_t completed_start = content.find("\"completed\"", deadline_end);
-        completed_start = content.find(":", completed_start) + 1;
-        size_t completed_end = content.find(",", completed_start);
-        if (completed_end == std::string::npos) completed_end = content.find("}", completed_start);
-        std::string completed_str = content.substr(completed_start, completed_end - completed_start);
-        task.completed = (completed_str.find("true") != std::string::npos);
-        
-        size_t username_start = content.find("\"username\"", deadline_end);
-        if (username_start != std::string::npos) {
-            username_start = content.find(":", username_start) + 1;
-            username_start = content.find("\"", username_start) + 1;
-            size_t username_end = content.find("\"", username_start);
-            task.username = content.substr(username_start, username_end - username_start);
-        } else {
-            task.username = "default";
-        }
-        
-        tasks.push_back(task);
-        pos = completed_end;
-    }
-}
-
-std::map<std::string, std::string> parseJson(const std::string &json) {
-    std::map<std::string, std::string> result;
-    size_t pos = 0;
-    
-    while ((pos = json.find("\"", pos)) != std::string::npos) {
-        size_t key_start = pos + 1;
-        size_t key_end = json.find("\"", key_start);
-        std::string key = json.substr(key_start, key_end - key_start);
-        
-        size_t value_start = json.find(":", key_end) + 1;
-        while (value_start < json.length() && (json[value_start] == ' ' || json[value_start] == '\n' || json[value_start] == '\r' || json[value_start] == '\t')) {
-            value_start++;
-        }
-        
-        std::string value;
-        if (value_start < json.length() && json[value_start] == '\"') {
-            value_start++;
-            size_t value_end = json.find("\"", value_start);
-            value = json.substr(value_start, value_end - value_start);
-            pos = value_end + 1;
-        } else {
-            size_t value_end = json.find_first_of(",}\n\r\t", value_start);
-            value = json.substr(value_start, value_end - value_start);
-            while (!value.empty() && (value.back() == ' ' || value.back() == '\n' || value.back() == '\r' || value.back() == '\t')) {
-                value.pop_back();
-            }
-            pos = value_end;
-        }
-        
-        result[key] = value;
-    }
-    
-    return result;
-}
-
-std::string handleRequest(const std::string &method, const std::string &path, const std::string &body) {
-    std::cout << "Request: " << method << " " << path << std::endl;
-    
-    if (method == "GET") {
-        if (path == "/" || path == "/index.html") {
-            return serveFile("index.html");
-        }
-        else if (path == "/login.html") {
-            return serveFile("login.html");
-        }
-        else if (path == "/signup.html") {
-            return serveFile("signup.html");
-        }
-        else if (path == "/style.css") {
-            return serveFile("style.css");
-        }
-        else if (path == "/script.js") {
-            return serveFile("script.js");
-        }
-        else if (path.find("/schedule") == 0) {
-     
-            std::string username = "default";
-            size_t user_pos = path.find("?user=");
-            if (user_pos != std::string::npos) {
-                username = path.substr(user_pos + 6);
-       
-                size_t end_pos = username.find("&");
-                if (end_pos != std::string::npos) {
-                    username = username.substr(0, end_pos);
-                }
-                end_pos = username.find(" ");
-                if (end_pos != std::string::npos) {
-                    username = username.substr(0, end_pos);
-                }
-            }
-            
-            std::cout << "Getting tasks for user: '" << username << "'" << std::endl;
-            
-            std::string json = "[";
-            int count = 0;
-            for (size_t i = 0; i < tasks.size(); i++) {
-                const Task &t = tasks[i];
-                if (t.username == username) {
-                    if (count > 0) json += ",";
-                    json += "{";
-                    json += "\"id\":" + std::to_string(t.id) + ",";
-                    json += "\"name\":\"" + t.name + "\",";
-                    json += "\"category\":\"" + t.category + "\",";
-                    json += "\"priority\":\"" + t.priority + "\",";
-                    json += "\"deadline\":\"" + t.deadline + "\",";
-                    json += "\"completed\":";
-                    json += (t.completed ? "true" : "false");
-                    json += "}";
-                    count++;
-                }
-            }
-            json += "]";
-            std::cout << "Returning " << count << " tasks for user: " << username << std::endl;
-            return createResponse(json);
-        }
-    }
-    
-    if (method == "POST" && path == "/add_task") {
-        auto data = parseJson(body);
-        if (data.find("id") == data.end() || data.find("name") == data.end()) {
-            return createErrorResponse("Missing required fields");
-        }
-        
-        Task task;
-        task.id = std::stoll(data["id"]);
-        task.name = data["name"];
-        task.category = data["category"];
-        task.priority = data["priority"];
-        task.deadline = data["deadline"];
-        task.completed = false;
-        task.username = data["username"];
-        
-        std::cout << "Adding task for user: " << task.username << std::endl;
-        
-        tasks.push_back(task);
-        saveTasks();
-        
-        return createResponse("{\"message\":\"Task added successfully\"}");
-    }
-    
-    if (method == "POST" && path == "/toggle_complete") {
-        auto data = parseJson(body);
-        if (data.find("id") == data.end()) {
-            return createErrorResponse("Missing task ID");
-        }
-        
-        long long taskId = std::stoll(data["id"]);
-        std::string username = data["username"];
-        
-        for (auto &t : tasks) {
-            if (t.id == taskId && t.username == username) {
-                t.completed = !t.completed;
-                saveTasks();
-                return createResponse("{\"message\":\"Updated\"}");
-            }
-        }
-        
-        return createErrorResponse("Task not found");
-    }
-    
-    if (method == "POST" && path == "/delete_task") {
-        auto data = parseJson(body);
-        if (data.find("id") == data.end()) {
-            return createErrorResponse("Missing task ID");
-        }
-        
-        long long taskId = std::stoll(data["id"]);
-        std::string username = data["username"];
-        
-        for (size_t i = 0; i < tasks.size(); i++) {
-            if (tasks[i].id == taskId && tasks[i].username == username) {
-                tasks.erase(tasks.begin() + i);
-                saveTasks();
-                return createResponse("{\"message\":\"Deleted\"}");
-            }
-        }
-        
-        return createErrorResponse("Task not found");
-    }
-    
-    if (method == "POST" && path == "/register") {
-        auto data = parseJson(body);
-        if (data.find("username") == data.end() || data.find("password") == data.end()) {
-            return createErrorResponse("Missing username or password");
-        }
-        
-        std::string username = data["username"];
-        std::string password = data["password"];
-        
-        if (userExists(username)) {
-            return createErrorResponse("Username already exists");
-        }
-        
-        User newUser;
-        newUser.username = username;
-        newUser.password = password;
-        users.push_back(newUser);
-        saveUsers();
-        
-        return createResponse("{\"message\":\"User registered successfully\"}");
-    }
-    
-    if (method == "POST" && path == "/login") {
-        auto data = parseJson(body);
-        if (data.find("username") == data.end() || data.find("password") == data.end()) {
-            return createErrorResponse("Missing username or password");
-        }
-        
-        std::string username = data["username"];
-        std::string password = data["password"];
-        
-        if (validateUser(username, password)) {
-            return createResponse("{\"message\":\"Login successful\",\"username\":\"" + username + "\"}");
-        } else {
-            return createErrorResponse("Invalid username or password");
-        }
-    }
-    
-    if (method == "OPTIONS") {
-        return createResponse("");
-    }
-    
-    return serveFile("login.html");
-}
-
-int main() {
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        std::cerr << "WSAStartup failed\n";
-        return 1;
-    }
-    
-    SOCKET serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (serverSocket == INVALID_SOCKET) {
-        std::cerr << "Socket creation failed\n";
-        WSACleanup();
-        return 1;
-    }
-    
-    int opt = 1;
-    if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt)) < 0) {
-        std::cerr << "Setsockopt failed\n";
-    }
-    
-    sockaddr_in serverAddr;
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_addr.s_addr = INADDR_ANY;
-    serverAddr.sin_port = htons(8080);
-    
-    if (bind(serverSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        std::cerr << "Bind failed\n";
-        closesocket(serverSocket);
-        WSACleanup();
-        return 1;
-    }
-    
-    if (listen(serverSocket, 10) == SOCKET_ERROR) {
-        std::cerr << "Listen failed\n";
-        closesocket(serverSocket);
-        WSACleanup();
-        return 1;
-    }
-    
-    loadTasks();
-    loadUsers();
-    std::cout << " Server running on http://127.0.0.1:8080\n";
-    std::cout << " Loaded " << tasks.size() << " tasks and " << users.size() << " users\n";
-    
-    while (true) {
-        sockaddr_in clientAddr;
-        int clientAddrSize = sizeof(clientAddr);
-        SOCKET clientSocket = accept(serverSocket, (sockaddr*)&clientAddr, &clientAddrSize);
-        
-        if (clientSocket == INVALID_SOCKET) {
-            std::cerr << "Accept failed\n";
-            continue;
-        }
-        
-        char buffer[4096];
-        int bytesReceived = recv(clientSocket, buffer, sizeof(buffer) - 1, 0);
-        
-        if (bytesReceived > 0) {
-            buffer[bytesReceived] = '\0';
-            std::string request(buffer);
-            
-            size_t method_end = request.find(' ');
-            std::string method = request.substr(0, method_end);
-            
-            size_t path_start = method_end + 1;
-            size_t path_end = request.find(' ', path_start);
-            std::string path = request.substr(path_start, path_end - path_start);
-            
-            std::string body;
-            size_t body_start = request.find("\r\n\r\n");
-            if (body_start != std::string::npos) {
-                body_start += 4;
-                body = request.substr(body_start);
-            }
-            
-            std::string response = handleRequest(method, path, body);
-            send(clientSocket, response.c_str(), response.length(), 0);
-        }
-        
-        closesocket(clientSocket);
-    }
-    
-    closesocket(serverSocket);
-    WSACleanup();
-    return 0;
-}
-
-
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "platform.h"
+#include "http.h"
+#include "admission.h"
+#include "asset_cache.h"
+#include "auth.h"
+#include "deadline_timers.h"
+#include "event_loop.h"
+#include "log.h"
+#include "metrics.h"
+#include "router.h"
+#include "task_store.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "json.h"
+#include "task_json.h"
+#include "worker_pool.h"
+
+struct ServerConfig {
+    int port = 8080;
+    int backlog = SOMAXCONN;    // pending connections the kernel holds per listener
+    unsigned threads = 0;   // 0 means one event loop per hardware thread
+    SyncPolicy syncPolicy = SyncPolicy::Always;
+    int syncIntervalMs = 10;
+    size_t compactBytes = 4 << 20;
+    size_t storeShards = 8;     // task files; a power of two up to TaskStore::SHARDS
+    HttpLimits limits;
+    unsigned hashThreads = 0;   // 0 means half the hardware threads
+    ScryptParams scrypt;
+    LogLevel logLevel = LogLevel::Info;
+    uint32_t logSampleEvery = 1;    // keep one access log line in N
+    // Requests are shed once they have queued this long while the queue
+    // stands, or queueIntervalMs at any time; a target of 0 disables.
+    int queueTargetMs = 5;
+    int queueIntervalMs = 100;
+    // Token buckets, in requests a second and the most saved up; a rate of
+    // 0 disables.
+    double userRate = 0;
+    double userBurst = 0;
+    double ipRate = 0;
+    double ipBurst = 0;
+};
+
+ServerConfig config;
+TaskStore taskStore;
+Logger logger;
+
+// Routes as labelled in /metrics. Every other path counts as "other", so
+// clients cannot grow the set of series.
+enum class Route { Static, Schedule, Overdue, DueSoon, Stats, Events, AddTask, ToggleComplete, DeleteTask, Batch,
+                   Register, Login, Metrics, Preflight, Other };
+RouteMetrics routeMetrics({"static", "/schedule", "/overdue", "/due_soon", "/stats", "/events", "/add_task",
+                           "/toggle_complete", "/delete_task", "/batch", "/register", "/login", "/metrics",
+                           "preflight", "other"});
+
+// Username to password hash. Entries loaded from files written before
+// passwords were hashed hold the plaintext until that user's next login.
+std::unordered_map<std::string, std::string> users;
+
+// Fans task changes out to /events subscribers on every event loop.
+EventHub eventHub;
+
+// A timer for every pending task with a date deadline still ahead, fired by
+// deadlineLoop when that day begins.
+DeadlineTimers deadlineTimers;
+std::atomic<unsigned long long> deadlinesDue{0};
+
+// Request rates per session user and per client address, and what
+// admission control turned away, by Rejection.
+RateLimiter userLimiter;
+RateLimiter ipLimiter;
+enum class Rejection { QueuedRead, QueuedWrite, ClientRate, UserRate };
+std::atomic<unsigned long long> rejections[4] = {};
+std::atomic<int> overloadedLoops{0};
+
+// Password hashing is deliberately slow, so /login and /register hand it to
+// these threads instead of holding up an event loop.
+std::unique_ptr<WorkerPool> hashPool;
+
+// Under --sync always, task changes wait here for their log records to be
+// synced, so the loops go on serving other connections meanwhile.
+std::unique_ptr<WorkerPool> commitPool;
+
+// Signs the tokens /login hands out; the key lives in session.key.
+SessionTokens sessions;
+
+// Checked when a login names an unknown user, so that takes as long as a
+// wrong password and does not reveal which usernames exist.
+std::string dummyPasswordHash;
+
+// Every change is appended to a log, and the snapshots are only rewritten
+// by compaction once it has grown large enough. Tasks are split into
+// config.storeShards partitions by user, each with its own log (and
+// flusher thread) and snapshot, so users in different partitions do not
+// wait for each other's syncs and compaction rewrites one partition at a
+// time. A user's partition is their store shard modulo the count.
+std::vector<std::unique_ptr<WriteAheadLog>> tasksLogs;
+std::unique_ptr<WriteAheadLog> usersLog;
+
+size_t partitionOf(std::string_view username) {
+    return TaskStore::shardOf(username) % tasksLogs.size();
+}
+
+WriteAheadLog &tasksLogFor(std::string_view username) {
+    return *tasksLogs[partitionOf(username)];
+}
+
+// index.html, login.html, signup.html, style.css and script.js, kept in
+// memory and reloaded when they change.
+AssetCache assets;
+
+// Guards `users` and the order of user records in usersLog. It is only held
+// for a hash table lookup or insert, never while hashing.
+std::mutex usersLock;
+
+std::string taskRecord(const StoredTask &t) {
+    StringInterner &strings = StringInterner::instance();
+    char deadline[10];
+    std::string record = "{\"op\":\"put\",\"id\":" + std::to_string(t.id);
+    record += ",\"name\":\"";
+    appendJsonEscaped(record, t.name());
+    record += "\",\"category\":\"";
+    appendJsonEscaped(record, strings.text(t.category));
+    record += "\",\"priority\":\"";
+    appendJsonEscaped(record, strings.text(t.priority));
+    record += "\",\"deadline\":\"";
+    appendJsonEscaped(record, deadlineText(t.deadline, deadline));
+    record += "\",\"completed\":";
+    record += (t.completed ? "true" : "false");
+    record += ",\"username\":\"";
+    appendJsonEscaped(record, strings.text(t.user));
+    record += "\"}";
+    return record;
+}
+
+std::string deleteRecord(const std::string &username, long long id) {
+    return "{\"op\":\"del\",\"id\":" + std::to_string(id) + ",\"username\":\"" + jsonEscape(username) + "\"}";
+}
+
+std::string userRecord(const std::string &username, const std::string &passwordHash) {
+    return "{\"op\":\"user\",\"username\":\"" + jsonEscape(username) + "\",\"password\":\"" + jsonEscape(passwordHash) + "\"}";
+}
+
+// Appends "upserts":[...],"deletes":[...]. With `changed` (sorted, unique
+// ids) only those tasks are sent, and ids no longer in the list become
+// deletes; without it the whole list is sent. Upserts are rendered straight
+// from the stored records. Returns the number of upserts.
+size_t appendChanges(std::string &json, const TaskList* list, const std::vector<long long>* changed) {
+    size_t count = 0;
+    json += "\"upserts\":[";
+    if (changed) {
+        for (long long id : *changed) {
+            const StoredTask* t = list->find(id);
+            if (!t) continue;
+            if (count++ > 0) json += ',';
+            appendTaskJson(json, *t);
+        }
+    } else {
+        for (size_t i = 0; list && i < list->tasks.size(); i++) {
+            if (count++ > 0) json += ',';
+            appendTaskJson(json, *list->tasks[i]);
+        }
+    }
+    json += "],\"deletes\":[";
+    bool first = true;
+    for (size_t i = 0; changed && i < changed->size(); i++) {
+        long long id = (*changed)[i];
+        if (list->find(id)) continue;
+        if (!first) json += ',';
+        appendInteger(json, id);
+        first = false;
+    }
+    json += ']';
+    return count;
+}
+
+// Sends subscribers of /events the change from `previous` to the list's
+// version, in the shape of a /schedule?since= delta plus the version it
+// applies to. Encoded once and shared by every subscribed connection. The
+// event can reach other clients just before the change is synced to disk.
+void publishChanges(const std::string &username, uint64_t previous, const TaskList &list) {
+    if (!eventHub.hasSubscribers(username)) return;
+    std::vector<long long> changed;
+    std::string data = "{\"since\":";
+    appendInteger(data, (long long)previous);
+    data += ",\"version\":";
+    appendInteger(data, (long long)list.version);
+    if (list.changes.changedSince(previous, changed)) {
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+        data += ",\"full\":false,";
+        appendChanges(data, &list, &changed);
+    } else {
+        // A batch larger than the change ring: the client refetches.
+        data += ",\"resync\":true";
+    }
+    data += '}';
+
+    std::shared_ptr<std::string> event = std::make_shared<std::string>();
+    event->reserve(data.size() + 48);
+    *event += "id: ";
+    appendInteger(*event, (long long)list.version);
+    *event += "\nevent: tasks\ndata: ";
+    *event += data;
+    *event += "\n\n";
+    eventHub.publish(username, std::move(event));
+}
+
+// Moves the deadline timers of the tasks changed from `previous` to the
+// list's version.
+void scheduleDeadlines(const std::string &username, uint64_t previous, const TaskList &list) {
+    thread_local std::vector<long long> changed;
+    changed.clear();
+    uint32_t user = StringInterner::instance().intern(username);
+    if (!list.changes.changedSince(previous, changed)) {
+        // A batch larger than the change ring: every task is looked at, and
+        // timers of tasks it deleted are dropped when they fire.
+        for (const StoredTask* t : list.tasks) deadlineTimers.update(user, t->id, t->deadline, t->completed);
+        return;
+    }
+    for (long long id : changed) {
+        const StoredTask* t = list.find(id);
+        if (t) deadlineTimers.update(user, id, t->deadline, t->completed);
+        else deadlineTimers.remove(user, id);
+    }
+}
+
+// Runs under the user's write lock, which keeps log order equal to the
+// order changes were applied in.
+class TaskLogJournal : public TaskJournal {
+public:
+    void taskPut(const StoredTask &task) override {
+        tasksLogFor(StringInterner::instance().text(task.user)).append(taskRecord(task));
+    }
+
+    void taskRemoved(const std::string &username, long long id) override {
+        tasksLogFor(username).append(deleteRecord(username, id));
+    }
+
+    void listPublished(const std::string &username, uint64_t previous, const TaskList &list) override {
+        scheduleDeadlines(username, previous, list);
+        publishChanges(username, previous, list);
+    }
+
+    // One record holding the final put or del of every touched task, so a
+    // batch is replayed entirely or, if the record is torn, not at all.
+    // /batch only touches one user; a batch spanning partitions would get
+    // one record in each.
+    void batchApplied(const std::vector<BatchEffect> &effects) override {
+        std::vector<size_t> partitions;
+        for (const BatchEffect &e : effects) partitions.push_back(partitionOf(*e.username));
+        for (size_t i = 0; i < effects.size(); i++) {
+            if (std::find(partitions.begin(), partitions.begin() + i, partitions[i]) != partitions.begin() + i) continue;
+            std::string record = "{\"op\":\"batch\",\"ops\":[";
+            bool first = true;
+            for (size_t j = i; j < effects.size(); j++) {
+                if (partitions[j] != partitions[i]) continue;
+                const BatchEffect &e = effects[j];
+                if (!first) record += ",";
+                record += e.task ? taskRecord(*e.task) : deleteRecord(*e.username, e.id);
+                first = false;
+            }
+            record += "]}";
+            tasksLogs[partitions[i]]->append(record);
+        }
+    }
+};
+
+TaskLogJournal taskJournal;
+
+// Writes a snapshot next to its final name and renames it into place, so a
+// crash leaves either the old or the new file, never a truncated one. The
+// directory is synced after the rename: only once this returns true may
+// the files the new one replaces, such as log segments, be deleted.
+bool writeFileAtomically(const std::string &path, const std::string &content) {
+    std::string tmp = path + ".tmp";
+    int fd = openFileForWrite(tmp.c_str());
+    if (fd < 0) return false;
+    bool ok = writeFully(fd, content.data(), content.size()) && syncFile(fd);
+    closeFile(fd);
+    std::error_code ec;
+    if (ok) std::filesystem::rename(tmp, path, ec);
+    if (!ok || ec) return false;
+    std::filesystem::path dir = std::filesystem::path(path).parent_path();
+    return syncDirectory(dir.empty() ? "." : dir.string().c_str());
+}
+
+const char* CORS_HEADERS =
+    "Access-Control-Allow-Origin: *\r\n"
+    "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n"
+    "Access-Control-Allow-Headers: Content-Type, Authorization\r\n";
+
+HttpResponse createResponse(std::string_view content, const char* contentType = "application/json") {
+    HttpResponse response;
+    response.contentType = contentType;
+    response.fixedHeaders = CORS_HEADERS;
+    response.body = takeResponseBuffer();
+    response.body.append(content);
+    return response;
+}
+
+// For bodies built in a buffer from takeResponseBuffer(); the buffer is
+// moved in rather than copied.
+HttpResponse createBufferedResponse(std::string &&body) {
+    HttpResponse response;
+    response.contentType = "application/json";
+    response.fixedHeaders = CORS_HEADERS;
+    response.body = std::move(body);
+    return response;
+}
+
+// Adds `ETag: "<version>"` to the per-response headers.
+void addVersionTag(HttpResponse &response, uint64_t version) {
+    if (response.headers.empty()) response.headers = takeResponseBuffer();
+    response.headers += "ETag: \"";
+    appendInteger(response.headers, (long long)version);
+    response.headers += "\"\r\n";
+}
+
+// Decoded value of `name` in a query string, or `fallback` if absent.
+std::string queryParam(std::string_view query, const char* name, const std::string &fallback) {
+    std::string value;
+    return findQueryParam(query, name, value) ? value : fallback;
+}
+
+// Reads the /schedule filter, sort and paging parameters. `present` tells
+// whether any were given; on a bad value `error` says which.
+bool parseTaskQuery(std::string_view queryString, TaskQuery &query, bool &present, const char* &error) {
+    std::string value;
+    present = false;
+    if (findQueryParam(queryString, "date", value)) {
+        query.from = query.to = value;
+        present = true;
+    }
+    if (findQueryParam(queryString, "from", query.from)) present = true;
+    if (findQueryParam(queryString, "to", query.to)) present = true;
+    if (findQueryParam(queryString, "category", value)) {
+        query.category = value;
+        present = true;
+    }
+    if (findQueryParam(queryString, "priority", value)) {
+        query.priority = value;
+        present = true;
+    }
+    if (findQueryParam(queryString, "completed", value)) {
+        present = true;
+        if (value != "true" && value != "false") {
+            error = "completed must be true or false";
+            return false;
+        }
+        query.completed = value == "true";
+    }
+    if (findQueryParam(queryString, "sort", value)) {
+        present = true;
+        if (value == "deadline") query.sort = TaskQuery::ByDeadline;
+        else if (value == "priority") query.sort = TaskQuery::ByPriority;
+        else {
+            error = "sort must be deadline or priority";
+            return false;
+        }
+    }
+    if (findQueryParam(queryString, "limit", value)) {
+        present = true;
+        char* end = nullptr;
+        unsigned long long limit = strtoull(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || limit == 0) {
+            error = "limit must be a positive integer";
+            return false;
+        }
+        query.limit = (size_t)limit;
+    }
+    if (findQueryParam(queryString, "after", query.after)) present = true;
+    return true;
+}
+
+HttpResponse createErrorResponse(const std::string &error, int statusCode = 400) {
+    HttpResponse response;
+    response.status = statusCode;
+    response.contentType = "application/json";
+    response.fixedHeaders = CORS_HEADERS;
+    response.body = takeResponseBuffer();
+    response.body += "{\"error\":\"";
+    appendJsonEscaped(response.body, error);
+    response.body += "\"}";
+    return response;
+}
+
+// Parses a request body into this thread's reusable document. The result is
+// invalid unless the body is a JSON object, and stays valid until the next
+// call on the same thread.
+JsonValue parseBody(std::string_view body) {
+    thread_local JsonDocument doc;
+    if (!doc.parse(body) || !doc.root().isObject()) return JsonValue();
+    return doc.root();
+}
+
+void loadUsers() {
+    std::ifstream file("users.json");
+    if (!file.is_open()) {
+        std::cout << "No users.json found, starting fresh.\n";
+        return;
+    }
+    
+    std::string content((std::istreambuf_iterator<char>(file)), 
+                       std::istreambuf_iterator<char>());
+    file.close();
+    
+    users.clear();
+    
+    JsonDocument doc;
+    if (!doc.parse(content) || !doc.root().isArray()) {
+        std::cerr << "Cannot parse users.json: " << doc.error() << "\n";
+        return;
+    }
+    for (JsonValue item = doc.root().first(); item.valid(); item = item.next()) {
+        std::string username = item["username"].string();
+        if (!username.empty()) users[username] = item["password"].string();
+    }
+}
+
+void replayUsersLog() {
+    JsonDocument doc;
+    size_t records = usersLog->replay([&](const std::string &line) {
+        if (!doc.parse(line) || doc.root()["op"].string() != "user") return;
+        users[doc.root()["username"].string()] = doc.root()["password"].string();
+    });
+    if (records > 0) std::cout << " Replayed " << records << " user log records\n";
+}
+
+bool saveUsers() {
+    std::ostringstream file;
+    file << "[\n";
+    size_t i = 0;
+    for (const auto &user : users) {
+        file << "  {\n";
+        file << "    \"username\": \"" << jsonEscape(user.first) << "\",\n";
+        file << "    \"password\": \"" << jsonEscape(user.second) << "\"\n";
+        file << "  }";
+        if (++i < users.size()) file << ",";
+        file << "\n";
+    }
+    file << "]";
+    if (!writeFileAtomically("users.json", file.str())) {
+        logger.error("compaction failed").kv("file", "users.json");
+        return false;
+    }
+    return true;
+}
+
+// Sessions survive restarts because the signing key does. A missing or
+// short key file is replaced with a fresh key, which logs everyone out.
+bool loadSessionKey(std::string &key) {
+    std::ifstream file("session.key", std::ios::binary);
+    if (file.is_open()) {
+        key.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (key.size() >= 32) return true;
+    }
+    key = randomBytes(32);
+    return writeFileAtomically("session.key", key);
+}
+
+// The user a session token was issued to. Empty if the token is altered or
+// expired.
+std::string tokenUser(std::string_view token) {
+    std::string username;
+    if (!sessions.verify(token, username, (int64_t)std::time(nullptr))) username.clear();
+    return username;
+}
+
+// The user a task request acts for, taken from its
+// "Authorization: Bearer <token>" header. Empty if the token is missing,
+// altered or expired.
+std::string authenticatedUser(const HttpRequest &request) {
+    std::string_view auth = request.authorization;
+    const size_t SCHEME = sizeof("Bearer ") - 1;
+    if (auth.size() <= SCHEME || !headerEquals(auth.data(), SCHEME, "bearer ")) return std::string();
+    return tokenUser(auth.substr(SCHEME));
+}
+
+HttpResponse createUnauthorizedResponse() {
+    HttpResponse response = createErrorResponse("Not logged in", 401);
+    response.headers += "WWW-Authenticate: Bearer\r\n";
+    return response;
+}
+
+// Files of partition `partition` of `partitions`: tasks-<p>-of-<n>.snap
+// and the log segments tasks-<p>-of-<n>.wal.*.
+std::string taskFileBase(size_t partition, size_t partitions) {
+    return "tasks-" + std::to_string(partition) + "-of-" + std::to_string(partitions);
+}
+
+// Writes the tasks of one partition to its snapshot and moves its users
+// that are still served from an older snapshot over to the new mapping.
+bool saveTasks(size_t partition) {
+    SnapshotBuilder builder;
+    taskStore.forEachUser([&](const std::string &username, const TaskList &list) {
+        if (list.tasks.empty()) return;
+        builder.beginUser(username);
+        for (const StoredTask* t : list.tasks) {
+            builder.addTask(*t);
+        }
+    }, partition, tasksLogs.size());
+    std::string path = taskFileBase(partition, tasksLogs.size()) + ".snap";
+    std::string image;
+    if (!builder.finish(image)) {
+        logger.error("compaction failed").kv("file", path).kv("error", "snapshot too large");
+        return false;
+    }
+    if (!writeFileAtomically(path, image)) {
+        logger.error("compaction failed").kv("file", path);
+        return false;
+    }
+    
+    std::string error;
+    std::shared_ptr<const TaskSnapshot> snap = TaskSnapshot::open(path, error);
+    if (snap) {
+        taskStore.rebaseSnapshot(snap);
+    } else {
+        logger.error("cannot reopen snapshot").kv("file", path).kv("error", error);
+    }
+    return true;
+}
+
+// Runs work(i) for every i < count, on up to one thread per core.
+void runParallel(size_t count, const std::function<void(size_t)> &work) {
+    size_t threads = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < threads; t++) {
+        pool.emplace_back([&]() {
+            for (size_t i; (i = next.fetch_add(1)) < count;) work(i);
+        });
+    }
+    for (std::thread &thread : pool) thread.join();
+}
+
+// Applies the records of one task log to the store. Logs of different
+// partitions hold different users and may be replayed concurrently.
+size_t replayTasksLog(const std::string &baseName) {
+    JsonDocument doc;
+    std::function<void(JsonValue)> apply = [&](JsonValue data) {
+        std::string op = data["op"].string();
+        if (op == "put") {
+            Task task;
+            task.completed = false;
+            if (readTaskFields(data, task)) taskStore.put(task);
+        } else if (op == "del") {
+            long long id;
+            if (data["id"].getInt64(id)) taskStore.remove(data["username"].string(), id);
+        } else if (op == "batch") {
+            for (JsonValue item = data["ops"].first(); item.valid(); item = item.next()) apply(item);
+        }
+    };
+    return WriteAheadLog::replay(baseName, [&](const std::string &line) {
+        if (doc.parse(line)) apply(doc.root());
+    });
+}
+
+// tasks.layout names the partition count the task files were written with.
+// Without it they are the single tasks.snap (or tasks.json) and tasks.wal
+// of earlier versions, reported as 0.
+const char* TASK_LAYOUT_FILE = "tasks.layout";
+
+size_t storedPartitions() {
+    std::ifstream file(TASK_LAYOUT_FILE);
+    std::string key;
+    size_t partitions = 0;
+    if (!(file >> key >> partitions) || key != "partitions") return 0;
+    return partitions;
+}
+
+// Deletes the task files of every layout but `keep`: partition files of
+// other counts and, unless `keep` is 0, tasks.snap and tasks.wal.*. They
+// are either superseded or left by a change of count that did not finish.
+// tasks.json is never deleted.
+void removeTaskFiles(size_t keep) {
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(".", ec)) {
+        std::string name = entry.path().filename().string();
+        unsigned partition = 0, partitions = 0;
+        int consumed = 0;
+        if (sscanf(name.c_str(), "tasks-%u-of-%u.%n", &partition, &partitions, &consumed) != 2 || consumed == 0) continue;
+        if (partitions != keep) std::filesystem::remove(entry.path(), ec);
+    }
+    if (keep != 0) {
+        std::filesystem::remove("tasks.snap", ec);
+        WriteAheadLog::dropThrough("tasks.wal", UINT64_MAX);
+    }
+}
+
+// Loads the tasks in whatever layout they were saved, each partition on its
+// own thread, and replays the logs on top. If the layout's partition count
+// differs from config.storeShards, every partition is written out in the
+// new layout before tasks.layout switches to it and the old files go.
+// Returns false only if a snapshot exists but cannot be used; starting
+// without it would silently drop its tasks.
+bool loadTasks() {
+    size_t stored = storedPartitions();
+    removeTaskFiles(stored);
+    
+    std::atomic<bool> ok{true};
+    std::atomic<size_t> records{0};
+    if (stored > 0) {
+        runParallel(stored, [&](size_t partition) {
+            std::string base = taskFileBase(partition, stored);
+            if (std::filesystem::exists(base + ".snap")) {
+                std::string error;
+                std::shared_ptr<const TaskSnapshot> snap = TaskSnapshot::open(base + ".snap", error);
+                if (!snap) {
+                    std::cerr << "Cannot load " << base << ".snap: " << error << "\n";
+                    ok = false;
+                    return;
+                }
+                taskStore.attachSnapshot(snap);
+            }
+            records += replayTasksLog(base + ".wal");
+        });
+    } else if (std::filesystem::exists("tasks.snap")) {
+        std::string error;
+        std::shared_ptr<const TaskSnapshot> snap = TaskSnapshot::open("tasks.snap", error);
+        if (!snap) {
+            std::cerr << "Cannot load tasks.snap: " << error << "\n";
+            return false;
+        }
+        taskStore.attachSnapshot(snap);
+        records = replayTasksLog("tasks.wal");
+    } else {
+        // Data from before binary snapshots.
+        std::ifstream file("tasks.json");
+        if (file.is_open()) {
+            std::string content((std::istreambuf_iterator<char>(file)), 
+                               std::istreambuf_iterator<char>());
+            std::vector<Task> tasks;
+            std::string error;
+            if (!parseTasksJson(content, tasks, error)) {
+                std::cerr << "Cannot load tasks.json: " << error << "\n";
+                return false;
+            }
+            taskStore.load(tasks);
+        } else {
+            std::cout << "No tasks.json found, starting fresh.\n";
+        }
+        records = replayTasksLog("tasks.wal");
+    }
+    if (!ok) return false;
+    if (records > 0) std::cout << " Replayed " << records << " task log records\n";
+    if (stored == tasksLogs.size()) return true;
+    
+    // Every step is on disk, directory entries included, before the next:
+    // the new partitions before tasks.layout names them, and tasks.layout
+    // before the old files go (writeFileAtomically syncs the directory).
+    runParallel(tasksLogs.size(), [&](size_t partition) {
+        if (!saveTasks(partition)) ok = false;
+    });
+    if (!ok || !syncDirectory(".") ||
+        !writeFileAtomically(TASK_LAYOUT_FILE, "partitions " + std::to_string(tasksLogs.size()) + "\n")) {
+        std::cerr << "Cannot write tasks in " << tasksLogs.size() << " partitions\n";
+        return false;
+    }
+    removeTaskFiles(tasksLogs.size());
+    if (stored > 0) std::cout << " Moved tasks from " << stored << " to " << tasksLogs.size() << " partitions\n";
+    return true;
+}
+
+// Folds each log into a fresh snapshot once it has grown large enough; the
+// task partitions share config.compactBytes between them. The segment is
+// sealed before the snapshot is taken, and the snapshot reads each user
+// under its write lock, after any change journaled in the sealed segment
+// has been published (see TaskStore::forEachUser), so everything in it is
+// already reflected when it is dropped. Segments are only dropped once the
+// new snapshot is durable, directory entry included (see
+// writeFileAtomically); records appended meanwhile land in
+// the next segment and are replayed on top, which is safe because records
+// are idempotent.
+void compactionLoop() {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        
+        size_t threshold = std::max<size_t>(1, config.compactBytes / tasksLogs.size());
+        for (size_t partition = 0; partition < tasksLogs.size(); partition++) {
+            WriteAheadLog &log = *tasksLogs[partition];
+            if (log.bytesSinceSeal() < threshold) continue;
+            uint64_t sealed = log.seal();
+            if (saveTasks(partition)) log.dropThrough(sealed);
+        }
+        
+        if (usersLog->bytesSinceSeal() >= config.compactBytes) {
+            std::lock_guard<std::mutex> lock(usersLock);
+            uint64_t sealed = usersLog->seal();
+            if (saveUsers()) usersLog->dropThrough(sealed);
+        }
+    }
+}
+
+// When a UTC day begins, tells each user which pending tasks fall due that
+// day: an "event: due" on /events, {"date": D, "tasks": [...]}, and a line
+// in the log. The tasks come straight from the timers, so the day's work
+// follows the number of tasks due rather than the number stored. Each is
+// checked against the store first, which drops timers left behind by
+// tasks a large batch deleted.
+void deadlineLoop() {
+    std::vector<DeadlineTimers::Due> due;
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        
+        int32_t today = todayDeadlineCode();
+        due.clear();
+        deadlineTimers.advance(today, due);
+        if (due.empty()) continue;
+        std::sort(due.begin(), due.end(), [](const DeadlineTimers::Due &a, const DeadlineTimers::Due &b) {
+            return a.user < b.user || (a.user == b.user && a.id < b.id);
+        });
+        
+        char date[10];
+        std::string_view dateText = deadlineText(today, date);
+        size_t total = 0;
+        size_t userCount = 0;
+        for (size_t begin = 0, end; begin < due.size(); begin = end) {
+            for (end = begin + 1; end < due.size() && due[end].user == due[begin].user; end++) {}
+            std::string username(StringInterner::instance().text(due[begin].user));
+            bool subscribed = eventHub.hasSubscribers(username);
+            std::string data = "{\"date\":\"";
+            data += dateText;
+            data += "\",\"tasks\":[";
+            size_t count = 0;
+            {
+                RcuReadGuard guard;
+                const TaskList* list = taskStore.snapshot(username);
+                for (size_t i = begin; list && i < end; i++) {
+                    const StoredTask* t = list->find(due[i].id);
+                    if (!t || t->completed || t->deadline != due[i].deadline) continue;
+                    if (subscribed) {
+                        if (count > 0) data += ',';
+                        appendTaskJson(data, *t);
+                    }
+                    count++;
+                }
+            }
+            if (count == 0) continue;
+            data += "]}";
+            total += count;
+            userCount++;
+            logger.debug("deadlines due").kv("user", username).kv("tasks", count);
+            if (subscribed) {
+                std::shared_ptr<std::string> event = std::make_shared<std::string>("event: due\ndata: ");
+                *event += data;
+                *event += "\n\n";
+                eventHub.publish(username, std::move(event));
+            }
+        }
+        deadlinesDue.fetch_add(total, std::memory_order_relaxed);
+        logger.info("deadlines due").kv("date", dateText).kv("tasks", total).kv("users", userCount);
+    }
+}
+
+// What the handlers and middleware share about one request.
+struct RequestContext {
+    const HttpRequest &request;
+    std::string user;           // the session's user, on routes that need one
+};
+
+// Route flags, read by the middleware.
+const uint32_t NEEDS_SESSION = 1;       // 401 without a valid session token
+const uint32_t TOKEN_IN_QUERY = 2;      // the token may also come as ?token=
+const uint32_t EXPENSIVE = 4;           // writes to disk or hashes a password; shed first
+
+// Adapts a handler that takes a decoded request. Decode reads the raw
+// request into a Req, or fails with `error`, which is answered with 400
+// before Handle runs; handlers only ever see input that has been checked.
+template <typename Req, bool (*Decode)(const RequestContext&, Req&, const char*&),
+          HttpResponse (*Handle)(RequestContext&, Req&)>
+HttpResponse typed(RequestContext &ctx) {
+    Req req;
+    const char* error = "Invalid request";
+    if (!Decode(ctx, req, error)) return createErrorResponse(error);
+    return Handle(ctx, req);
+}
+
+struct TaskIdRequest {
+    long long id = 0;
+};
+
+bool decodeTaskId(const RequestContext &ctx, TaskIdRequest &req, const char* &error) {
+    JsonValue data = parseBody(ctx.request.body);
+    if (!data.valid()) error = "Invalid JSON";
+    else if (!data["id"].valid()) error = "Missing task ID";
+    else if (!data["id"].getInt64(req.id)) error = "Invalid task ID";
+    else return true;
+    return false;
+}
+
+// For tasks whose category, priority or deadline text is new once the
+// string table is full (see StringInterner::BUDGET_BYTES).
+const char* const TOO_MANY_VALUES = "Too many distinct categories, priorities or deadlines";
+
+// A new task for the session's user; a username in the body is ignored.
+struct NewTaskRequest {
+    Task task;
+};
+
+bool decodeNewTask(const RequestContext &ctx, NewTaskRequest &req, const char* &error) {
+    JsonValue data = parseBody(ctx.request.body);
+    if (!data.valid()) error = "Invalid JSON";
+    else if (!data["id"].valid() || !data["name"].valid()) error = "Missing required fields";
+    else if (!readTaskFields(data, req.task)) error = "Invalid task ID";
+    else if (!StoredTask::internFields(req.task)) error = TOO_MANY_VALUES;
+    else {
+        req.task.completed = false;
+        req.task.username = ctx.user;
+        return true;
+    }
+    return false;
+}
+
+struct Credentials {
+    std::string username;
+    std::string password;
+};
+
+bool decodeCredentials(const RequestContext &ctx, Credentials &req, const char* &error) {
+    JsonValue data = parseBody(ctx.request.body);
+    if (!data.valid()) error = "Invalid JSON";
+    else if (!data["username"].isString() || !data["password"].isString()) error = "Missing username or password";
+    else {
+        req.username = data["username"].string();
+        req.password = data["password"].string();
+        return true;
+    }
+    return false;
+}
+
+bool decodeRegistration(const RequestContext &ctx, Credentials &req, const char* &error) {
+    if (!decodeCredentials(ctx, req, error)) return false;
+    if (req.username.empty()) {
+        error = "Missing username or password";
+        return false;
+    }
+    return true;
+}
+
+// Sends `response` to a change of `username`'s tasks once the change is
+// durable. Waiting for the sync is deferred to the commit pool; a log that
+// has failed to write answers 500 instead, since the change may not survive
+// a restart.
+HttpResponse afterCommit(const std::string &username, HttpResponse response) {
+    WriteAheadLog &log = tasksLogFor(username);
+    if (!log.syncsOnCommit()) {
+        return log.commit() ? response : createErrorResponse("Could not save the change", 500);
+    }
+    HttpResponse deferred;
+    deferred.deferredPool = commitPool.get();
+    deferred.deferred = [&log, ticket = log.lastAppended(), response = std::move(response)]() {
+        return log.commit(ticket) ? response : createErrorResponse("Could not save the change", 500);
+    };
+    return deferred;
+}
+
+// POST /batch: {"ops": [{"op": "add"|"update"|"toggle"|"delete", "id": ..., ...}]}
+// Ops act on the tasks of the user the session token names; an op naming
+// another "username" is malformed. Malformed ops reject the batch with 400
+// before anything runs; otherwise it is applied all-or-nothing (409 if any
+// op fails) and logged as one record with one commit.
+struct BatchRequest {
+    std::vector<BatchOp> ops;
+    std::vector<BatchResult> results;   // one per op, failed for malformed ops
+    bool malformed = false;
+};
+
+// Only a body without an ops array fails here; a malformed op is reported
+// in its own result, alongside the others.
+bool decodeBatch(const RequestContext &ctx, BatchRequest &req, const char* &error) {
+    JsonValue data = parseBody(ctx.request.body);
+    if (!data.valid() || !data["ops"].isArray()) {
+        error = "Expected an object with an ops array";
+        return false;
+    }
+    
+    for (JsonValue item = data["ops"].first(); item.valid(); item = item.next()) {
+        BatchOp op;
+        op.task.completed = false;
+        op.task.username = ctx.user;
+        std::string type = item["op"].string();
+        const char* opError = nullptr;
+        if (type == "add") op.type = BatchOp::Add;
+        else if (type == "update") op.type = BatchOp::Update;
+        else if (type == "toggle") op.type = BatchOp::Toggle;
+        else if (type == "delete") op.type = BatchOp::Remove;
+        else opError = "Unknown op";
+        
+        if (!opError && !readTaskFields(item, op.task)) opError = "Missing or invalid task ID";
+        if (!opError && op.task.username != ctx.user) opError = "Not allowed to change another user's tasks";
+        if (!opError && op.type == BatchOp::Add && !item["name"].isString()) opError = "Missing required fields";
+        if (!opError && op.type == BatchOp::Update) {
+            if (item["name"].valid()) op.fields |= BatchOp::NAME;
+            if (item["category"].valid()) op.fields |= BatchOp::CATEGORY;
+            if (item["priority"].valid()) op.fields |= BatchOp::PRIORITY;
+            if (item["deadline"].valid()) op.fields |= BatchOp::DEADLINE;
+            if (item["completed"].valid()) op.fields |= BatchOp::COMPLETED;
+        }
+        if (op.type == BatchOp::Add) op.task.completed = false;
+        if (!opError && (op.type == BatchOp::Add || op.type == BatchOp::Update) &&
+            !StoredTask::internFields(op.task)) {
+            opError = TOO_MANY_VALUES;
+        }
+        
+        req.results.push_back(BatchResult{opError == nullptr, opError});
+        if (opError) req.malformed = true;
+        req.ops.push_back(std::move(op));
+    }
+    return true;
+}
+
+HttpResponse handleBatch(RequestContext &ctx, BatchRequest &req) {
+    const std::string &username = ctx.user;
+    std::vector<BatchResult> &results = req.results;
+    bool applied = !req.malformed && taskStore.applyBatch(req.ops, results);
+    
+    std::string json = takeResponseBuffer();
+    json += applied ? "{\"applied\":true,\"results\":[" : "{\"applied\":false,\"results\":[";
+    for (size_t i = 0; i < results.size(); i++) {
+        if (i > 0) json += ",";
+        if (results[i].ok) {
+            json += "{\"ok\":true}";
+        } else {
+            json += "{\"ok\":false,\"error\":\"";
+            appendJsonEscaped(json, results[i].error);
+            json += "\"}";
+        }
+    }
+    json += "]}";
+    
+    logger.debug("batch").kv("user", username).kv("ops", req.ops.size()).kv("applied", applied ? "true" : "false");
+    HttpResponse response = createBufferedResponse(std::move(json));
+    if (!applied) response.status = req.malformed ? 400 : 409;
+    return applied ? afterCommit(username, std::move(response)) : response;
+}
+
+void appendGauge(std::string &out, const char* name, long long value) {
+    out += "# TYPE ";
+    out += name;
+    out += " gauge\n";
+    out += name;
+    out += ' ';
+    appendInteger(out, value);
+    out += '\n';
+}
+
+// One histogram family with a series for the task logs, all partitions
+// together, and one for the user log.
+void appendLogHistograms(std::string &out, const char* name, const LatencyHistogram &(WriteAheadLog::*which)() const) {
+    LatencyHistogram::Snapshot snapshots[2];
+    for (const std::unique_ptr<WriteAheadLog> &log : tasksLogs) (log.get()->*which)().addTo(snapshots[0]);
+    (usersLog.get()->*which)().addTo(snapshots[1]);
+    const char* labels[2] = {"log=\"tasks\"", "log=\"users\""};
+    std::string quantiles = std::string(name) + "_quantile";
+    out += "# TYPE " + std::string(name) + " histogram\n";
+    for (int i = 0; i < 2; i++) appendHistogramSeries(out, name, labels[i], snapshots[i]);
+    out += "# TYPE " + quantiles + " gauge\n";
+    for (int i = 0; i < 2; i++) appendQuantileSeries(out, quantiles.c_str(), labels[i], snapshots[i]);
+}
+
+// GET /metrics, in the Prometheus text format.
+HttpResponse handleMetrics() {
+    std::string out = takeResponseBuffer();
+    routeMetrics.render(out);
+    appendGauge(out, "taskbuddy_open_connections", EventLoop::openConnections().load(std::memory_order_relaxed));
+    appendGauge(out, "taskbuddy_tasks", (long long)taskStore.size());
+    appendGauge(out, "taskbuddy_task_record_bytes", (long long)taskStore.recordBytes());
+    appendGauge(out, "taskbuddy_event_subscribers", eventHub.subscribers.load(std::memory_order_relaxed));
+    appendGauge(out, "taskbuddy_deadline_timers", (long long)deadlineTimers.pending());
+    size_t userCount;
+    {
+        std::lock_guard<std::mutex> lock(usersLock);
+        userCount = users.size();
+    }
+    appendGauge(out, "taskbuddy_users", (long long)userCount);
+    
+    uint64_t taskSyncs = 0;
+    uint64_t taskLogBytes = 0;
+    for (const std::unique_ptr<WriteAheadLog> &log : tasksLogs) {
+        taskSyncs += log->syncCount();
+        taskLogBytes += log->bytesWritten();
+    }
+    out += "# TYPE taskbuddy_wal_fsyncs_total counter\n";
+    out += "taskbuddy_wal_fsyncs_total{log=\"tasks\"} " + std::to_string(taskSyncs) + "\n";
+    out += "taskbuddy_wal_fsyncs_total{log=\"users\"} " + std::to_string(usersLog->syncCount()) + "\n";
+    out += "# TYPE taskbuddy_wal_bytes_total counter\n";
+    out += "taskbuddy_wal_bytes_total{log=\"tasks\"} " + std::to_string(taskLogBytes) + "\n";
+    out += "taskbuddy_wal_bytes_total{log=\"users\"} " + std::to_string(usersLog->bytesWritten()) + "\n";
+    appendLogHistograms(out, "taskbuddy_wal_fsync_duration_seconds", &WriteAheadLog::syncLatency);
+    appendLogHistograms(out, "taskbuddy_wal_commit_wait_seconds", &WriteAheadLog::commitLatency);
+    
+    out += "# TYPE taskbuddy_events_published_total counter\n";
+    out += "taskbuddy_events_published_total " + std::to_string(eventHub.publishedCount()) + "\n";
+    out += "# TYPE taskbuddy_event_evictions_total counter\n";
+    out += "taskbuddy_event_evictions_total " + std::to_string(eventHub.evictions.load(std::memory_order_relaxed)) + "\n";
+    
+    out += "# TYPE taskbuddy_deadlines_due_total counter\n";
+    out += "taskbuddy_deadlines_due_total " + std::to_string(deadlinesDue.load(std::memory_order_relaxed)) + "\n";
+    out += "# TYPE taskbuddy_connection_timeouts_total counter\n";
+    const char* phases[4] = {nullptr, "idle", "header", "body"};
+    for (int i = 1; i < 4; i++) {
+        out += "taskbuddy_connection_timeouts_total{phase=\"";
+        out += phases[i];
+        out += "\"} " + std::to_string(EventLoop::timeouts()[i].load(std::memory_order_relaxed)) + "\n";
+    }
+
+    out += "# TYPE taskbuddy_admission_rejected_total counter\n";
+    const char* reasons[4] = {"queued_read", "queued_write", "client_rate", "user_rate"};
+    for (int i = 0; i < 4; i++) {
+        out += "taskbuddy_admission_rejected_total{reason=\"";
+        out += reasons[i];
+        out += "\"} " + std::to_string(rejections[i].load(std::memory_order_relaxed)) + "\n";
+    }
+    out += "taskbuddy_admission_rejected_total{reason=\"connections\"} " +
+           std::to_string(EventLoop::refusedConnections().load(std::memory_order_relaxed)) + "\n";
+    out += "taskbuddy_admission_rejected_total{reason=\"workers_busy\"} " +
+           std::to_string(EventLoop::busyRejections().load(std::memory_order_relaxed)) + "\n";
+    appendGauge(out, "taskbuddy_admission_overloaded_loops", overloadedLoops.load(std::memory_order_relaxed));
+    appendGauge(out, "taskbuddy_rate_limiter_keys", (long long)(userLimiter.size() + ipLimiter.size()));
+    
+    out += "# TYPE taskbuddy_log_lines_total counter\n";
+    out += "taskbuddy_log_lines_total{result=\"written\"} " + std::to_string(logger.writtenLines()) + "\n";
+    out += "taskbuddy_log_lines_total{result=\"dropped\"} " + std::to_string(logger.droppedLines()) + "\n";
+    
+    HttpResponse response = createBufferedResponse(std::move(out));
+    response.contentType = "text/plain; version=0.0.4";
+    response.headers += "Cache-Control: no-store\r\n";
+    return response;
+}
+
+// Answers a filtered, sorted or paged query with {"version": V, "tasks":
+// [...], "next": cursor|null}. The indexes pick the matching slots, which
+// are rendered into the body. Must be called inside an RcuReadGuard.
+HttpResponse queryResponse(const TaskList* list, const TaskQuery &query, const std::string &username, const char* what) {
+    uint64_t version = list ? list->version : TaskList::initialVersion();
+    thread_local std::vector<uint32_t> slots;
+    slots.clear();
+    std::string next;
+    if (list && !list->query.run(query, list->tasks, slots, next)) {
+        return createErrorResponse("Invalid cursor");
+    }
+    std::string json = takeResponseBuffer();
+    json += "{\"version\":";
+    appendInteger(json, (long long)version);
+    json += ",\"tasks\":[";
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (i > 0) json += ',';
+        appendTaskJson(json, *list->tasks[slots[i]]);
+    }
+    if (next.empty()) {
+        json += "],\"next\":null}";
+    } else {
+        json += "],\"next\":\"";
+        appendJsonEscaped(json, next);
+        json += "\"}";
+    }
+    logger.debug(what).kv("user", username).kv("tasks", slots.size());
+    HttpResponse response = createBufferedResponse(std::move(json));
+    addVersionTag(response, version);
+    response.headers += "Cache-Control: no-cache\r\n";
+    return response;
+}
+
+// GET /overdue and GET /due_soon?days=N (default 7): the user's pending
+// tasks with a date before today, or from today through N - 1 days later
+// (UTC), soonest first. They are a range of the deadline index, so neither
+// looks at tasks outside it. Paging and the category and priority filters
+// work as in /schedule; a "user" parameter is ignored in favour of the
+// session token, like everywhere else.
+struct DeadlineRequest {
+    TaskQuery query;
+    const char* what = "";      // for the log
+};
+
+bool decodeDeadlineWindow(const RequestContext &ctx, DeadlineRequest &req, const char* &error, bool overdue) {
+    bool filtered = false;
+    if (!parseTaskQuery(ctx.request.query, req.query, filtered, error)) return false;
+    int32_t today = todayDeadlineCode();
+    int32_t first = 1;                  // 0000-01-01, so tasks without a deadline stay out
+    int32_t last = today - 1;
+    if (!overdue) {
+        std::string value = queryParam(ctx.request.query, "days", "7");
+        char* end = nullptr;
+        long days = strtol(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || days < 1 || days > 3660) {
+            error = "days must be between 1 and 3660";
+            return false;
+        }
+        first = today;
+        last = today + (int32_t)days - 1;
+    }
+    char buffer[10];
+    req.query.from = std::string(deadlineText(first, buffer));
+    req.query.to = std::string(deadlineText(last, buffer));
+    req.query.completed = false;
+    req.what = overdue ? "overdue" : "due soon";
+    return true;
+}
+
+bool decodeOverdue(const RequestContext &ctx, DeadlineRequest &req, const char* &error) {
+    return decodeDeadlineWindow(ctx, req, error, true);
+}
+
+bool decodeDueSoon(const RequestContext &ctx, DeadlineRequest &req, const char* &error) {
+    return decodeDeadlineWindow(ctx, req, error, false);
+}
+
+HttpResponse handleDeadlineQuery(RequestContext &ctx, DeadlineRequest &req) {
+    RcuReadGuard guard;
+    return queryResponse(taskStore.snapshot(ctx.user), req.query, ctx.user, req.what);
+}
+
+// GET /stats: counts of the user's tasks for the dashboard (see
+// TaskStats), read from counters every change keeps up to date instead of
+// from the tasks. The deadline buckets move when a UTC day begins, so the
+// ETag is the list version and the date.
+HttpResponse handleStats(RequestContext &ctx) {
+    static const TaskStats NO_TASKS;
+    RcuReadGuard guard;
+    uint64_t version = TaskList::initialVersion();
+    const TaskStats* stats = taskStore.stats(ctx.user, version);
+    int32_t today = todayDeadlineCode();
+    std::string etag = "\"" + std::to_string(version) + "-" + std::to_string(today) + "\"";
+    
+    HttpResponse response = createResponse("");
+    if (!ctx.request.ifNoneMatch.empty() && etagMatches(ctx.request.ifNoneMatch, etag)) {
+        response.status = 304;
+    } else {
+        response.sharedBody = (stats ? stats : &NO_TASKS)->json(version, today);
+    }
+    response.headers = takeResponseBuffer();
+    response.headers += "ETag: " + etag + "\r\n";
+    response.headers += "Cache-Control: no-cache\r\n";
+    return response;
+}
+
+// GET /schedule, whole, as a delta since a version, or filtered, sorted
+// and paged; the last cannot be combined with a delta.
+struct ScheduleRequest {
+    TaskQuery query;
+    bool filtered = false;
+    bool delta = false;                 // ?since= was given
+    unsigned long long since = 0;
+};
+
+bool decodeSchedule(const RequestContext &ctx, ScheduleRequest &req, const char* &error) {
+    if (!parseTaskQuery(ctx.request.query, req.query, req.filtered, error)) return false;
+    std::string since = queryParam(ctx.request.query, "since", "");
+    if (since.empty()) return true;
+    if (req.filtered) {
+        error = "since cannot be combined with filters";
+        return false;
+    }
+    char* end = nullptr;
+    req.since = strtoull(since.c_str(), &end, 10);
+    if (*end != '\0') {
+        error = "Invalid since version";
+        return false;
+    }
+    req.delta = true;
+    return true;
+}
+
+HttpResponse handleSchedule(RequestContext &ctx, ScheduleRequest &req) {
+    const HttpRequest &request = ctx.request;
+    const std::string &username = ctx.user;
+    
+    RcuReadGuard guard;
+    const TaskList* list = taskStore.snapshot(username);
+    uint64_t version = list ? list->version : TaskList::initialVersion();
+    char etag[24];
+    etag[0] = '"';
+    char* etagEnd = std::to_chars(etag + 1, etag + sizeof(etag) - 1, version).ptr;
+    *etagEnd++ = '"';
+    std::string_view etagView(etag, etagEnd - etag);
+    
+    // Incremental sync: the client sends the version it holds and gets
+    // the tasks changed since then, plus the ids deleted since then.
+    // If the change ring no longer reaches back that far, or the
+    // version is not one this server handed out, it gets everything.
+    if (req.delta) {
+        unsigned long long known = req.since;
+        if (known == version) {
+            HttpResponse notModified = createResponse("");
+            notModified.status = 304;
+            addVersionTag(notModified, version);
+            return notModified;
+        }
+        
+        thread_local std::vector<long long> changed;
+        changed.clear();
+        bool delta = list && known < version && list->changes.changedSince(known, changed);
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+        
+        std::string json = takeResponseBuffer();
+        json += "{\"version\":";
+        appendInteger(json, (long long)version);
+        json += delta ? ",\"full\":false," : ",\"full\":true,";
+        size_t count = appendChanges(json, list, delta ? &changed : nullptr);
+        json += '}';
+        logger.debug("schedule delta").kv("user", username).kv("tasks", count).kv("full", delta ? "false" : "true");
+        return createBufferedResponse(std::move(json));
+    }
+    
+    if (!request.ifNoneMatch.empty() && etagMatches(request.ifNoneMatch, etagView)) {
+        HttpResponse notModified = createResponse("");
+        notModified.status = 304;
+        addVersionTag(notModified, version);
+        return notModified;
+    }
+    
+    if (req.filtered) {
+        return queryResponse(list, req.query, username, "schedule query");
+    }
+    
+    // The body is rendered once per version and shared by every
+    // response for it; the event loop gathers it behind the headers.
+    static const std::shared_ptr<const std::string> EMPTY_LIST = std::make_shared<const std::string>("[]");
+    logger.debug("schedule").kv("user", username).kv("tasks", list ? list->tasks.size() : 0);
+    HttpResponse response = createResponse("");
+    response.sharedBody = list ? list->json() : EMPTY_LIST;
+    addVersionTag(response, version);
+    response.headers += "Cache-Control: no-cache\r\n";
+    return response;
+}
+
+// GET /events. EventSource cannot set headers, so the route takes the
+// token in the query string too. The stream is always the token's user.
+HttpResponse handleEvents(RequestContext &ctx) {
+    logger.debug("subscribe").kv("user", ctx.user);
+    HttpResponse response = createResponse("retry: 3000\n\n", "text/event-stream");
+    response.headers = "Cache-Control: no-cache\r\n";
+    response.stream = ctx.user;
+    return response;
+}
+
+HttpResponse handleAddTask(RequestContext &ctx, NewTaskRequest &req) {
+    if (!taskStore.add(req.task)) {
+        return createErrorResponse("Task ID already exists", 409);
+    }
+    return afterCommit(ctx.user, createResponse("{\"message\":\"Task added successfully\"}"));
+}
+
+HttpResponse handleToggle(RequestContext &ctx, TaskIdRequest &req) {
+    if (!taskStore.toggle(ctx.user, req.id)) {
+        return createErrorResponse("Task not found", 404);
+    }
+    return afterCommit(ctx.user, createResponse("{\"message\":\"Updated\"}"));
+}
+
+HttpResponse handleDelete(RequestContext &ctx, TaskIdRequest &req) {
+    if (!taskStore.remove(ctx.user, req.id)) {
+        return createErrorResponse("Task not found", 404);
+    }
+    return afterCommit(ctx.user, createResponse("{\"message\":\"Deleted\"}"));
+}
+
+HttpResponse handleRegister(RequestContext &, Credentials &req) {
+    {
+        std::lock_guard<std::mutex> lock(usersLock);
+        if (users.count(req.username)) {
+            return createErrorResponse("Username already exists", 409);
+        }
+    }
+    
+    // Hashing happens on the hash pool; the name is checked again when
+    // the result goes in, since another registration may have won.
+    HttpResponse response;
+    response.deferred = [username = std::move(req.username), password = std::move(req.password)]() {
+        std::string hash = hashPassword(password, config.scrypt);
+        {
+            std::lock_guard<std::mutex> lock(usersLock);
+            if (!users.emplace(username, hash).second) {
+                return createErrorResponse("Username already exists", 409);
+            }
+            usersLog->append(userRecord(username, hash));
+        }
+        if (!usersLog->commit()) return createErrorResponse("Could not save the change", 500);
+        return createResponse("{\"message\":\"User registered successfully\"}");
+    };
+    return response;
+}
+
+// {"message": ..., "username": ..., "token": ..., "expiresAt": unix seconds}.
+// Plaintext or weaker hashes are replaced once the password is known to
+// match, unless the password changed in the meantime.
+HttpResponse handleLogin(RequestContext &, Credentials &req) {
+    std::string stored;
+    bool known;
+    {
+        std::lock_guard<std::mutex> lock(usersLock);
+        auto it = users.find(req.username);
+        known = it != users.end();
+        stored = known ? it->second : dummyPasswordHash;
+    }
+    
+    HttpResponse response;
+    response.deferred = [username = std::move(req.username), password = std::move(req.password), stored, known]() {
+        PasswordCheck check = verifyPassword(password, stored, config.scrypt);
+        if (!known || check == PasswordCheck::Mismatch) {
+            logger.info("login rejected").kv("user", username);
+            return createErrorResponse("Invalid username or password");
+        }
+        if (check == PasswordCheck::MatchNeedsRehash) {
+            std::string upgraded = hashPassword(password, config.scrypt);
+            bool replaced = false;
+            {
+                std::lock_guard<std::mutex> lock(usersLock);
+                auto it = users.find(username);
+                if (it != users.end() && it->second == stored) {
+                    it->second = upgraded;
+                    usersLog->append(userRecord(username, upgraded));
+                    replaced = true;
+                }
+            }
+            if (replaced) usersLog->commit();
+        }
+        
+        int64_t now = (int64_t)std::time(nullptr);
+        std::string json = takeResponseBuffer();
+        json += "{\"message\":\"Login successful\",\"username\":\"";
+        appendJsonEscaped(json, username);
+        json += "\",\"token\":\"";
+        json += sessions.issue(username, now);
+        json += "\",\"expiresAt\":";
+        appendInteger(json, (long long)(now + sessions.lifetimeSeconds()));
+        json += "}";
+        logger.info("login").kv("user", username);
+        return createBufferedResponse(std::move(json));
+    };
+    return response;
+}
+
+HttpResponse serveAsset(RequestContext &ctx) {
+    std::string_view path = ctx.request.path;
+    return assets.serve(path == "/" ? std::string("index.html") : std::string(path.substr(1)), ctx.request);
+}
+
+HttpResponse serveMetrics(RequestContext &) {
+    return handleMetrics();
+}
+
+// Unknown paths get 404, and known ones asked with another method 405.
+HttpResponse rejectUnmatched(RequestContext &, const char* allow) {
+    if (!allow) return createErrorResponse("Not found", 404);
+    HttpResponse response = createErrorResponse("Method not allowed", 405);
+    response.headers += "Allow: ";
+    response.headers += allow;
+    response.headers += "\r\n";
+    return response;
+}
+
+Router<RequestContext> router(rejectUnmatched);
+
+// Records a finished request in /metrics and, for sampled requests, the
+// access log.
+void recordRequest(Route route, std::string_view method, std::string_view path, uint64_t start,
+                   size_t bytesIn, const HttpResponse &response) {
+    uint64_t micros = monotonicMicros() - start;
+    size_t bytesOut = response.sharedBody ? response.sharedBody->size() : response.body.size();
+    routeMetrics.record((size_t)route, response.status, micros, bytesIn, bytesOut);
+    logger.sample(LogLevel::Info, "request").kv("method", method).kv("path", path).kv("status", response.status)
+          .kv("us", micros).kv("in", bytesIn).kv("out", bytesOut);
+}
+
+// Outermost middleware: times every request and records it. Deferred work
+// is timed when it finishes, on the thread that ran it.
+HttpResponse recordMetrics(RequestContext &ctx, Router<RequestContext>::Chain &chain) {
+    const HttpRequest &request = ctx.request;
+    uint64_t start = monotonicMicros();
+    Route route = chain.route() ? (Route)chain.route()->label
+                : request.method == "OPTIONS" ? Route::Preflight : Route::Other;
+    HttpResponse response = chain(ctx);
+    if (response.deferred) {
+        response.deferred = [work = std::move(response.deferred), route, start, bytesIn = request.wireBytes,
+                             method = std::string(request.method), path = std::string(request.path)]() {
+            HttpResponse finished = work();
+            recordRequest(route, method, path, start, bytesIn, finished);
+            return finished;
+        };
+        return response;
+    }
+    recordRequest(route, request.method, request.path, start, request.wireBytes, response);
+    return response;
+}
+
+// Browsers send an OPTIONS preflight before cross-origin requests that
+// carry a token or a JSON body. It is answered for any path with the CORS
+// headers every response carries.
+HttpResponse answerPreflight(RequestContext &ctx, Router<RequestContext>::Chain &chain) {
+    if (ctx.request.method == "OPTIONS") return createResponse("");
+    return chain(ctx);
+}
+
+// 503 for shedding and 429 for rate limits, with when to come back.
+HttpResponse createRetryResponse(const char* error, int status, unsigned retryAfterSeconds) {
+    HttpResponse response = createErrorResponse(error, status);
+    response.headers += "Retry-After: ";
+    appendInteger(response.headers, (long long)retryAfterSeconds);
+    response.headers += "\r\n";
+    return response;
+}
+
+void reject(Rejection reason) {
+    rejections[(int)reason].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Turns a request away before any work is done for it when it has queued
+// too long (see QueueShedder; expensive routes are shed first) or its
+// client address is over its rate.
+HttpResponse admitRequest(RequestContext &ctx, Router<RequestContext>::Chain &chain) {
+    thread_local QueueShedder shedder((uint64_t)config.queueTargetMs * 1000, (uint64_t)config.queueIntervalMs * 1000);
+    const Router<RequestContext>::Route* route = chain.route();
+    bool cheap = !route || !(route->flags & EXPENSIVE);
+    uint64_t now = monotonicMicros();
+    bool wasOverloaded = shedder.overloaded();
+    bool admitted = shedder.admit(ctx.request.queuedMicros, now, cheap);
+    if (shedder.overloaded() != wasOverloaded) {
+        overloadedLoops.fetch_add(wasOverloaded ? -1 : 1, std::memory_order_relaxed);
+        logger.warn(wasOverloaded ? "queue recovered" : "queue standing").kv("queued_us", ctx.request.queuedMicros);
+    }
+    if (!admitted) {
+        reject(cheap ? Rejection::QueuedRead : Rejection::QueuedWrite);
+        return createRetryResponse("Server busy", 503, 1);
+    }
+    if (ipLimiter.enabled()) {
+        if (unsigned wait = ipLimiter.take(ctx.request.peer, now)) {
+            reject(Rejection::ClientRate);
+            return createRetryResponse("Too many requests", 429, wait);
+        }
+    }
+    return chain(ctx);
+}
+
+// Routes flagged NEEDS_SESSION act for the user the session token names;
+// a username in the body or query is ignored.
+HttpResponse requireSession(RequestContext &ctx, Router<RequestContext>::Chain &chain) {
+    const Router<RequestContext>::Route* route = chain.route();
+    if (!route || !(route->flags & NEEDS_SESSION)) return chain(ctx);
+    ctx.user = authenticatedUser(ctx.request);
+    std::string token;
+    if (ctx.user.empty() && (route->flags & TOKEN_IN_QUERY) && findQueryParam(ctx.request.query, "token", token)) {
+        ctx.user = tokenUser(token);
+    }
+    if (ctx.user.empty()) return createUnauthorizedResponse();
+    return chain(ctx);
+}
+
+// Session users over their rate get 429; runs once requireSession has
+// named the user.
+HttpResponse limitUser(RequestContext &ctx, Router<RequestContext>::Chain &chain) {
+    if (ctx.user.empty() || !userLimiter.enabled()) return chain(ctx);
+    if (unsigned wait = userLimiter.take(ctx.user, monotonicMicros())) {
+        reject(Rejection::UserRate);
+        return createRetryResponse("Too many requests", 429, wait);
+    }
+    return chain(ctx);
+}
+
+void buildRouter() {
+    for (const char* path : {"/", "/index.html", "/login.html", "/signup.html", "/style.css", "/script.js"}) {
+        router.add(HttpMethod::Get, path, serveAsset, (size_t)Route::Static);
+    }
+    router.add(HttpMethod::Get, "/metrics", serveMetrics, (size_t)Route::Metrics);
+    router.add(HttpMethod::Get, "/events", handleEvents, (size_t)Route::Events, NEEDS_SESSION | TOKEN_IN_QUERY);
+    router.add(HttpMethod::Get, "/schedule", typed<ScheduleRequest, decodeSchedule, handleSchedule>,
+               (size_t)Route::Schedule, NEEDS_SESSION);
+    router.add(HttpMethod::Get, "/overdue", typed<DeadlineRequest, decodeOverdue, handleDeadlineQuery>,
+               (size_t)Route::Overdue, NEEDS_SESSION);
+    router.add(HttpMethod::Get, "/due_soon", typed<DeadlineRequest, decodeDueSoon, handleDeadlineQuery>,
+               (size_t)Route::DueSoon, NEEDS_SESSION);
+    router.add(HttpMethod::Get, "/stats", handleStats, (size_t)Route::Stats, NEEDS_SESSION);
+    router.add(HttpMethod::Post, "/add_task", typed<NewTaskRequest, decodeNewTask, handleAddTask>,
+               (size_t)Route::AddTask, NEEDS_SESSION | EXPENSIVE);
+    router.add(HttpMethod::Post, "/toggle_complete", typed<TaskIdRequest, decodeTaskId, handleToggle>,
+               (size_t)Route::ToggleComplete, NEEDS_SESSION | EXPENSIVE);
+    router.add(HttpMethod::Post, "/delete_task", typed<TaskIdRequest, decodeTaskId, handleDelete>,
+               (size_t)Route::DeleteTask, NEEDS_SESSION | EXPENSIVE);
+    router.add(HttpMethod::Post, "/batch", typed<BatchRequest, decodeBatch, handleBatch>,
+               (size_t)Route::Batch, NEEDS_SESSION | EXPENSIVE);
+    router.add(HttpMethod::Post, "/register", typed<Credentials, decodeRegistration, handleRegister>,
+               (size_t)Route::Register, EXPENSIVE);
+    router.add(HttpMethod::Post, "/login", typed<Credentials, decodeCredentials, handleLogin>,
+               (size_t)Route::Login, EXPENSIVE);
+    
+    router.use(recordMetrics);
+    router.use(answerPreflight);
+    router.use(admitRequest);
+    router.use(requireSession);
+    router.use(limitUser);
+    router.freeze();
+}
+
+// The handler the event loops run.
+HttpResponse serveRequest(const HttpRequest &request) {
+    RequestContext ctx{request, std::string()};
+    return router.dispatch(ctx, request.method, request.path);
+}
+
+bool parseArgs(int argc, char* argv[], ServerConfig &cfg) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) return false;
+        std::string value = argv[++i];
+        if (arg == "--port") cfg.port = std::atoi(value.c_str());
+        else if (arg == "--backlog") cfg.backlog = std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--max-connections") cfg.limits.maxConnections = (size_t)std::atoll(value.c_str());
+        else if (arg == "--queue-target-ms") cfg.queueTargetMs = std::max(0, std::atoi(value.c_str()));
+        else if (arg == "--queue-interval-ms") cfg.queueIntervalMs = std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--user-rate") cfg.userRate = std::atof(value.c_str());
+        else if (arg == "--user-burst") cfg.userBurst = std::atof(value.c_str());
+        else if (arg == "--ip-rate") cfg.ipRate = std::atof(value.c_str());
+        else if (arg == "--ip-burst") cfg.ipBurst = std::atof(value.c_str());
+        else if (arg == "--threads") cfg.threads = (unsigned)std::atoi(value.c_str());
+        else if (arg == "--sync") {
+            if (!parseSyncPolicy(value, cfg.syncPolicy)) return false;
+        }
+        else if (arg == "--sync-interval-ms") cfg.syncIntervalMs = std::atoi(value.c_str());
+        else if (arg == "--compact-bytes") cfg.compactBytes = (size_t)std::atoll(value.c_str());
+        else if (arg == "--store-shards") {
+            cfg.storeShards = (size_t)std::atoi(value.c_str());
+            if (cfg.storeShards == 0 || cfg.storeShards > TaskStore::SHARDS ||
+                (cfg.storeShards & (cfg.storeShards - 1)) != 0) return false;
+        }
+        else if (arg == "--max-header-bytes") cfg.limits.maxHeaderBytes = (size_t)std::atoll(value.c_str());
+        else if (arg == "--max-body-bytes") cfg.limits.maxBodyBytes = (size_t)std::atoll(value.c_str());
+        else if (arg == "--idle-timeout-ms") cfg.limits.idleTimeoutMs = std::atoi(value.c_str());
+        else if (arg == "--header-timeout-ms") cfg.limits.headerTimeoutMs = std::atoi(value.c_str());
+        else if (arg == "--body-timeout-ms") cfg.limits.bodyTimeoutMs = std::atoi(value.c_str());
+        else if (arg == "--log-level") {
+            if (!parseLogLevel(value, cfg.logLevel)) return false;
+        }
+        else if (arg == "--log-sample") cfg.logSampleEvery = (uint32_t)std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--hash-threads") cfg.hashThreads = (unsigned)std::atoi(value.c_str());
+        else if (arg == "--scrypt-log-n") {
+            cfg.scrypt.logN = std::atoi(value.c_str());
+            if (cfg.scrypt.logN < 10 || cfg.scrypt.logN > 20) return false;
+        }
+        else return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (!parseArgs(argc, argv, config)) {
+        std::cerr << "Usage: server [--port N] [--threads N] [--sync always|interval|none]\n"
+                  << "              [--sync-interval-ms N] [--compact-bytes N] [--store-shards N]\n"
+                  << "              [--max-header-bytes N] [--max-body-bytes N]\n"
+                  << "              [--idle-timeout-ms N] [--header-timeout-ms N] [--body-timeout-ms N]\n"
+                  << "              [--backlog N] [--max-connections N] [--queue-target-ms N] [--queue-interval-ms N]\n"
+                  << "              [--user-rate R] [--user-burst N] [--ip-rate R] [--ip-burst N]\n"
+                  << "              [--hash-threads N] [--scrypt-log-n N]\n"
+                  << "              [--log-level debug|info|warn|error|off] [--log-sample N]\n";
+        return 1;
+    }
+    
+    if (!initNetworking()) {
+        std::cerr << "Network initialization failed\n";
+        return 1;
+    }
+    
+    unsigned threadCount = config.threads ? config.threads : std::thread::hardware_concurrency();
+    if (threadCount == 0) threadCount = 1;
+    
+    // On Linux every loop gets its own SO_REUSEPORT listener and the kernel
+    // spreads connections across them. Elsewhere the loops share one
+    // listener and whichever wakes first accepts.
+    std::vector<socket_t> listeners;
+    for (unsigned i = 0; i < threadCount; i++) {
+#ifdef __linux__
+        socket_t listener = createListenSocket(config.port, config.backlog, true);
+#else
+        socket_t listener = i == 0 ? createListenSocket(config.port, config.backlog) : listeners[0];
+#endif
+        if (listener == INVALID_SOCKET_HANDLE) {
+            std::cerr << "Failed to listen on port " << config.port << "\n";
+            shutdownNetworking();
+            return 1;
+        }
+        listeners.push_back(listener);
+    }
+    
+    for (size_t partition = 0; partition < config.storeShards; partition++) {
+        std::string base = taskFileBase(partition, config.storeShards) + ".wal";
+        tasksLogs.emplace_back(new WriteAheadLog(base, config.syncPolicy, config.syncIntervalMs));
+    }
+    usersLog.reset(new WriteAheadLog("users.wal", config.syncPolicy, config.syncIntervalMs));
+    
+    if (!loadTasks()) {
+        return 1;
+    }
+    {
+        std::lock_guard<std::mutex> lock(usersLock);
+        loadUsers();
+        replayUsersLog();
+        std::cout << " Loaded " << taskStore.size() << " tasks and " << users.size() << " users\n";
+    }
+    
+    std::string sessionKey;
+    if (!loadSessionKey(sessionKey)) {
+        std::cerr << "Failed to write session.key\n";
+        return 1;
+    }
+    sessions = SessionTokens(sessionKey);
+    dummyPasswordHash = hashPassword(randomBytes(16), config.scrypt);
+    
+    // Each queued hash holds a login for tens of milliseconds, so the queue
+    // is kept short: past it, /login answers 503 rather than piling up.
+    unsigned hashThreads = config.hashThreads ? config.hashThreads : std::max(1u, threadCount / 2);
+    hashPool.reset(new WorkerPool(hashThreads, 32 * hashThreads));
+    // A connection waits for at most one commit, so the open connections
+    // bound this queue and a change that is already applied is never
+    // refused with 503.
+    commitPool.reset(new WorkerPool(threadCount, SIZE_MAX));
+    
+    bool opened = usersLog->open();
+    for (std::unique_ptr<WriteAheadLog> &log : tasksLogs) opened = log->open() && opened;
+    if (!opened) {
+        std::cerr << "Failed to open write-ahead logs\n";
+        return 1;
+    }
+    taskStore.setJournal(&taskJournal);
+    std::thread(compactionLoop).detach();
+    
+    runParallel(TaskStore::SHARDS, [](size_t shard) { taskStore.rebuildStats(shard); });
+    taskStore.forEachDeadline([](uint32_t user, int64_t id, int32_t deadline, bool completed) {
+        deadlineTimers.update(user, id, deadline, completed);
+    });
+    std::thread(deadlineLoop).detach();
+    
+    for (const char* file : {"index.html", "login.html", "signup.html", "style.css", "script.js"}) {
+        assets.add(file);
+    }
+    assets.watch();
+    userLimiter.configure(config.userRate, config.userBurst > 0 ? config.userBurst : 2 * config.userRate);
+    ipLimiter.configure(config.ipRate, config.ipBurst > 0 ? config.ipBurst : 2 * config.ipRate);
+    buildRouter();
+    
+    std::cout << " Server running on http://127.0.0.1:" << config.port << " with " << threadCount << " worker threads" << std::endl;
+    
+    logger.setLevel(config.logLevel);
+    logger.setSampleEvery(config.logSampleEvery);
+    logger.start(stdout);
+    
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threadCount; i++) {
+        socket_t listener = listeners[i];
+        workers.emplace_back([listener]() {
+            EventLoop loop(listener, serveRequest, config.limits, hashPool.get(), &eventHub);
+            if (!loop.run()) {
+                std::cerr << "Event loop failed\n";
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    
+    shutdownNetworking();
+    return 1;
+}
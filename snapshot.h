@@ -0,0 +1,401 @@
+#pragma once
+
+#include "platform.h"
+#include "task.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Binary snapshot of the task store, designed to be mapped and used in
+// place. All integers are little-endian.
+//
+//   SnapshotHeader
+//   SnapshotUser[userCount]
+//   SnapshotTask[taskCount]          grouped by user, in list order
+//   TaskIdIndex::Entry[indexCount]   one prebuilt id table per user
+//   string heap                      uint32 length + bytes
+//
+// The checksum covers the whole file, with the header's checksum field read
+// as zero. Version 1 files, whose checksum covers only what follows the
+// header, are still read; the next compaction rewrites them.
+
+const char SNAPSHOT_MAGIC[8] = {'T', 'B', 'S', 'N', 'A', 'P', '\r', '\n'};
+const uint32_t SNAPSHOT_VERSION = 2;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t userCount;
+    uint64_t taskCount;
+    uint64_t indexCount;
+    uint64_t heapSize;
+    uint64_t usersOffset;
+    uint64_t tasksOffset;
+    uint64_t indexOffset;
+    uint64_t heapOffset;
+    uint64_t fileSize;
+    uint64_t checksum;
+};
+
+struct SnapshotUser {
+    uint32_t name;              // heap offset
+    uint32_t indexCapacity;     // entries in this user's id table
+    uint64_t firstTask;
+    uint64_t taskCount;
+    uint64_t firstIndexEntry;
+};
+
+struct SnapshotTask {
+    int64_t id;
+    uint32_t name;              // heap offsets
+    uint32_t category;
+    uint32_t priority;
+    uint32_t deadline;
+    uint32_t user;              // index into the user table
+    uint8_t completed;
+    uint8_t unused[3];
+};
+
+static_assert(sizeof(SnapshotUser) == 32, "snapshot layout");
+static_assert(sizeof(SnapshotTask) == 32, "snapshot layout");
+static_assert(sizeof(TaskIdIndex::Entry) == 16, "snapshot layout");
+
+// Four independent multiply-rotate lanes so verification runs close to
+// memory bandwidth instead of being bound by one dependency chain.
+inline uint64_t snapshotChecksum(const char* data, size_t len) {
+    const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+    uint64_t lanes[4] = {PRIME1, PRIME2, PRIME1 ^ PRIME2, ~PRIME1};
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        for (int l = 0; l < 4; l++) {
+            uint64_t w;
+            memcpy(&w, data + i + l * 8, 8);
+            lanes[l] = (lanes[l] ^ w) * PRIME1;
+            lanes[l] = (lanes[l] << 31) | (lanes[l] >> 33);
+        }
+    }
+    uint64_t h = len * PRIME2;
+    for (int l = 0; l < 4; l++) {
+        h = (h ^ lanes[l]) * PRIME2;
+        h ^= h >> 29;
+    }
+    for (; i < len; i++) {
+        h = (h ^ (unsigned char)data[i]) * PRIME1;
+    }
+    return h ^ (h >> 32);
+}
+
+// The checksum stored in a snapshot of `version` (see above) that starts
+// at `data` and is `len` bytes long, at least a header.
+inline uint64_t snapshotFileChecksum(const char* data, size_t len, uint32_t version) {
+    uint64_t body = snapshotChecksum(data + sizeof(SnapshotHeader), len - sizeof(SnapshotHeader));
+    if (version == 1) return body;
+    SnapshotHeader h;
+    memcpy(&h, data, sizeof(h));
+    h.checksum = 0;
+    return (snapshotChecksum((const char*)&h, sizeof(h)) * 0x9E3779B185EBCA87ULL) ^ body;
+}
+
+// A mapped, verified snapshot. Every accessor reads straight from the
+// mapping; nothing is copied until a caller asks for a Task.
+class TaskSnapshot {
+public:
+    // Returns nullptr if the file is missing, truncated, of another version,
+    // fails its checksum or refers outside itself; `error` says which. Every
+    // offset and count the accessors use is checked here, so a damaged file
+    // is rejected rather than read out of bounds.
+    static std::shared_ptr<const TaskSnapshot> open(const std::string &path, std::string &error) {
+        std::shared_ptr<TaskSnapshot> snap(new TaskSnapshot());
+        if (!snap->file.map(path.c_str())) {
+            error = "cannot map " + path;
+            return nullptr;
+        }
+        const char* base = snap->file.bytes();
+        size_t size = snap->file.length();
+        if (size < sizeof(SnapshotHeader)) {
+            error = "truncated header";
+            return nullptr;
+        }
+
+        const SnapshotHeader* h = (const SnapshotHeader*)base;
+        if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+            error = "not a task snapshot";
+            return nullptr;
+        }
+        if (h->version < 1 || h->version > SNAPSHOT_VERSION || h->headerSize != sizeof(SnapshotHeader)) {
+            error = "unsupported snapshot version " + std::to_string(h->version);
+            return nullptr;
+        }
+        if (h->fileSize != size ||
+            !fits(h->usersOffset, h->userCount, sizeof(SnapshotUser), size) ||
+            !fits(h->tasksOffset, h->taskCount, sizeof(SnapshotTask), size) ||
+            !fits(h->indexOffset, h->indexCount, sizeof(TaskIdIndex::Entry), size) ||
+            !fits(h->heapOffset, h->heapSize, 1, size)) {
+            error = "truncated snapshot";
+            return nullptr;
+        }
+        if (h->usersOffset % 8 != 0 || h->tasksOffset % 8 != 0 || h->indexOffset % 8 != 0) {
+            error = "misaligned snapshot";
+            return nullptr;
+        }
+        if (snapshotFileChecksum(base, size, h->version) != h->checksum) {
+            error = "checksum mismatch";
+            return nullptr;
+        }
+
+        snap->header = h;
+        snap->users = (const SnapshotUser*)(base + h->usersOffset);
+        snap->tasks = (const SnapshotTask*)(base + h->tasksOffset);
+        snap->index = (const TaskIdIndex::Entry*)(base + h->indexOffset);
+        snap->heap = base + h->heapOffset;
+        if (!snap->validate(error)) return nullptr;
+        return snap;
+    }
+
+    size_t userCount() const { return header->userCount; }
+    size_t taskCount() const { return header->taskCount; }
+    const SnapshotUser &user(size_t i) const { return users[i]; }
+
+    std::string_view string(uint32_t offset) const {
+        uint32_t len;
+        memcpy(&len, heap + offset, sizeof(len));
+        return std::string_view(heap + offset + sizeof(len), len);
+    }
+
+    std::string_view username(const SnapshotUser &u) const {
+        return string(u.name);
+    }
+
+    const SnapshotTask* tasksOf(const SnapshotUser &u) const {
+        return tasks + u.firstTask;
+    }
+
+    const TaskIdIndex::Entry* indexOf(const SnapshotUser &u) const {
+        return index + u.firstIndexEntry;
+    }
+
+    Task task(const SnapshotTask &r) const {
+        Task t;
+        t.id = r.id;
+        t.name = std::string(string(r.name));
+        t.category = std::string(string(r.category));
+        t.priority = std::string(string(r.priority));
+        t.deadline = std::string(string(r.deadline));
+        t.completed = r.completed != 0;
+        t.username = std::string(username(users[r.user]));
+        return t;
+    }
+
+private:
+    TaskSnapshot() {}
+
+    // True if `count` elements of `elemSize` bytes at `offset` end within
+    // `size`, without overflowing on the way.
+    static bool fits(uint64_t offset, uint64_t count, uint64_t elemSize, uint64_t size) {
+        return offset >= sizeof(SnapshotHeader) && offset <= size && count <= (size - offset) / elemSize;
+    }
+
+    bool validString(uint32_t offset) const {
+        uint64_t heapSize = header->heapSize;
+        if (offset > heapSize || heapSize - offset < sizeof(uint32_t)) return false;
+        uint32_t len;
+        memcpy(&len, heap + offset, sizeof(len));
+        return len <= heapSize - offset - sizeof(uint32_t);
+    }
+
+    // Checks the records against the tables and heap they point into: each
+    // user's tasks and id table, which must be a power of two with room to
+    // spare and slots within the user's tasks, and every string.
+    bool validate(std::string &error) const {
+        for (size_t i = 0; i < header->userCount; i++) {
+            const SnapshotUser &u = users[i];
+            if (!validString(u.name)) {
+                error = "bad name of user " + std::to_string(i);
+                return false;
+            }
+            if (u.firstTask > header->taskCount || u.taskCount > header->taskCount - u.firstTask) {
+                error = "bad task range of user " + std::to_string(i);
+                return false;
+            }
+            if (u.taskCount == 0) continue;
+            uint64_t capacity = u.indexCapacity;
+            if (capacity <= u.taskCount || (capacity & (capacity - 1)) != 0 ||
+                u.firstIndexEntry > header->indexCount || capacity > header->indexCount - u.firstIndexEntry) {
+                error = "bad id table of user " + std::to_string(i);
+                return false;
+            }
+            uint64_t used = 0;
+            bool inRange = true;
+            for (const TaskIdIndex::Entry* e = index + u.firstIndexEntry; e != index + u.firstIndexEntry + capacity; e++) {
+                if (e->slot == TaskIdIndex::NONE) continue;
+                inRange = inRange && e->slot < u.taskCount;
+                used++;
+            }
+            if (!inRange || used != u.taskCount) {
+                error = "bad id table of user " + std::to_string(i);
+                return false;
+            }
+        }
+        for (size_t i = 0; i < header->taskCount; i++) {
+            const SnapshotTask &r = tasks[i];
+            if (r.user >= header->userCount || !validString(r.name) || !validString(r.category) ||
+                !validString(r.priority) || !validString(r.deadline)) {
+                error = "bad task record " + std::to_string(i);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    MappedFile file;
+    const SnapshotHeader* header = nullptr;
+    const SnapshotUser* users = nullptr;
+    const SnapshotTask* tasks = nullptr;
+    const TaskIdIndex::Entry* index = nullptr;
+    const char* heap = nullptr;
+};
+
+// Builds a snapshot in memory. Each user is followed by all of its tasks.
+class SnapshotBuilder {
+public:
+    void beginUser(const std::string &username) {
+        finishUser();
+        if (users.size() == UINT32_MAX) overflowed = true;
+        SnapshotUser u;
+        u.name = intern(username);
+        u.indexCapacity = 0;
+        u.firstTask = tasks.size();
+        u.taskCount = 0;
+        u.firstIndexEntry = 0;
+        users.push_back(u);
+        userIndex = TaskIdIndex();
+    }
+
+    void addTask(const Task &t) {
+        SnapshotTask r;
+        memset(&r, 0, sizeof(r));
+        r.id = t.id;
+        r.name = appendString(t.name);
+        r.category = intern(t.category);
+        r.priority = intern(t.priority);
+        r.deadline = intern(t.deadline);
+        r.user = (uint32_t)(users.size() - 1);
+        r.completed = t.completed ? 1 : 0;
+        userIndex.set(t.id, (uint32_t)users.back().taskCount);
+        users.back().taskCount++;
+        tasks.push_back(r);
+    }
+
+    // The same for a stored record, without converting it to strings first.
+    void addTask(const StoredTask &t) {
+        SnapshotTask r;
+        memset(&r, 0, sizeof(r));
+        r.id = t.id;
+        r.name = appendString(t.name());
+        r.category = internId(t.category);
+        r.priority = internId(t.priority);
+        auto it = deadlines.find(t.deadline);
+        if (it == deadlines.end()) {
+            char buffer[10];
+            it = deadlines.emplace(t.deadline, intern(deadlineText(t.deadline, buffer))).first;
+        }
+        r.deadline = it->second;
+        r.user = (uint32_t)(users.size() - 1);
+        r.completed = t.completed ? 1 : 0;
+        userIndex.set(t.id, (uint32_t)users.back().taskCount);
+        users.back().taskCount++;
+        tasks.push_back(r);
+    }
+
+    // Fills `out` with the snapshot. False if the strings outgrew the
+    // 4 GiB that heap offsets reach, or there are more users than user
+    // indexes reach; such a snapshot cannot be written, and the data it was
+    // to replace must be kept.
+    bool finish(std::string &out) {
+        finishUser();
+        if (overflowed) return false;
+
+        SnapshotHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        h.version = SNAPSHOT_VERSION;
+        h.headerSize = sizeof(SnapshotHeader);
+        h.userCount = users.size();
+        h.taskCount = tasks.size();
+        h.indexCount = index.size();
+        h.heapSize = heap.size();
+        h.usersOffset = sizeof(SnapshotHeader);
+        h.tasksOffset = h.usersOffset + users.size() * sizeof(SnapshotUser);
+        h.indexOffset = h.tasksOffset + tasks.size() * sizeof(SnapshotTask);
+        h.heapOffset = h.indexOffset + index.size() * sizeof(TaskIdIndex::Entry);
+        h.fileSize = h.heapOffset + heap.size();
+
+        out.clear();
+        out.reserve(h.fileSize);
+        out.append((const char*)&h, sizeof(h));
+        out.append((const char*)users.data(), users.size() * sizeof(SnapshotUser));
+        out.append((const char*)tasks.data(), tasks.size() * sizeof(SnapshotTask));
+        out.append((const char*)index.data(), index.size() * sizeof(TaskIdIndex::Entry));
+        out.append(heap);
+
+        uint64_t checksum = snapshotFileChecksum(out.data(), out.size(), SNAPSHOT_VERSION);
+        memcpy(&out[offsetof(SnapshotHeader, checksum)], &checksum, sizeof(checksum));
+        return true;
+    }
+
+private:
+    void finishUser() {
+        if (users.empty() || users.back().indexCapacity != 0 || users.back().taskCount == 0) return;
+        users.back().firstIndexEntry = index.size();
+        users.back().indexCapacity = (uint32_t)userIndex.capacity();
+        index.insert(index.end(), userIndex.data(), userIndex.data() + userIndex.capacity());
+    }
+
+    uint32_t appendString(std::string_view s) {
+        if (s.size() > UINT32_MAX - sizeof(uint32_t) || heap.size() > UINT32_MAX - sizeof(uint32_t) - s.size()) {
+            overflowed = true;
+            return 0;
+        }
+        uint32_t offset = (uint32_t)heap.size();
+        uint32_t len = (uint32_t)s.size();
+        heap.append((const char*)&len, sizeof(len));
+        heap.append(s.data(), s.size());
+        return offset;
+    }
+
+    // Category, priority, deadline and username repeat across many tasks,
+    // so they are stored once.
+    uint32_t intern(std::string_view s) {
+        auto it = interned.find(std::string(s));
+        if (it != interned.end()) return it->second;
+        uint32_t offset = appendString(s);
+        interned.emplace(std::string(s), offset);
+        return offset;
+    }
+
+    uint32_t internId(uint32_t id) {
+        auto it = internedIds.find(id);
+        if (it != internedIds.end()) return it->second;
+        uint32_t offset = intern(StringInterner::instance().text(id));
+        internedIds.emplace(id, offset);
+        return offset;
+    }
+
+    std::vector<SnapshotUser> users;
+    std::vector<SnapshotTask> tasks;
+    std::vector<TaskIdIndex::Entry> index;
+    std::string heap;
+    std::unordered_map<std::string, uint32_t> interned;
+    std::unordered_map<uint32_t, uint32_t> internedIds;     // StringInterner id -> heap offset
+    std::unordered_map<int32_t, uint32_t> deadlines;        // deadline code -> heap offset
+    TaskIdIndex userIndex;
+    bool overflowed = false;    // see finish()
+};
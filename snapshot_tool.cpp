@@ -0,0 +1,117 @@
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "snapshot.h"
+#include "task_json.h"
+
+// Converts between the binary tasks.snap format and tasks.json.
+//
+//   snapshot_tool to-json   tasks.snap tasks.json
+//   snapshot_tool from-json tasks.json tasks.snap
+//   snapshot_tool verify    tasks.snap
+
+int toJson(const std::string &input, const std::string &output) {
+    std::string error;
+    std::shared_ptr<const TaskSnapshot> snap = TaskSnapshot::open(input, error);
+    if (!snap) {
+        std::cerr << input << ": " << error << "\n";
+        return 1;
+    }
+
+    std::vector<Task> tasks;
+    tasks.reserve(snap->taskCount());
+    for (size_t u = 0; u < snap->userCount(); u++) {
+        const SnapshotUser &user = snap->user(u);
+        const SnapshotTask* records = snap->tasksOf(user);
+        for (uint64_t i = 0; i < user.taskCount; i++) {
+            tasks.push_back(snap->task(records[i]));
+        }
+    }
+
+    std::ofstream file(output, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Cannot write " << output << "\n";
+        return 1;
+    }
+    writeTasksJson(file, tasks);
+    std::cout << "Wrote " << tasks.size() << " tasks to " << output << "\n";
+    return 0;
+}
+
+int fromJson(const std::string &input, const std::string &output) {
+    std::ifstream in(input, std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "Cannot read " << input << "\n";
+        return 1;
+    }
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::vector<Task> parsed;
+    std::string error;
+    if (!parseTasksJson(content, parsed, error)) {
+        std::cerr << "Cannot parse " << input << ": " << error << "\n";
+        return 1;
+    }
+
+    // Same rule as the server's loader: a repeated id replaces the earlier task.
+    std::map<std::string, std::vector<Task>> byUser;
+    std::map<std::string, TaskIdIndex> seen;
+    size_t count = 0;
+    for (Task &t : parsed) {
+        std::vector<Task> &list = byUser[t.username];
+        TaskIdIndex &index = seen[t.username];
+        uint32_t slot = index.find(t.id);
+        if (slot != TaskIdIndex::NONE) {
+            list[slot] = t;
+            continue;
+        }
+        index.set(t.id, (uint32_t)list.size());
+        list.push_back(t);
+        count++;
+    }
+
+    SnapshotBuilder builder;
+    for (const auto &entry : byUser) {
+        builder.beginUser(entry.first);
+        for (const Task &t : entry.second) builder.addTask(t);
+    }
+    std::string bytes;
+    if (!builder.finish(bytes)) {
+        std::cerr << "Too much data for one snapshot\n";
+        return 1;
+    }
+
+    std::ofstream file(output, std::ios::binary);
+    if (!file.is_open() || !file.write(bytes.data(), bytes.size())) {
+        std::cerr << "Cannot write " << output << "\n";
+        return 1;
+    }
+    std::cout << "Wrote " << count << " tasks for " << byUser.size() << " users to " << output << "\n";
+    return 0;
+}
+
+int verify(const std::string &input) {
+    std::string error;
+    std::shared_ptr<const TaskSnapshot> snap = TaskSnapshot::open(input, error);
+    if (!snap) {
+        std::cerr << input << ": " << error << "\n";
+        return 1;
+    }
+    std::cout << input << ": " << snap->taskCount() << " tasks, " << snap->userCount() << " users, checksum ok\n";
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::string command = argc > 1 ? argv[1] : "";
+    if (command == "to-json" && argc == 4) return toJson(argv[2], argv[3]);
+    if (command == "from-json" && argc == 4) return fromJson(argv[2], argv[3]);
+    if (command == "verify" && argc == 3) return verify(argv[2]);
+
+    std::cerr << "Usage: snapshot_tool to-json <tasks.snap> <tasks.json>\n"
+              << "       snapshot_tool from-json <tasks.json> <tasks.snap>\n"
+              << "       snapshot_tool verify <tasks.snap>\n";
+    return 1;
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include "interner.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A task as requests, tasks.json and the log carry it. The store keeps the
+// compact StoredTask instead and converts at the edges.
+struct Task {
+    long long id;
+    std::string name;
+    std::string category;
+    std::string priority;
+    std::string deadline;
+    bool completed;
+    std::string username;
+};
+
+// Deadlines are stored as a 32-bit code that sorts like the text: 0 for
+// none, 1 + days since 0000-01-01 for a valid YYYY-MM-DD date, and
+// -1 - interned id for any other text, which compares by text.
+namespace deadlineimpl {
+
+const int32_t DAY_OFFSET = 719529;    // makes 0000-01-01 code 1
+
+inline int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+inline void civilFromDays(int64_t z, int &year, unsigned &month, unsigned &day) {
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = (unsigned)(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    day = doy - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = (int)(yoe + era * 400) + (month <= 2);
+}
+
+} // namespace deadlineimpl
+
+// Codes a canonical YYYY-MM-DD date; anything else, including dates that
+// do not exist, returns false and is kept as text.
+inline bool parseDateDeadline(std::string_view text, int32_t &code) {
+    if (text.size() != 10 || text[4] != '-' || text[7] != '-') return false;
+    unsigned digits[8];
+    const int positions[8] = {0, 1, 2, 3, 5, 6, 8, 9};
+    for (int i = 0; i < 8; i++) {
+        char c = text[positions[i]];
+        if (c < '0' || c > '9') return false;
+        digits[i] = (unsigned)(c - '0');
+    }
+    unsigned year = digits[0] * 1000 + digits[1] * 100 + digits[2] * 10 + digits[3];
+    unsigned month = digits[4] * 10 + digits[5];
+    unsigned day = digits[6] * 10 + digits[7];
+    static const unsigned DAYS[12] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (month < 1 || month > 12 || day < 1 || day > DAYS[month - 1]) return false;
+    bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    if (month == 2 && day == 29 && !leap) return false;
+    code = (int32_t)(deadlineimpl::daysFromCivil(year, month, day) + deadlineimpl::DAY_OFFSET);
+    return true;
+}
+
+// Today's date in UTC, as a deadline code.
+inline int32_t todayDeadlineCode() {
+    int64_t seconds = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    int64_t days = seconds >= 0 ? seconds / 86400 : (seconds - 86399) / 86400;
+    return (int32_t)(days + deadlineimpl::DAY_OFFSET);
+}
+
+inline int32_t deadlineCode(std::string_view text) {
+    int32_t code;
+    if (text.empty()) return 0;
+    if (parseDateDeadline(text, code)) return code;
+    return -1 - (int32_t)StringInterner::instance().intern(text);
+}
+
+// The text of a code; dates are formatted into `buffer`.
+inline std::string_view deadlineText(int32_t code, char (&buffer)[10]) {
+    if (code == 0) return std::string_view();
+    if (code < 0) return StringInterner::instance().text((uint32_t)(-1 - code));
+    int year;
+    unsigned month, day;
+    deadlineimpl::civilFromDays((int64_t)code - deadlineimpl::DAY_OFFSET, year, month, day);
+    unsigned parts[3] = {(unsigned)year, month, day};
+    char* p = buffer;
+    for (unsigned v = parts[0], div = 1000; div > 0; div /= 10) *p++ = (char)('0' + v / div % 10);
+    for (int i = 1; i < 3; i++) {
+        *p++ = '-';
+        *p++ = (char)('0' + parts[i] / 10);
+        *p++ = (char)('0' + parts[i] % 10);
+    }
+    return std::string_view(buffer, sizeof(buffer));
+}
+
+inline int compareDeadlines(int32_t a, int32_t b) {
+    if (a >= 0 && b >= 0) return (a > b) - (a < b);
+    char bufferA[10], bufferB[10];
+    int c = deadlineText(a, bufferA).compare(deadlineText(b, bufferB));
+    return (c > 0) - (c < 0);
+}
+
+// A task as the store keeps it: 32 bytes of ids and codes, with the name
+// stored right behind it in the same block. Category, priority and the
+// username are interned ids (see interner.h) and the deadline is a code as
+// above. Records are immutable once published.
+struct StoredTask {
+    int64_t id;
+    uint32_t user;
+    uint32_t category;
+    uint32_t priority;
+    int32_t deadline;
+    uint32_t nameLength;
+    bool completed;
+
+    std::string_view name() const {
+        return std::string_view((const char*)(this + 1), nameLength);
+    }
+
+    static size_t sizeFor(size_t nameLength) {
+        return sizeof(StoredTask) + nameLength;
+    }
+
+    // Fields of `task`, interned. The name is not part of the result.
+    static StoredTask fieldsOf(const Task &task, uint32_t user) {
+        StringInterner &strings = StringInterner::instance();
+        StoredTask fields;
+        fields.id = task.id;
+        fields.user = user;
+        fields.category = strings.intern(task.category);
+        fields.priority = strings.intern(task.priority);
+        fields.deadline = deadlineCode(task.deadline);
+        fields.nameLength = 0;
+        fields.completed = task.completed;
+        return fields;
+    }
+
+    // Interns the strings of `task` that fieldsOf() does, for tasks that
+    // come from clients: false if one is new and the string table has no
+    // room left for it (see StringInterner::tryIntern). After this,
+    // fieldsOf() only looks them up.
+    static bool internFields(const Task &task) {
+        StringInterner &strings = StringInterner::instance();
+        uint32_t id;
+        int32_t code;
+        return strings.tryIntern(task.category, id) && strings.tryIntern(task.priority, id) &&
+               (task.deadline.empty() || parseDateDeadline(task.deadline, code) ||
+                strings.tryIntern(task.deadline, id));
+    }
+
+    // Copies `fields` and `name` into `block`, of at least sizeFor(name.size()).
+    static StoredTask* construct(void* block, const StoredTask &fields, std::string_view name) {
+        StoredTask* record = new (block) StoredTask(fields);
+        record->nameLength = (uint32_t)name.size();
+        memcpy(record + 1, name.data(), name.size());
+        return record;
+    }
+
+    Task toTask() const {
+        const StringInterner &strings = StringInterner::instance();
+        char buffer[10];
+        Task t;
+        t.id = id;
+        t.name = std::string(name());
+        t.category = std::string(strings.text(category));
+        t.priority = std::string(strings.text(priority));
+        t.deadline = std::string(deadlineText(deadline, buffer));
+        t.completed = completed;
+        t.username = std::string(strings.text(user));
+        return t;
+    }
+};
+
+static_assert(sizeof(StoredTask) == 32, "compact task layout");
+
+// Open-addressing map from task id to its position in a TaskList. Linear
+// probing with backward-shift deletion, so there are no tombstones and a
+// lookup touches one or two cache lines.
+class TaskIdIndex {
+public:
+    static const uint32_t NONE = UINT32_MAX;
+
+    uint32_t find(long long id) const {
+        if (entries.empty()) return NONE;
+        for (size_t i = bucket(id);; i = (i + 1) & mask()) {
+            const Entry &e = entries[i];
+            if (e.slot == NONE) return NONE;
+            if (e.id == id) return e.slot;
+        }
+    }
+
+    // Inserts or overwrites.
+    void set(long long id, uint32_t slot) {
+        if ((count + 1) * 2 > entries.size()) grow();
+        for (size_t i = bucket(id);; i = (i + 1) & mask()) {
+            Entry &e = entries[i];
+            if (e.slot == NONE) {
+                e.id = id;
+                e.slot = slot;
+                count++;
+                return;
+            }
+            if (e.id == id) {
+                e.slot = slot;
+                return;
+            }
+        }
+    }
+
+    void erase(long long id) {
+        if (entries.empty()) return;
+        size_t i = bucket(id);
+        while (true) {
+            if (entries[i].slot == NONE) return;
+            if (entries[i].id == id) break;
+            i = (i + 1) & mask();
+        }
+        // Pull later members of the probe chain back into the hole.
+        size_t hole = i;
+        for (size_t j = (hole + 1) & mask(); entries[j].slot != NONE; j = (j + 1) & mask()) {
+            size_t home = bucket(entries[j].id);
+            bool movable = (j > hole) ? (home <= hole || home > j) : (home <= hole && home > j);
+            if (movable) {
+                entries[hole] = entries[j];
+                hole = j;
+            }
+        }
+        entries[hole].slot = NONE;
+        count--;
+    }
+
+    size_t size() const { return count; }
+
+    // Fixed layout so a table can be stored in a snapshot and adopted
+    // again without rehashing.
+    struct Entry {
+        int64_t id;
+        uint32_t slot;
+        uint32_t unused;
+    };
+
+    const Entry* data() const { return entries.data(); }
+    size_t capacity() const { return entries.size(); }
+
+    void adopt(const Entry* table, size_t tableCapacity, size_t entryCount) {
+        entries.assign(table, table + tableCapacity);
+        count = entryCount;
+    }
+
+private:
+
+    size_t mask() const { return entries.size() - 1; }
+
+    size_t bucket(long long id) const {
+        uint64_t x = (uint64_t)id;
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        return (size_t)x & mask();
+    }
+
+    void grow() {
+        std::vector<Entry> old;
+        old.swap(entries);
+        entries.assign(old.empty() ? 16 : old.size() * 2, Entry{0, NONE, 0});
+        count = 0;
+        for (const Entry &e : old) {
+            if (e.slot != NONE) set(e.id, e.slot);
+        }
+    }
+
+    std::vector<Entry> entries;
+    size_t count = 0;
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "json.h"
+#include "task.h"
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The tasks.json format: a JSON array of task objects. It was the only
+// on-disk format before binary snapshots and is still used for import and
+// export.
+
+// Copies the task fields present in `obj` into `task`. Returns false if the
+// object has no integer id.
+inline bool readTaskFields(JsonValue obj, Task &task) {
+    if (!obj["id"].getInt64(task.id)) return false;
+    std::string scratch;
+    std::string_view s;
+    if (obj["name"].getString(s, scratch)) task.name.assign(s);
+    if (obj["category"].getString(s, scratch)) task.category.assign(s);
+    if (obj["priority"].getString(s, scratch)) task.priority.assign(s);
+    if (obj["deadline"].getString(s, scratch)) task.deadline.assign(s);
+    if (obj["username"].getString(s, scratch)) task.username.assign(s);
+    obj["completed"].getBool(task.completed);
+    return true;
+}
+
+// Tasks without a username belong to "default", as in the first releases.
+inline bool parseTasksJson(std::string_view content, std::vector<Task> &tasks, std::string &error) {
+    JsonDocument doc;
+    if (!doc.parse(content)) {
+        error = doc.error();
+        return false;
+    }
+    if (!doc.root().isArray()) {
+        error = "expected an array of tasks";
+        return false;
+    }
+    for (JsonValue item = doc.root().first(); item.valid(); item = item.next()) {
+        Task task;
+        task.completed = false;
+        task.username = "default";
+        if (!item.isObject() || !readTaskFields(item, task)) {
+            error = "task without an integer id";
+            return false;
+        }
+        tasks.push_back(std::move(task));
+    }
+    return true;
+}
+
+// The object form /schedule sends: every field except the username.
+inline void appendTaskJson(std::string &json, const Task &t) {
+    json += "{\"id\":";
+    appendInteger(json, t.id);
+    json += ",\"name\":\"";
+    appendJsonEscaped(json, t.name);
+    json += "\",\"category\":\"";
+    appendJsonEscaped(json, t.category);
+    json += "\",\"priority\":\"";
+    appendJsonEscaped(json, t.priority);
+    json += "\",\"deadline\":\"";
+    appendJsonEscaped(json, t.deadline);
+    json += t.completed ? "\",\"completed\":true}" : "\",\"completed\":false}";
+}
+
+// The same object rendered from a stored record.
+inline void appendTaskJson(std::string &json, const StoredTask &t) {
+    const StringInterner &strings = StringInterner::instance();
+    char buffer[10];
+    json += "{\"id\":";
+    appendInteger(json, t.id);
+    json += ",\"name\":\"";
+    appendJsonEscaped(json, t.name());
+    json += "\",\"category\":\"";
+    appendJsonEscaped(json, strings.text(t.category));
+    json += "\",\"priority\":\"";
+    appendJsonEscaped(json, strings.text(t.priority));
+    json += "\",\"deadline\":\"";
+    appendJsonEscaped(json, deadlineText(t.deadline, buffer));
+    json += t.completed ? "\",\"completed\":true}" : "\",\"completed\":false}";
+}
+
+inline void writeTasksJson(std::ostream &file, const std::vector<Task> &tasks) {
+    file << "[\n";
+    for (size_t i = 0; i < tasks.size(); i++) {
+        const Task &t = tasks[i];
+        file << "  {\n";
+        file << "    \"id\": " << t.id << ",\n";
+        file << "    \"name\": \"" << jsonEscape(t.name) << "\",\n";
+        file << "    \"category\": \"" << jsonEscape(t.category) << "\",\n";
+        file << "    \"priority\": \"" << jsonEscape(t.priority) << "\",\n";
+        file << "    \"deadline\": \"" << jsonEscape(t.deadline) << "\",\n";
+        file << "    \"completed\": " << (t.completed ? "true" : "false") << ",\n";
+        file << "    \"username\": \"" << jsonEscape(t.username) << "\"\n";
+        file << "  }";
+        if (i < tasks.size() - 1) file << ",";
+        file << "\n";
+    }
+    file << "]";
+}
@@ -0,0 +1,389 @@
+#pragma once
+
+#include "task.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace queryimpl {
+
+inline int countTrailingZeros(uint64_t x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+inline size_t popCount(uint64_t x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return (size_t)__popcnt64(x);
+#else
+    return (size_t)__builtin_popcountll(x);
+#endif
+}
+
+// Ranks for sort=priority; anything unrecognized sorts last.
+inline int priorityRank(uint32_t priority) {
+    return priority >= StringInterner::HIGH && priority <= StringInterner::LOW ? (int)priority - 1 : 3;
+}
+
+} // namespace queryimpl
+
+// One bit per slot of a TaskList.
+class SlotBitmap {
+public:
+    void set(uint32_t slot) {
+        size_t word = slot / 64;
+        if (word >= words.size()) words.resize(word + 1, 0);
+        words[word] |= 1ULL << (slot % 64);
+    }
+
+    void clear(uint32_t slot) {
+        size_t word = slot / 64;
+        if (word < words.size()) words[word] &= ~(1ULL << (slot % 64));
+    }
+
+    bool test(uint32_t slot) const {
+        size_t word = slot / 64;
+        return word < words.size() && (words[word] >> (slot % 64) & 1);
+    }
+
+    // Intersects in place; the result is never longer than either side.
+    void intersect(const SlotBitmap &other) {
+        if (words.size() > other.words.size()) words.resize(other.words.size());
+        for (size_t i = 0; i < words.size(); i++) words[i] &= other.words[i];
+    }
+
+    size_t count() const {
+        size_t n = 0;
+        for (uint64_t w : words) n += queryimpl::popCount(w);
+        return n;
+    }
+
+    template <typename F>
+    void forEach(F f) const {
+        for (size_t i = 0; i < words.size(); i++) {
+            for (uint64_t w = words[i]; w; w &= w - 1) {
+                f((uint32_t)(i * 64 + queryimpl::countTrailingZeros(w)));
+            }
+        }
+    }
+
+private:
+    std::vector<uint64_t> words;
+};
+
+// A /schedule query. Empty bounds are open; limit 0 means no limit.
+struct TaskQuery {
+    enum Sort { ByDeadline, ByPriority };
+
+    std::string from;
+    std::string to;
+    std::optional<std::string> category;
+    std::optional<std::string> priority;
+    std::optional<bool> completed;
+    Sort sort = ByDeadline;
+    size_t limit = 0;
+    std::string after;      // cursor from a previous page
+};
+
+// A deadline given as text, such as a query bound or a cursor, compared
+// with stored codes without interning it.
+struct DeadlineKey {
+    std::string_view text;
+    int32_t code = 0;
+    bool coded = false;
+
+    static DeadlineKey of(std::string_view text) {
+        DeadlineKey key;
+        key.text = text;
+        uint32_t id;
+        if (text.empty()) {
+            key.coded = true;
+        } else if (parseDateDeadline(text, key.code)) {
+            key.coded = true;
+        } else if (StringInterner::instance().find(text, id)) {
+            key.code = -1 - (int32_t)id;
+            key.coded = true;
+        }
+        return key;
+    }
+
+    // Negative, zero or positive as `stored` sorts before, with or after
+    // this key.
+    int compareStored(int32_t stored) const {
+        if (coded) return compareDeadlines(stored, code);
+        char buffer[10];
+        int c = deadlineText(stored, buffer).compare(text);
+        return (c > 0) - (c < 0);
+    }
+};
+
+// Secondary indexes over one TaskList: (deadline, id, slot) entries in
+// deadline order, and a bitmap over slots for each category, each priority,
+// and for completed and pending tasks. Like the id index they are copied
+// with the list and updated by the list's mutators, so they always describe
+// exactly its slots. Entries carry their sort key, so searching and walking
+// the order never touches the task records.
+//
+// A query walks whichever of the deadline range or the filter bitmaps
+// selects fewer tasks, so its cost follows the size of the result rather
+// than the size of the list.
+class TaskQueryIndex {
+public:
+    void insert(const StoredTask* task, uint32_t slot) {
+        Entry entry{task->id, task->deadline, slot};
+        byDeadline.insert(std::upper_bound(byDeadline.begin(), byDeadline.end(), entry, before), entry);
+        bitmapFor(categories, task->category).add(slot);
+        bitmapFor(priorities, task->priority).add(slot);
+        (task->completed ? completed : pending).set(slot);
+    }
+
+    void erase(const StoredTask* task, uint32_t slot) {
+        byDeadline.erase(locate(task));
+        release(categories, task->category, slot);
+        release(priorities, task->priority, slot);
+        (task->completed ? completed : pending).clear(slot);
+    }
+
+    // The task in slot `from` now lives in slot `to`, which is free.
+    void move(const StoredTask* task, uint32_t from, uint32_t to) {
+        locate(task)->slot = to;
+        for (SlotBitmap* bits : {&bitmapFor(categories, task->category).bits,
+                                 &bitmapFor(priorities, task->priority).bits,
+                                 task->completed ? &completed : &pending}) {
+            bits->clear(from);
+            bits->set(to);
+        }
+    }
+
+    // Indexes a whole list at once, sorting once instead of per insert.
+    void rebuild(const std::vector<const StoredTask*> &tasks) {
+        *this = TaskQueryIndex();
+        byDeadline.reserve(tasks.size());
+        for (uint32_t slot = 0; slot < tasks.size(); slot++) {
+            const StoredTask* task = tasks[slot];
+            byDeadline.push_back(Entry{task->id, task->deadline, slot});
+            bitmapFor(categories, task->category).add(slot);
+            bitmapFor(priorities, task->priority).add(slot);
+            (task->completed ? completed : pending).set(slot);
+        }
+        std::sort(byDeadline.begin(), byDeadline.end(), before);
+    }
+
+    // Appends the slots of up to query.limit matching tasks, in query order.
+    // `next` is set to the cursor for the following page, or cleared when
+    // there is none. Returns false if query.after is not a valid cursor.
+    bool run(const TaskQuery &query, const std::vector<const StoredTask*> &tasks,
+             std::vector<uint32_t> &slots, std::string &next) const {
+        next.clear();
+        Cursor cursor;
+        bool hasCursor = !query.after.empty();
+        if (hasCursor && !parseCursor(query.after, cursor)) return false;
+
+        SlotBitmap filter;
+        bool filtered = query.category || query.priority || query.completed;
+        if (filtered && !buildFilter(query, filter)) return true;
+
+        DeadlineKey from = DeadlineKey::of(query.from);
+        DeadlineKey to = DeadlineKey::of(query.to);
+        auto first = byDeadline.begin();
+        auto last = byDeadline.end();
+        if (!query.from.empty()) {
+            first = std::partition_point(first, last, [&](const Entry &e) { return from.compareStored(e.deadline) < 0; });
+        }
+        if (!query.to.empty()) {
+            last = std::partition_point(first, last, [&](const Entry &e) { return to.compareStored(e.deadline) <= 0; });
+        }
+        size_t rangeSize = (size_t)(last - first);
+        bool walkRange = !filtered || rangeSize <= filter.count();
+
+        size_t want = query.limit ? query.limit + 1 : SIZE_MAX;
+        std::vector<Key> found;
+        if (query.sort == TaskQuery::ByDeadline && walkRange) {
+            // Already in order: skip to the cursor and stop after one page.
+            if (hasCursor) {
+                first = std::partition_point(first, last, [&](const Entry &e) {
+                    return !cursorBefore(cursor, keyOf(e, 0), TaskQuery::ByDeadline);
+                });
+            }
+            for (auto it = first; it != last && found.size() < want; ++it) {
+                if (!filtered || filter.test(it->slot)) found.push_back(keyOf(*it, 0));
+            }
+        } else {
+            auto consider = [&](const Entry &e) {
+                Key key = keyOf(e, queryimpl::priorityRank(tasks[e.slot]->priority));
+                if (!hasCursor || cursorBefore(cursor, key, query.sort)) found.push_back(key);
+            };
+            if (walkRange) {
+                for (auto it = first; it != last; ++it) {
+                    if (!filtered || filter.test(it->slot)) consider(*it);
+                }
+            } else {
+                filter.forEach([&](uint32_t slot) {
+                    const StoredTask* task = tasks[slot];
+                    if (!query.from.empty() && from.compareStored(task->deadline) < 0) return;
+                    if (!query.to.empty() && to.compareStored(task->deadline) > 0) return;
+                    consider(Entry{task->id, task->deadline, slot});
+                });
+            }
+            auto order = [&](const Key &a, const Key &b) { return keyBefore(a, b, query.sort); };
+            if (found.size() > want) {
+                std::partial_sort(found.begin(), found.begin() + want, found.end(), order);
+                found.resize(want);
+            } else {
+                std::sort(found.begin(), found.end(), order);
+            }
+        }
+
+        if (found.size() == want) {
+            found.pop_back();
+            const Key &k = found.back();
+            char buffer[10];
+            int rank = queryimpl::priorityRank(tasks[k.slot]->priority);
+            next = std::to_string(rank) + "." + std::to_string(k.id) + "." +
+                   std::string(deadlineText(k.deadline, buffer));
+        }
+        for (const Key &k : found) slots.push_back(k.slot);
+        return true;
+    }
+
+private:
+    struct Entry {
+        int64_t id;
+        int32_t deadline;
+        uint32_t slot;
+    };
+
+    struct ValueBitmap {
+        uint32_t value;
+        SlotBitmap bits;
+        size_t count = 0;
+
+        void add(uint32_t slot) {
+            bits.set(slot);
+            count++;
+        }
+    };
+
+    // Sort key of one match.
+    struct Key {
+        int rank;
+        int32_t deadline;
+        int64_t id;
+        uint32_t slot;
+    };
+
+    // Cursors are "<rank>.<id>.<deadline>" of the last task returned, so a
+    // page can follow even if that task has since been deleted.
+    struct Cursor {
+        int rank;
+        int64_t id;
+        DeadlineKey deadline;
+    };
+
+    static bool before(const Entry &a, const Entry &b) {
+        int c = compareDeadlines(a.deadline, b.deadline);
+        if (c != 0) return c < 0;
+        return a.id < b.id;
+    }
+
+    static bool keyBefore(const Key &a, const Key &b, TaskQuery::Sort sort) {
+        if (sort == TaskQuery::ByPriority && a.rank != b.rank) return a.rank < b.rank;
+        int c = compareDeadlines(a.deadline, b.deadline);
+        if (c != 0) return c < 0;
+        return a.id < b.id;
+    }
+
+    static bool cursorBefore(const Cursor &cursor, const Key &key, TaskQuery::Sort sort) {
+        if (sort == TaskQuery::ByPriority && cursor.rank != key.rank) return cursor.rank < key.rank;
+        int c = cursor.deadline.compareStored(key.deadline);
+        if (c != 0) return c > 0;
+        return cursor.id < key.id;
+    }
+
+    static Key keyOf(const Entry &e, int rank) {
+        return Key{rank, e.deadline, e.id, e.slot};
+    }
+
+    static bool parseCursor(const std::string &text, Cursor &cursor) {
+        char* end = nullptr;
+        long rank = strtol(text.c_str(), &end, 10);
+        if (*end != '.' || rank < 0 || rank > 3) return false;
+        const char* idStart = end + 1;
+        long long id = strtoll(idStart, &end, 10);
+        if (end == idStart || *end != '.') return false;
+        cursor = Cursor{(int)rank, id, DeadlineKey::of(std::string_view(end + 1))};
+        return true;
+    }
+
+    std::vector<Entry>::iterator locate(const StoredTask* task) {
+        return std::lower_bound(byDeadline.begin(), byDeadline.end(),
+                                Entry{task->id, task->deadline, 0}, before);
+    }
+
+    static ValueBitmap &bitmapFor(std::vector<ValueBitmap> &values, uint32_t value) {
+        for (ValueBitmap &v : values) {
+            if (v.value == value) return v;
+        }
+        values.emplace_back();
+        values.back().value = value;
+        return values.back();
+    }
+
+    static const ValueBitmap* findBitmap(const std::vector<ValueBitmap> &values, const std::string &text) {
+        uint32_t value;
+        if (!StringInterner::instance().find(text, value)) return nullptr;
+        for (const ValueBitmap &v : values) {
+            if (v.value == value) return &v;
+        }
+        return nullptr;
+    }
+
+    static void release(std::vector<ValueBitmap> &values, uint32_t value, uint32_t slot) {
+        for (size_t i = 0; i < values.size(); i++) {
+            if (values[i].value != value) continue;
+            values[i].bits.clear(slot);
+            if (--values[i].count == 0) values.erase(values.begin() + i);
+            return;
+        }
+    }
+
+    // Intersects the bitmaps the query filters on. Returns false if one of
+    // them is empty, so nothing can match.
+    bool buildFilter(const TaskQuery &query, SlotBitmap &filter) const {
+        std::vector<const SlotBitmap*> parts;
+        if (query.category) {
+            const ValueBitmap* v = findBitmap(categories, *query.category);
+            if (!v) return false;
+            parts.push_back(&v->bits);
+        }
+        if (query.priority) {
+            const ValueBitmap* v = findBitmap(priorities, *query.priority);
+            if (!v) return false;
+            parts.push_back(&v->bits);
+        }
+        if (query.completed) parts.push_back(*query.completed ? &completed : &pending);
+        filter = *parts[0];
+        for (size_t i = 1; i < parts.size(); i++) filter.intersect(*parts[i]);
+        return true;
+    }
+
+    std::vector<Entry> byDeadline;
+    std::vector<ValueBitmap> categories;
+    std::vector<ValueBitmap> priorities;
+    SlotBitmap completed;
+    SlotBitmap pending;
+};
@@ -0,0 +1,226 @@
+#pragma once
+
+#include "interner.h"
+#include "json.h"
+#include "task.h"
+
+#include <algorithm>
+#include <cassert>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Counts of one user's tasks for the dashboard: totals, completed, and
+// tallies by category and priority, kept in step with the list on every
+// change (TaskList does this the way it keeps its indexes), so reading them
+// never walks the tasks.
+//
+// Pending tasks are also tallied by the day they are due. Which of them
+// are overdue, due today, due in the six days after or later depends on
+// the day, so those four are kept for `asOf` and only summed again from the
+// per-day tallies once the day has moved on.
+class TaskStats {
+public:
+    struct Tally {
+        uint32_t id;            // interned category or priority
+        uint32_t total;
+        uint32_t completed;
+    };
+
+    struct Due {
+        uint32_t overdue = 0;
+        uint32_t today = 0;
+        uint32_t week = 0;      // the six days after today
+        uint32_t later = 0;
+    };
+
+    explicit TaskStats(int32_t today = todayDeadlineCode()) : asOf(today) {}
+
+    // Copies start without a rendered body and on today's date; they are
+    // about to change.
+    TaskStats(const TaskStats &other)
+        : total(other.total), completed(other.completed), categories(other.categories),
+          priorities(other.priorities), byDay(other.byDay), undated(other.undated),
+          asOf(other.asOf), due(other.due) {
+        roll(todayDeadlineCode());
+    }
+
+    TaskStats& operator=(const TaskStats&) = delete;
+
+    void add(const StoredTask &task) {
+        count(task, 1);
+    }
+
+    void remove(const StoredTask &task) {
+        count(task, -1);
+    }
+
+    void rebuild(const std::vector<const StoredTask*> &tasks) {
+        for (const StoredTask* task : tasks) add(*task);
+    }
+
+    // For loaders that count tasks in bulk, such as from a mapped
+    // snapshot: `total` tasks of a category or priority, `completed` of
+    // them done, and `pending` tasks due on `deadline`, a code; anything
+    // but a date counts as undated. Totals come from the categories.
+    // Negative counts take tasks away again.
+    void addCategory(uint32_t id, int64_t total, int64_t completed) {
+        apply(this->total, total);
+        apply(this->completed, completed);
+        tally(categories, id, total, completed);
+    }
+
+    void addPriority(uint32_t id, int64_t total, int64_t completed) {
+        tally(priorities, id, total, completed);
+    }
+
+    void addPending(int32_t deadline, int64_t pending) {
+        if (deadline <= 0) {
+            apply(undated, pending);
+            return;
+        }
+        auto it = std::lower_bound(byDay.begin(), byDay.end(), deadline,
+                                   [](const std::pair<int32_t, uint32_t> &d, int32_t day) { return d.first < day; });
+        if (it == byDay.end() || it->first != deadline) it = byDay.insert(it, std::make_pair(deadline, 0u));
+        apply(it->second, pending);
+        if (it->second == 0) byDay.erase(it);
+        apply(bucket(due, deadline, asOf), pending);
+    }
+
+    // Pending tasks by when they are due as seen on `today`: the kept
+    // buckets when they are for that day, otherwise summed from byDay.
+    Due dueOn(int32_t today) const {
+        if (today == asOf) return due;
+        Due result;
+        for (const auto &d : byDay) bucket(result, d.first, today) += d.second;
+        return result;
+    }
+
+    // The JSON /stats sends for `today`, rendered on first use and shared by
+    // every response for that day. `version` must be the same on every call,
+    // the version of the list these counts describe.
+    std::shared_ptr<const std::string> json(uint64_t version, int32_t today) const {
+        std::shared_ptr<const Rendered> cached = std::atomic_load(&rendered);
+        if (cached && cached->day == today) return cached->body;
+        std::shared_ptr<std::string> body = std::make_shared<std::string>();
+        char buffer[10];
+        Due d = dueOn(today);
+        *body += "{\"version\":";
+        appendInteger(*body, (long long)version);
+        *body += ",\"date\":\"";
+        *body += deadlineText(today, buffer);
+        *body += "\",\"total\":";
+        appendInteger(*body, total);
+        *body += ",\"completed\":";
+        appendInteger(*body, completed);
+        *body += ",\"pending\":";
+        appendInteger(*body, total - completed);
+        *body += ",\"categories\":";
+        appendTallies(*body, categories);
+        *body += ",\"priorities\":";
+        appendTallies(*body, priorities);
+        *body += ",\"deadlines\":{\"overdue\":";
+        appendInteger(*body, d.overdue);
+        *body += ",\"today\":";
+        appendInteger(*body, d.today);
+        *body += ",\"week\":";
+        appendInteger(*body, d.week);
+        *body += ",\"later\":";
+        appendInteger(*body, d.later);
+        *body += ",\"none\":";
+        appendInteger(*body, undated);
+        *body += "}}";
+        std::shared_ptr<Rendered> built = std::make_shared<Rendered>();
+        built->day = today;
+        built->body = body;
+        std::atomic_store(&rendered, std::shared_ptr<const Rendered>(built));
+        return body;
+    }
+
+    uint32_t total = 0;
+    uint32_t completed = 0;
+
+private:
+    struct Rendered {
+        int32_t day;
+        std::shared_ptr<const std::string> body;
+    };
+
+    // Rolls the kept buckets forward to `today`.
+    void roll(int32_t today) {
+        if (today == asOf) return;
+        due = dueOn(today);
+        asOf = today;
+    }
+
+    static uint32_t &bucket(Due &d, int32_t deadline, int32_t today) {
+        if (deadline < today) return d.overdue;
+        if (deadline == today) return d.today;
+        if (deadline < today + 7) return d.week;
+        return d.later;
+    }
+
+    // Adds one task to the counts, or with a delta of -1 takes it away.
+    void count(const StoredTask &task, int64_t delta) {
+        int64_t done = task.completed ? delta : 0;
+        addCategory(task.category, delta, done);
+        addPriority(task.priority, delta, done);
+        if (!task.completed) addPending(task.deadline, delta);
+    }
+
+    // Every removal matches an earlier add, so a count never goes below
+    // zero; if one does, the store's bookkeeping is wrong, and Debug builds
+    // stop here rather than serve the result.
+    static void apply(uint32_t &count, int64_t delta) {
+        int64_t next = (int64_t)count + delta;
+        assert(next >= 0 && next <= (int64_t)UINT32_MAX);
+        count = (uint32_t)next;
+    }
+
+    static void tally(std::vector<Tally> &tallies, uint32_t id, int64_t total, int64_t completed) {
+        auto it = std::find_if(tallies.begin(), tallies.end(), [id](const Tally &t) { return t.id == id; });
+        if (it == tallies.end()) {
+            assert(total >= 0);
+            if (total == 0) return;
+            it = tallies.insert(tallies.end(), Tally{id, 0, 0});
+        }
+        apply(it->total, total);
+        apply(it->completed, completed);
+        if (it->total == 0) tallies.erase(it);
+    }
+
+    // {"name":{"total":N,"completed":N},...}, by name.
+    static void appendTallies(std::string &out, const std::vector<Tally> &tallies) {
+        const StringInterner &strings = StringInterner::instance();
+        std::vector<const Tally*> sorted;
+        for (const Tally &t : tallies) sorted.push_back(&t);
+        std::sort(sorted.begin(), sorted.end(), [&](const Tally* a, const Tally* b) {
+            return strings.text(a->id) < strings.text(b->id);
+        });
+        out += '{';
+        for (size_t i = 0; i < sorted.size(); i++) {
+            if (i > 0) out += ',';
+            out += '"';
+            appendJsonEscaped(out, strings.text(sorted[i]->id));
+            out += "\":{\"total\":";
+            appendInteger(out, sorted[i]->total);
+            out += ",\"completed\":";
+            appendInteger(out, sorted[i]->completed);
+            out += '}';
+        }
+        out += '}';
+    }
+
+    // Few users have more than a handful of categories or priorities, so
+    // a linear search beats hashing.
+    std::vector<Tally> categories;
+    std::vector<Tally> priorities;
+    std::vector<std::pair<int32_t, uint32_t>> byDay;   // pending tasks per due date, by date
+    uint32_t undated = 0;       // pending tasks without a date
+    int32_t asOf;
+    Due due;                    // for asOf
+    mutable std::shared_ptr<const Rendered> rendered;
+};
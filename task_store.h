@@ -0,0 +1,858 @@
+#pragma once
+
+#include "arena.h"
+#include "rcu.h"
+#include "task.h"
+#include "snapshot.h"
+#include "task_json.h"
+#include "task_query.h"
+#include "task_stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The most recent changes to one user's list, so a client that is only a
+// few versions behind can be sent just the tasks that changed.
+struct ChangeRing {
+    static const size_t CAPACITY = 128;
+
+    struct Change {
+        uint64_t version;
+        long long id;
+    };
+
+    Change entries[CAPACITY];
+    size_t head = 0;        // oldest retained change
+    size_t count = 0;
+    uint64_t floor = 0;     // every change after this version is retained
+
+    void record(uint64_t version, long long id) {
+        if (count == CAPACITY) {
+            floor = entries[head].version;
+            head = (head + 1) % CAPACITY;
+            count--;
+        }
+        entries[(head + count) % CAPACITY] = Change{version, id};
+        count++;
+    }
+
+    // Appends the ids changed after `since`, possibly repeated. Returns false
+    // if some of those changes have already been dropped.
+    bool changedSince(uint64_t since, std::vector<long long> &ids) const {
+        if (since < floor) return false;
+        for (size_t i = 0; i < count; i++) {
+            const Change &c = entries[(head + i) % CAPACITY];
+            if (c.version > since) ids.push_back(c.id);
+        }
+        return true;
+    }
+};
+
+// Where the records of one directory shard's users live. Records are
+// created under the owning user's write lock, so users of the same shard
+// only share the arena's lock for the allocation itself. The arena is kept
+// alive by every retired record still waiting for RCU, so it can outlive
+// the store.
+class TaskArena {
+public:
+    const StoredTask* create(const StoredTask &fields, std::string_view name) {
+        std::lock_guard<std::mutex> guard(lock);
+        return createLocked(fields, name);
+    }
+
+    void destroy(const StoredTask* record) {
+        std::lock_guard<std::mutex> guard(lock);
+        destroyLocked(record);
+    }
+
+    // For bulk loads that hold the lock across many records.
+    std::mutex lock;
+
+    const StoredTask* createLocked(const StoredTask &fields, std::string_view name) {
+        return StoredTask::construct(arena.allocate(StoredTask::sizeFor(name.size())), fields, name);
+    }
+
+    void destroyLocked(const StoredTask* record) {
+        arena.release((void*)record, StoredTask::sizeFor(record->nameLength));
+    }
+
+    size_t bytesInUse() {
+        std::lock_guard<std::mutex> guard(lock);
+        return arena.bytesInUse();
+    }
+
+private:
+    Arena arena;
+};
+
+// Immutable view of one user's tasks. Writers build a new list and publish
+// it; readers keep using whichever list they loaded until they leave their
+// read section. Task records are shared between consecutive lists and are
+// never modified in place, so publishing a change copies pointers and index
+// entries, never strings. Changes go through append(), replace() and
+// removeAt(), which keep both indexes and the counts in step with `tasks`.
+struct TaskList {
+    std::vector<const StoredTask*> tasks;
+    TaskIdIndex index;
+    TaskQueryIndex query;
+    TaskStats stats;
+    uint64_t version;       // bumped by every change; exposed as an ETag
+    ChangeRing changes;
+
+    TaskList() : version(initialVersion()) {
+        changes.floor = version;
+    }
+
+    // Copies start without a rendered body; they are about to change.
+    TaskList(const TaskList &other)
+        : tasks(other.tasks), index(other.index), query(other.query), stats(other.stats),
+          version(other.version), changes(other.changes) {}
+
+    TaskList& operator=(const TaskList&) = delete;
+
+    // The JSON array /schedule sends, rendered from the records on first use
+    // and shared by every response for this version. Readers that race here
+    // build identical bodies and one of them is kept.
+    std::shared_ptr<const std::string> json() const {
+        std::shared_ptr<const std::string> body = std::atomic_load(&rendered);
+        if (body) return body;
+        size_t size = 2;
+        for (const StoredTask* t : tasks) size += RENDERED_FIELDS_SIZE + t->nameLength;
+        std::shared_ptr<std::string> built = std::make_shared<std::string>();
+        built->reserve(size);
+        *built += '[';
+        for (size_t i = 0; i < tasks.size(); i++) {
+            if (i > 0) *built += ',';
+            appendTaskJson(*built, *tasks[i]);
+        }
+        *built += ']';
+        body = built;
+        std::atomic_store(&rendered, body);
+        return body;
+    }
+
+    // Versions start from the process start time shifted left by 20 bits, so
+    // they keep increasing across restarts (unless a user makes a million
+    // changes per second of uptime) and stay below 2^53 for JavaScript.
+    static uint64_t initialVersion() {
+        static const uint64_t base = (uint64_t)time(nullptr) << 20;
+        return base;
+    }
+
+    const StoredTask* find(long long id) const {
+        uint32_t slot = index.find(id);
+        return slot == TaskIdIndex::NONE ? nullptr : tasks[slot];
+    }
+
+    void append(const StoredTask* task) {
+        uint32_t slot = (uint32_t)tasks.size();
+        index.set(task->id, slot);
+        tasks.push_back(task);
+        query.insert(task, slot);
+        stats.add(*task);
+    }
+
+    // `task` takes the place of the one in `slot`, which has the same id.
+    void replace(uint32_t slot, const StoredTask* task) {
+        query.erase(tasks[slot], slot);
+        stats.remove(*tasks[slot]);
+        tasks[slot] = task;
+        query.insert(task, slot);
+        stats.add(*task);
+    }
+
+    // Swap-and-pop: the last task takes the removed task's slot.
+    void removeAt(uint32_t slot) {
+        const StoredTask* removed = tasks[slot];
+        const StoredTask* last = tasks.back();
+        uint32_t lastSlot = (uint32_t)tasks.size() - 1;
+        query.erase(removed, slot);
+        stats.remove(*removed);
+        if (slot != lastSlot) query.move(last, lastSlot, slot);
+        tasks[slot] = last;
+        index.set(last->id, slot);
+        tasks.pop_back();
+        index.erase(removed->id);
+    }
+
+private:
+    // Roughly what a rendered task takes besides its name.
+    static const size_t RENDERED_FIELDS_SIZE = 112;
+
+    mutable std::shared_ptr<const std::string> rendered;
+};
+
+// One operation of a batch. Add stores `task`; Update copies the fields
+// named in `fields` from it onto the stored task. Toggle and Remove only
+// use task.username and task.id.
+struct BatchOp {
+    enum Type { Add, Update, Toggle, Remove };
+    enum Field { NAME = 1, CATEGORY = 2, PRIORITY = 4, DEADLINE = 8, COMPLETED = 16 };
+    Type type;
+    unsigned fields = 0;
+    Task task;
+};
+
+struct BatchResult {
+    bool ok;
+    const char* error;      // set when !ok
+};
+
+// Final state of one task touched by a batch: the stored task, or nullptr
+// if it was removed.
+struct BatchEffect {
+    const std::string* username;
+    long long id;
+    const StoredTask* task;
+};
+
+// Receives every change while the user's write lock is still held, so the
+// order of calls for one user matches the order the changes were applied.
+class TaskJournal {
+public:
+    virtual ~TaskJournal() {}
+    virtual void taskPut(const StoredTask &task) = 0;
+    virtual void taskRemoved(const std::string &username, long long id) = 0;
+    // All effects of one batch, to be persisted as a single record.
+    virtual void batchApplied(const std::vector<BatchEffect> &effects) = 0;
+    // Called once a change is visible to readers, still under the lock;
+    // `previous` is the version of the list the change was applied to.
+    virtual void listPublished(const std::string &username, uint64_t previous, const TaskList &list) {
+        (void)username;
+        (void)previous;
+        (void)list;
+    }
+};
+
+// Task store safe for concurrent use. Reads are lock-free: they load the
+// user's current TaskList through RCU. Writes are serialized per user, so
+// users never wait on each other, and every lookup goes through the user's
+// id index, so no request touches another user's tasks.
+//
+// Users loaded from a mapped TaskSnapshot stay in the mapping until they
+// are first touched; only then are their records copied into a TaskList.
+// Startup therefore costs one entry per user, not one allocation per task.
+//
+// Tasks are kept as StoredTask records in the arena of the user's directory
+// shard and are converted to JSON or to a Task only at the edges.
+class TaskStore {
+public:
+    void setJournal(TaskJournal* j) {
+        journal = j;
+    }
+
+    // Must be called inside an RcuReadGuard. Returns nullptr for a user that
+    // has never had a task. The first read of a user still in the mapped
+    // snapshot materializes it under the user's write lock.
+    const TaskList* snapshot(const std::string &username) const {
+        UserTasks* user = findUser(username);
+        if (!user) return nullptr;
+        if (user->base.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(user->writeLock);
+            materializeLocked(*user);
+        }
+        return user->list.load();
+    }
+
+    // Must be called inside an RcuReadGuard. The counts of the user's tasks,
+    // with the version of the list they describe in `version`, or nullptr
+    // for a user that has never had a task. Users still in the mapped
+    // snapshot are answered from the counts rebuildStats() took, without
+    // being materialized.
+    const TaskStats* stats(const std::string &username, uint64_t &version) const {
+        UserTasks* user = findUser(username);
+        if (!user) return nullptr;
+        const TaskList* list = user->list.load();
+        if (const TaskStats* counted = user->baseStats.load()) {
+            version = list->version;
+            return counted;
+        }
+        list = snapshot(username);
+        version = list->version;
+        return &list->stats;
+    }
+
+    // Counts the tasks of the users of directory shard `shard` that are
+    // still only in the mapped snapshot, reading the records in place.
+    // Records are grouped by the heap offsets of their strings, so each
+    // distinct category, priority and deadline is read once per user.
+    // Startup only; different shards may be counted concurrently.
+    void rebuildStats(size_t shard) {
+        RcuReadGuard guard;
+        StringInterner &strings = StringInterner::instance();
+        int32_t today = todayDeadlineCode();
+        struct Group {
+            uint32_t offset;
+            uint32_t total;
+            uint32_t completed;
+        };
+        std::vector<Group> categories, priorities;
+        std::unordered_map<uint32_t, uint32_t> pendingByDeadline;
+        auto group = [](std::vector<Group> &groups, uint32_t offset, bool done) {
+            Group* g = nullptr;
+            for (Group &candidate : groups) {
+                if (candidate.offset == offset) g = &candidate;
+            }
+            if (!g) {
+                groups.push_back(Group{offset, 0, 0});
+                g = &groups.back();
+            }
+            g->total++;
+            g->completed += done;
+        };
+        for (const auto &entry : *shards[shard].directory.load()) {
+            UserTasks &user = *entry.second;
+            std::lock_guard<std::mutex> lock(user.writeLock);
+            const SnapshotUser* base = user.base.load();
+            if (!base) continue;
+            const TaskSnapshot &snap = *user.baseSnapshot;
+            const SnapshotTask* records = snap.tasksOf(*base);
+            categories.clear();
+            priorities.clear();
+            pendingByDeadline.clear();
+            for (uint64_t i = 0; i < base->taskCount; i++) {
+                const SnapshotTask &r = records[i];
+                group(categories, r.category, r.completed != 0);
+                group(priorities, r.priority, r.completed != 0);
+                if (!r.completed) pendingByDeadline[r.deadline]++;
+            }
+            TaskStats* counted = new TaskStats(today);
+            for (const Group &g : categories) counted->addCategory(strings.intern(snap.string(g.offset)), g.total, g.completed);
+            for (const Group &g : priorities) counted->addPriority(strings.intern(snap.string(g.offset)), g.total, g.completed);
+            for (const auto &d : pendingByDeadline) {
+                int32_t code;
+                if (!parseDateDeadline(snap.string(d.first), code)) code = 0;
+                counted->addPending(code, d.second);
+            }
+            user.baseStats.publish(counted);
+        }
+    }
+
+    // Registers every user of a freshly opened snapshot. Startup only;
+    // snapshots holding different users may be attached concurrently. A
+    // mapping stays open while any user is still served from it.
+    void attachSnapshot(const std::shared_ptr<const TaskSnapshot> &snap) {
+        std::vector<std::string> names;
+        names.reserve(snap->userCount());
+        for (size_t i = 0; i < snap->userCount(); i++) {
+            names.push_back(std::string(snap->username(snap->user(i))));
+        }
+        std::vector<UserTasks*> created = usersFor(names);
+        for (size_t i = 0; i < created.size(); i++) {
+            created[i]->baseSnapshot = snap;
+            created[i]->base.store(&snap->user(i), std::memory_order_release);
+        }
+        count.fetch_add(snap->taskCount(), std::memory_order_relaxed);
+    }
+
+    // Called after compaction wrote `snap`: users still served from an older
+    // mapping switch to the new one, so the old file is unmapped once its
+    // last user has moved.
+    void rebaseSnapshot(const std::shared_ptr<const TaskSnapshot> &snap) {
+        for (size_t i = 0; i < snap->userCount(); i++) {
+            UserTasks* user = findUser(std::string(snap->username(snap->user(i))));
+            if (!user) continue;
+            std::lock_guard<std::mutex> lock(user->writeLock);
+            if (user->base.load()) {
+                user->baseSnapshot = snap;
+                user->base.store(&snap->user(i), std::memory_order_release);
+            }
+        }
+    }
+
+    // Returns false if the user already has a task with this id.
+    bool add(const Task &task) {
+        UserTasks &user = userFor(task.username);
+        std::lock_guard<std::mutex> lock(user.writeLock);
+        materializeLocked(user);
+        const TaskList* current = user.list.load();
+        if (current->index.find(task.id) != TaskIdIndex::NONE) return false;
+
+        const StoredTask* record = user.arena->create(StoredTask::fieldsOf(task, user.name), task.name);
+        TaskList* next = new TaskList(*current);
+        next->append(record);
+        recordChange(*next, task.id);
+        count.fetch_add(1, std::memory_order_relaxed);
+        if (journal) journal->taskPut(*record);
+        uint64_t previous = current->version;
+        user.list.publish(next);
+        if (journal) journal->listPublished(task.username, previous, *next);
+        return true;
+    }
+
+    // Adds the task or replaces the user's task with the same id. Used when
+    // replaying the log.
+    void put(const Task &task) {
+        UserTasks &user = userFor(task.username);
+        std::lock_guard<std::mutex> lock(user.writeLock);
+        materializeLocked(user);
+        const TaskList* current = user.list.load();
+        uint32_t slot = current->index.find(task.id);
+
+        const StoredTask* record = user.arena->create(StoredTask::fieldsOf(task, user.name), task.name);
+        TaskList* next = new TaskList(*current);
+        const StoredTask* old = nullptr;
+        if (slot == TaskIdIndex::NONE) {
+            next->append(record);
+            count.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            old = next->tasks[slot];
+            next->replace(slot, record);
+        }
+        recordChange(*next, task.id);
+        if (journal) journal->taskPut(*record);
+        uint64_t previous = current->version;
+        user.list.publish(next);
+        if (journal) journal->listPublished(task.username, previous, *next);
+        if (old) retireTask(user, old);
+    }
+
+    bool toggle(const std::string &username, long long id) {
+        UserTasks* user = findUser(username);
+        if (!user) return false;
+        std::lock_guard<std::mutex> lock(user->writeLock);
+        materializeLocked(*user);
+        const TaskList* current = user->list.load();
+        uint32_t slot = current->index.find(id);
+        if (slot == TaskIdIndex::NONE) return false;
+
+        const StoredTask* old = current->tasks[slot];
+        StoredTask changed = *old;
+        changed.completed = !changed.completed;
+        const StoredTask* updated = user->arena->create(changed, old->name());
+        TaskList* next = new TaskList(*current);
+        next->replace(slot, updated);
+        recordChange(*next, id);
+        if (journal) journal->taskPut(*updated);
+        uint64_t previous = current->version;
+        user->list.publish(next);
+        if (journal) journal->listPublished(username, previous, *next);
+        retireTask(*user, old);
+        return true;
+    }
+
+    bool remove(const std::string &username, long long id) {
+        UserTasks* user = findUser(username);
+        if (!user) return false;
+        std::lock_guard<std::mutex> lock(user->writeLock);
+        materializeLocked(*user);
+        const TaskList* current = user->list.load();
+        uint32_t slot = current->index.find(id);
+        if (slot == TaskIdIndex::NONE) return false;
+
+        const StoredTask* old = current->tasks[slot];
+        TaskList* next = new TaskList(*current);
+        next->removeAt(slot);
+        recordChange(*next, id);
+        count.fetch_sub(1, std::memory_order_relaxed);
+        if (journal) journal->taskRemoved(username, id);
+        uint64_t previous = current->version;
+        user->list.publish(next);
+        if (journal) journal->listPublished(username, previous, *next);
+        retireTask(*user, old);
+        return true;
+    }
+
+    // Applies `ops` all-or-nothing. Every affected user is locked once, the
+    // ops run in order against private copies of their lists, and only if
+    // all of them succeed is each list published and the journal told once.
+    // results[i] says whether ops[i] succeeded (or would have); on failure
+    // nothing changes.
+    bool applyBatch(const std::vector<BatchOp> &ops, std::vector<BatchResult> &results) {
+        results.assign(ops.size(), BatchResult{true, nullptr});
+
+        struct Pending {
+            const std::string* name;
+            UserTasks* user;
+            TaskList* next;
+            std::vector<long long> touched;
+        };
+        std::unordered_map<std::string, size_t> byName;
+        std::vector<Pending> pending;
+        std::vector<size_t> opUser(ops.size(), SIZE_MAX);
+        for (size_t i = 0; i < ops.size(); i++) {
+            const std::string &name = ops[i].task.username;
+            auto it = byName.find(name);
+            if (it == byName.end()) {
+                UserTasks* user = ops[i].type == BatchOp::Add ? &userFor(name) : findUser(name);
+                if (!user) {
+                    results[i] = BatchResult{false, "Task not found"};
+                    continue;
+                }
+                it = byName.emplace(name, pending.size()).first;
+                pending.push_back(Pending{&it->first, user, nullptr, {}});
+            }
+            opUser[i] = it->second;
+        }
+
+        // A fixed lock order keeps concurrent batches from deadlocking.
+        std::vector<UserTasks*> order;
+        for (const Pending &p : pending) order.push_back(p.user);
+        std::sort(order.begin(), order.end());
+        std::vector<std::unique_lock<std::mutex>> locks;
+        for (UserTasks* user : order) {
+            locks.emplace_back(user->writeLock);
+            materializeLocked(*user);
+        }
+        for (Pending &p : pending) p.next = new TaskList(*p.user->list.load());
+
+        // Tasks allocated by this batch can be freed directly if replaced
+        // again; published ones must go through RCU.
+        std::unordered_map<const StoredTask*, UserTasks*> created;
+        std::vector<std::pair<const StoredTask*, UserTasks*>> replaced;
+        auto discard = [&](const StoredTask* old, UserTasks* user) {
+            if (created.erase(old)) user->arena->destroy(old);
+            else replaced.emplace_back(old, user);
+        };
+        bool failed = false;
+        long long added = 0;
+        for (size_t i = 0; i < ops.size(); i++) {
+            if (opUser[i] == SIZE_MAX) {
+                failed = true;
+                continue;
+            }
+            const BatchOp &op = ops[i];
+            Pending &p = pending[opUser[i]];
+            TaskList &list = *p.next;
+            uint32_t slot = list.index.find(op.task.id);
+            if (op.type == BatchOp::Add) {
+                if (slot != TaskIdIndex::NONE) {
+                    results[i] = BatchResult{false, "Task ID already exists"};
+                    failed = true;
+                    continue;
+                }
+                const StoredTask* t = p.user->arena->create(StoredTask::fieldsOf(op.task, p.user->name), op.task.name);
+                created.emplace(t, p.user);
+                list.append(t);
+                added++;
+            } else if (slot == TaskIdIndex::NONE) {
+                results[i] = BatchResult{false, "Task not found"};
+                failed = true;
+                continue;
+            } else if (op.type == BatchOp::Remove) {
+                const StoredTask* old = list.tasks[slot];
+                list.removeAt(slot);
+                discard(old, p.user);
+                added--;
+            } else {
+                const StoredTask* old = list.tasks[slot];
+                StoredTask changed = *old;
+                std::string_view name = old->name();
+                if (op.type == BatchOp::Toggle) {
+                    changed.completed = !changed.completed;
+                } else {
+                    StringInterner &strings = StringInterner::instance();
+                    if (op.fields & BatchOp::NAME) name = op.task.name;
+                    if (op.fields & BatchOp::CATEGORY) changed.category = strings.intern(op.task.category);
+                    if (op.fields & BatchOp::PRIORITY) changed.priority = strings.intern(op.task.priority);
+                    if (op.fields & BatchOp::DEADLINE) changed.deadline = deadlineCode(op.task.deadline);
+                    if (op.fields & BatchOp::COMPLETED) changed.completed = op.task.completed;
+                }
+                const StoredTask* t = p.user->arena->create(changed, name);
+                created.emplace(t, p.user);
+                list.replace(slot, t);
+                discard(old, p.user);
+            }
+            recordChange(list, op.task.id);
+            p.touched.push_back(op.task.id);
+        }
+
+        if (failed) {
+            for (const auto &entry : created) entry.second->arena->destroy(entry.first);
+            for (Pending &p : pending) delete p.next;
+            return false;
+        }
+
+        if (journal) {
+            std::vector<BatchEffect> effects;
+            for (Pending &p : pending) {
+                std::sort(p.touched.begin(), p.touched.end());
+                p.touched.erase(std::unique(p.touched.begin(), p.touched.end()), p.touched.end());
+                for (long long id : p.touched) {
+                    effects.push_back(BatchEffect{p.name, id, p.next->find(id)});
+                }
+            }
+            journal->batchApplied(effects);
+        }
+        for (Pending &p : pending) {
+            uint64_t previous = p.user->list.load()->version;
+            p.user->list.publish(p.next);
+            if (journal) journal->listPublished(*p.name, previous, *p.next);
+        }
+        for (const auto &entry : replaced) retireTask(*entry.second, entry.first);
+        if (added >= 0) count.fetch_add((size_t)added, std::memory_order_relaxed);
+        else count.fetch_sub((size_t)-added, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Replaces the whole contents; only meant for startup before any reader
+    // or writer runs.
+    void load(const std::vector<Task> &all) {
+        std::unordered_map<std::string, std::vector<const Task*>> grouped;
+        for (const Task &t : all) grouped[t.username].push_back(&t);
+        std::vector<std::string> names;
+        for (const auto &entry : grouped) names.push_back(entry.first);
+        std::vector<UserTasks*> created = usersFor(names);
+
+        size_t loaded = 0;
+        for (size_t i = 0; i < names.size(); i++) {
+            UserTasks &user = *created[i];
+            TaskList* list = new TaskList();
+            std::lock_guard<std::mutex> lock(user.arena->lock);
+            for (const Task* t : grouped[names[i]]) {
+                const StoredTask* record = user.arena->createLocked(StoredTask::fieldsOf(*t, user.name), t->name);
+                uint32_t slot = list->index.find(t->id);
+                if (slot != TaskIdIndex::NONE) {
+                    // Duplicate ids predate the index; the later record wins.
+                    const StoredTask* old = list->tasks[slot];
+                    list->replace(slot, record);
+                    user.arena->destroyLocked(old);
+                    continue;
+                }
+                list->append(record);
+                loaded++;
+            }
+            user.list.publish(list);
+        }
+        count.fetch_add(loaded, std::memory_order_relaxed);
+    }
+
+    // Calls f(username, list) for every user with a consistent list each,
+    // or with `partitions` > 1, only for users whose shard is `partition`
+    // modulo `partitions`. Users still in the mapped snapshot are read from
+    // it without being materialized.
+    //
+    // f runs under the user's write lock. Changes are journaled before they
+    // are published, under that lock, so any change already in the log when
+    // this is called is in the list f sees; compaction relies on that to
+    // drop the segments it sealed beforehand.
+    void forEachUser(const std::function<void(const std::string&, const TaskList&)> &f,
+                     size_t partition = 0, size_t partitions = 1) const {
+        RcuReadGuard guard;
+        for (size_t s = partition; s < SHARDS; s += partitions) {
+            for (const auto &entry : *shards[s].directory.load()) {
+                UserTasks &user = *entry.second;
+                std::lock_guard<std::mutex> lock(user.writeLock);
+                if (user.base.load()) {
+                    std::unique_ptr<TaskList> temporary(readSnapshotLocked(user, false));
+                    f(entry.first, *temporary);
+                    std::lock_guard<std::mutex> arenaLock(user.arena->lock);
+                    for (const StoredTask* t : temporary->tasks) user.arena->destroyLocked(t);
+                    continue;
+                }
+                f(entry.first, *user.list.load());
+            }
+        }
+    }
+
+    // Calls f(user, id, deadline, completed) for every task, with the
+    // interned username and the deadline code, under the user's write lock.
+    // Users still in the mapped snapshot are read in place without being
+    // materialized; their deadlines are only parsed as dates, so other text
+    // comes out as 0 instead of being interned.
+    template <typename F>
+    void forEachDeadline(F f) const {
+        RcuReadGuard guard;
+        for (const Shard &shard : shards) {
+            for (const auto &entry : *shard.directory.load()) {
+                UserTasks &user = *entry.second;
+                std::lock_guard<std::mutex> lock(user.writeLock);
+                if (const SnapshotUser* base = user.base.load()) {
+                    const TaskSnapshot &snap = *user.baseSnapshot;
+                    const SnapshotTask* records = snap.tasksOf(*base);
+                    std::unordered_map<uint32_t, int32_t> deadlines;
+                    for (uint64_t i = 0; i < base->taskCount; i++) {
+                        auto deadline = deadlines.find(records[i].deadline);
+                        if (deadline == deadlines.end()) {
+                            int32_t code;
+                            if (!parseDateDeadline(snap.string(records[i].deadline), code)) code = 0;
+                            deadline = deadlines.emplace(records[i].deadline, code).first;
+                        }
+                        f(user.name, records[i].id, deadline->second, records[i].completed != 0);
+                    }
+                    continue;
+                }
+                for (const StoredTask* t : user.list.load()->tasks) f(user.name, t->id, t->deadline, t->completed);
+            }
+        }
+    }
+
+    size_t size() const {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    // Bytes of task records currently allocated, names included.
+    size_t recordBytes() const {
+        size_t bytes = 0;
+        for (const Shard &shard : shards) bytes += shard.arena->bytesInUse();
+        return bytes;
+    }
+
+    // Users are spread over SHARDS directory shards by a hash of the name
+    // that does not change between builds or platforms, so files split by
+    // shard (see forEachUser) can be read back by any build.
+    static const size_t SHARDS = 64;
+
+    static size_t shardOf(std::string_view username) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (char c : username) h = (h ^ (unsigned char)c) * 0x100000001b3ULL;
+        return (size_t)((h ^ (h >> 32)) % SHARDS);
+    }
+
+private:
+    struct UserTasks {
+        UserTasks(std::shared_ptr<TaskArena> arena, uint32_t name) : arena(std::move(arena)), name(name) {}
+
+        std::shared_ptr<TaskArena> arena;
+        uint32_t name;          // interned username
+        std::mutex writeLock;
+        RcuPtr<TaskList> list{new TaskList()};
+        // Non-null while the user's tasks are only in the mapped snapshot.
+        std::atomic<const SnapshotUser*> base{nullptr};
+        std::shared_ptr<const TaskSnapshot> baseSnapshot;
+        // The counts of the tasks in `base`, once rebuildStats() has taken
+        // them; `list` is an empty placeholder until then.
+        RcuPtr<TaskStats> baseStats;
+    };
+
+    typedef std::unordered_map<std::string, UserTasks*> Directory;
+
+    // The user directory is split so that creating a user copies only a
+    // small map. Users are never removed, so UserTasks pointers stay valid.
+    struct Shard {
+        std::mutex insertLock;
+        RcuPtr<Directory> directory{new Directory()};
+        std::vector<std::unique_ptr<UserTasks>> owned;
+        std::shared_ptr<TaskArena> arena = std::make_shared<TaskArena>();
+    };
+
+    Shard &shardFor(const std::string &username) const {
+        return const_cast<Shard&>(shards[shardOf(username)]);
+    }
+
+    UserTasks* findUser(const std::string &username) const {
+        RcuReadGuard guard;
+        const Directory* directory = shardFor(username).directory.load();
+        auto it = directory->find(username);
+        return it == directory->end() ? nullptr : it->second;
+    }
+
+    // Looks up or creates many users at once, copying each directory shard
+    // only once.
+    std::vector<UserTasks*> usersFor(const std::vector<std::string> &names) {
+        std::vector<UserTasks*> result(names.size(), nullptr);
+        std::vector<std::vector<size_t>> byShard(SHARDS);
+        for (size_t i = 0; i < names.size(); i++) {
+            byShard[shardOf(names[i])].push_back(i);
+        }
+        for (size_t s = 0; s < SHARDS; s++) {
+            if (byShard[s].empty()) continue;
+            Shard &shard = shards[s];
+            std::lock_guard<std::mutex> lock(shard.insertLock);
+            Directory* next = new Directory(*shard.directory.load());
+            for (size_t i : byShard[s]) {
+                UserTasks* &slot = (*next)[names[i]];
+                if (!slot) {
+                    shard.owned.emplace_back(new UserTasks(shard.arena, StringInterner::instance().intern(names[i])));
+                    slot = shard.owned.back().get();
+                }
+                result[i] = slot;
+            }
+            shard.directory.publish(next);
+        }
+        return result;
+    }
+
+    UserTasks &userFor(const std::string &username) {
+        if (UserTasks* existing = findUser(username)) return *existing;
+
+        Shard &shard = shardFor(username);
+        std::lock_guard<std::mutex> lock(shard.insertLock);
+        const Directory* current = shard.directory.load();
+        auto it = current->find(username);
+        if (it != current->end()) return *it->second;
+
+        shard.owned.emplace_back(new UserTasks(shard.arena, StringInterner::instance().intern(username)));
+        UserTasks* created = shard.owned.back().get();
+        Directory* next = new Directory(*current);
+        (*next)[username] = created;
+        shard.directory.publish(next);
+        return *created;
+    }
+
+    // Temporary lists that are never served skip building the query
+    // indexes. Strings shared between tasks sit at one heap offset in the
+    // snapshot, so each is interned once per user.
+    TaskList* readSnapshotLocked(const UserTasks &user, bool indexed = true) const {
+        const SnapshotUser &base = *user.base.load();
+        const TaskSnapshot &snap = *user.baseSnapshot;
+        StringInterner &strings = StringInterner::instance();
+        std::unordered_map<uint32_t, uint32_t> ids;
+        std::unordered_map<uint32_t, int32_t> deadlines;
+        auto idAt = [&](uint32_t offset) {
+            auto it = ids.find(offset);
+            if (it == ids.end()) it = ids.emplace(offset, strings.intern(snap.string(offset))).first;
+            return it->second;
+        };
+
+        TaskList* list = new TaskList();
+        list->tasks.reserve(base.taskCount);
+        const SnapshotTask* records = snap.tasksOf(base);
+        std::lock_guard<std::mutex> lock(user.arena->lock);
+        for (uint64_t i = 0; i < base.taskCount; i++) {
+            const SnapshotTask &r = records[i];
+            auto deadline = deadlines.find(r.deadline);
+            if (deadline == deadlines.end()) {
+                deadline = deadlines.emplace(r.deadline, deadlineCode(snap.string(r.deadline))).first;
+            }
+            StoredTask fields;
+            fields.id = r.id;
+            fields.user = user.name;
+            fields.category = idAt(r.category);
+            fields.priority = idAt(r.priority);
+            fields.deadline = deadline->second;
+            fields.nameLength = 0;
+            fields.completed = r.completed != 0;
+            list->tasks.push_back(user.arena->createLocked(fields, snap.string(r.name)));
+        }
+        list->index.adopt(snap.indexOf(base), base.indexCapacity, base.taskCount);
+        if (indexed) {
+            list->query.rebuild(list->tasks);
+            list->stats.rebuild(list->tasks);
+        }
+        return list;
+    }
+
+    // Copies a user out of the mapped snapshot. Caller holds the write lock.
+    // The counts taken from the snapshot go first, so a reader that still
+    // finds them also finds the list they describe (see stats()).
+    void materializeLocked(UserTasks &user) const {
+        if (!user.base.load()) return;
+        user.baseStats.publish(nullptr);
+        user.list.publish(readSnapshotLocked(user));
+        user.base.store(nullptr, std::memory_order_release);
+        user.baseSnapshot.reset();
+    }
+
+    static void recordChange(TaskList &list, long long id) {
+        list.version++;
+        list.changes.record(list.version, id);
+    }
+
+    static void retireTask(const UserTasks &user, const StoredTask* task) {
+        std::shared_ptr<TaskArena> arena = user.arena;
+        EpochDomain::instance().retire([arena, task]() { arena->destroy(task); });
+    }
+
+    Shard shards[SHARDS];
+    std::atomic<size_t> count{0};
+    TaskJournal* journal = nullptr;
+};
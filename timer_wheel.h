@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// A timer as the wheel links it. Embedded in whatever it times out, so
+// arming one allocates nothing; `owner` leads back from the node.
+struct TimerNode {
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    uint64_t expires = 0;       // tick
+    void* owner = nullptr;
+
+    bool armed() const { return next != nullptr; }
+};
+
+// Hierarchical timing wheel: LEVELS wheels of SLOTS slots, each slot a list
+// of the timers due in its span. Level 0 holds timers due within SLOTS
+// ticks, one tick per slot; each further level covers SLOTS times the span
+// of the one below and is cascaded into it when the lower wheel comes round.
+// Timers further out than the top level reaches wait in its furthest slot
+// and are placed again when that slot cascades.
+//
+// Scheduling and cancelling unlink and link one node, whatever the number of
+// timers. Advancing visits only ticks where some slot is occupied, found
+// from a bitmap per level, so a sparse wheel can jump far ahead cheaply.
+// Ticks are whatever unit the owner chooses. Not thread-safe.
+class TimerWheel {
+public:
+    static const int LEVEL_BITS = 6;
+    static const size_t SLOTS = 1 << LEVEL_BITS;
+    static const int LEVELS = 4;
+    static const uint64_t NEVER = UINT64_MAX;
+
+    explicit TimerWheel(uint64_t now = 0) : current(now) {
+        for (int l = 0; l < LEVELS; l++) {
+            for (size_t s = 0; s < SLOTS; s++) {
+                slots[l][s].prev = slots[l][s].next = &slots[l][s];
+            }
+        }
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // Arms `node` for tick `expires`, moving it if it was already armed. A
+    // tick that has passed fires on the next advance.
+    void schedule(TimerNode &node, uint64_t expires) {
+        if (node.armed()) unlink(node);
+        else count++;
+        node.expires = expires;
+        place(node);
+    }
+
+    void cancel(TimerNode &node) {
+        if (!node.armed()) return;
+        unlink(node);
+        count--;
+    }
+
+    // Fires every timer due at or before `now`, in tick order, calling
+    // fire(TimerNode&) with the node already disarmed. The callback may
+    // schedule or cancel any timer, including the one it was given.
+    template <typename F>
+    void advance(uint64_t now, F fire) {
+        while (true) {
+            uint64_t tick = nextTick();
+            if (tick > now) break;
+            current = tick;
+            for (int l = LEVELS - 1; l > 0; l--) {
+                if (current & (((uint64_t)1 << (LEVEL_BITS * l)) - 1)) continue;
+                cascade(l, (size_t)(current >> (LEVEL_BITS * l)) & (SLOTS - 1));
+            }
+            TimerNode due;
+            take(0, (size_t)current & (SLOTS - 1), due);
+            // Timers the callbacks arm for this tick or earlier go to the next.
+            current++;
+            while (due.next != &due) {
+                TimerNode &node = *due.next;
+                unlink(node);
+                count--;
+                fire(node);
+            }
+        }
+        if (now >= current) current = now + 1;
+    }
+
+    // The first tick at which advance may have work: a timer's expiry, or
+    // earlier when a higher level still has to cascade. NEVER when empty.
+    uint64_t nextTick() const {
+        if (count == 0) return NEVER;
+        uint64_t best = NEVER;
+        for (int l = 0; l < LEVELS; l++) {
+            if (!occupied[l]) continue;
+            int shift = LEVEL_BITS * l;
+            uint64_t start = current >> shift;
+            if (current & (((uint64_t)1 << shift) - 1)) start++;
+            unsigned offset = (unsigned)(start & (SLOTS - 1));
+            uint64_t rotated = offset ? (occupied[l] >> offset) | (occupied[l] << (SLOTS - offset)) : occupied[l];
+            uint64_t tick = (start + (uint64_t)__builtin_ctzll(rotated)) << shift;
+            if (tick < best) best = tick;
+        }
+        return best;
+    }
+
+    size_t size() const { return count; }
+    uint64_t now() const { return current; }
+
+private:
+    void place(TimerNode &node) {
+        uint64_t expires = node.expires < current ? current : node.expires;
+        uint64_t delta = expires - current;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= ((uint64_t)1 << (LEVEL_BITS * (level + 1)))) level++;
+        if (delta >= ((uint64_t)1 << (LEVEL_BITS * LEVELS))) {
+            expires = current + ((uint64_t)1 << (LEVEL_BITS * LEVELS)) - 1;
+        }
+        size_t slot = (size_t)(expires >> (LEVEL_BITS * level)) & (SLOTS - 1);
+        TimerNode &head = slots[level][slot];
+        node.prev = head.prev;
+        node.next = &head;
+        head.prev->next = &node;
+        head.prev = &node;
+        occupied[level] |= (uint64_t)1 << slot;
+    }
+
+    static void unlink(TimerNode &node) {
+        node.prev->next = node.next;
+        node.next->prev = node.prev;
+        node.prev = node.next = nullptr;
+    }
+
+    // Moves the slot's list onto `into`, an empty sentinel.
+    void take(int level, size_t slot, TimerNode &into) {
+        TimerNode &head = slots[level][slot];
+        occupied[level] &= ~((uint64_t)1 << slot);
+        if (head.next == &head) {
+            into.prev = into.next = &into;
+            return;
+        }
+        into.next = head.next;
+        into.prev = head.prev;
+        into.next->prev = &into;
+        into.prev->next = &into;
+        head.prev = head.next = &head;
+    }
+
+    void cascade(int level, size_t slot) {
+        TimerNode moving;
+        take(level, slot, moving);
+        while (moving.next != &moving) {
+            TimerNode &node = *moving.next;
+            unlink(node);
+            place(node);
+        }
+    }
+
+    TimerNode slots[LEVELS][SLOTS];
+    uint64_t occupied[LEVELS] = {};
+    uint64_t current;           // the next tick to process
+    size_t count = 0;
+};
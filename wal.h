@@ -0,0 +1,300 @@
+#pragma once
+
+#include "platform.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class SyncPolicy {
+    Always,     // every commit waits for fdatasync; concurrent commits share one
+    Interval,   // a background flush syncs every intervalMs; commits never wait
+    None        // data is handed to the OS but never explicitly synced
+};
+
+inline bool parseSyncPolicy(const std::string &name, SyncPolicy &policy) {
+    if (name == "always") policy = SyncPolicy::Always;
+    else if (name == "interval") policy = SyncPolicy::Interval;
+    else if (name == "none") policy = SyncPolicy::None;
+    else return false;
+    return true;
+}
+
+// Append-only log of newline-terminated records, split into numbered
+// segment files (<baseName>.000001, ...). Appends only copy into a pending
+// buffer; a flusher thread writes the buffer out and syncs it, so every
+// commit that arrived while the previous sync was running is made durable
+// by the next single fdatasync.
+//
+// Compaction seals the current segment, writes a snapshot elsewhere, and
+// then drops the sealed segments. Records must therefore be idempotent:
+// replaying a segment over a snapshot that already contains its effects
+// has to give the same result.
+class WriteAheadLog {
+public:
+    WriteAheadLog(const std::string &baseName, SyncPolicy policy, int intervalMs)
+        : baseName(baseName), policy(policy), intervalMs(intervalMs), instance(nextInstance()) {}
+
+    ~WriteAheadLog() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        pendingCv.notify_all();
+        if (flusher.joinable()) flusher.join();
+        if (fd >= 0) closeFile(fd);
+    }
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Feeds every complete record of every existing segment, oldest first,
+    // to apply. A torn record at the end of the last segment is skipped.
+    size_t replay(const std::function<void(const std::string&)> &apply) const {
+        return replay(baseName, apply);
+    }
+
+    // The same for a log that is not open here, such as one being migrated.
+    static size_t replay(const std::string &baseName, const std::function<void(const std::string&)> &apply) {
+        size_t records = 0;
+        for (uint64_t segment : existingSegments(baseName)) {
+            std::ifstream file(segmentPath(baseName, segment), std::ios::binary);
+            std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            size_t pos = 0;
+            size_t end;
+            while ((end = content.find('\n', pos)) != std::string::npos) {
+                if (end > pos) {
+                    apply(content.substr(pos, end - pos));
+                    records++;
+                }
+                pos = end + 1;
+            }
+        }
+        return records;
+    }
+
+    // Opens a fresh segment after the existing ones and starts the flusher.
+    bool open() {
+        std::vector<uint64_t> segments = existingSegments(baseName);
+        segment = segments.empty() ? 1 : segments.back() + 1;
+        fd = openFileForAppend(segmentPath(baseName, segment).c_str());
+        if (fd < 0 || !syncSegmentEntry()) return false;
+        flusher = std::thread([this]() { flushLoop(); });
+        return true;
+    }
+
+    // Queues one record (without the trailing newline). Callers that need a
+    // particular order between records must serialize their appends.
+    void append(const std::string &record) {
+        uint64_t ticket;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending += record;
+            pending += '\n';
+            ticket = ++appended;
+        }
+        lastTicket() = ticket;
+        pendingCv.notify_one();
+    }
+
+    // Under SyncPolicy::Always, blocks until every record this thread has
+    // appended is on disk. Under the other policies it returns immediately.
+    // False once a write or sync of this log has failed: records appended
+    // since may never reach the disk.
+    bool commit() {
+        return commit(lastTicket());
+    }
+
+    // The same for the records up to `ticket`, from lastAppended() on the
+    // thread that appended them, so the wait can happen on another thread.
+    bool commit(uint64_t ticket) {
+        if (policy != SyncPolicy::Always) return !failed.load();
+        uint64_t start = monotonicMicros();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            durableCv.wait(lock, [&]() { return durable >= ticket || failed; });
+        }
+        commitWait.record(monotonicMicros() - start);
+        return !failed.load();
+    }
+
+    // The ticket of the last record this thread appended.
+    uint64_t lastAppended() {
+        return lastTicket();
+    }
+
+    // True if commit() waits for an fdatasync.
+    bool syncsOnCommit() const { return policy == SyncPolicy::Always; }
+
+    // Flushes and closes the current segment, continues in a new one, and
+    // returns the number of the sealed segment.
+    uint64_t seal() {
+        std::lock_guard<std::mutex> io(ioMutex);
+        std::string batch;
+        uint64_t batchEnd;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batch.swap(pending);
+            batchEnd = appended;
+        }
+        writeBatch(batch, true);
+        closeFile(fd);
+        uint64_t sealed = segment++;
+        fd = openFileForAppend(segmentPath(baseName, segment).c_str());
+        segmentBytes.store(0);
+        markDurable(batchEnd, fd < 0 || !syncSegmentEntry());
+        return sealed;
+    }
+
+    // Deletes every segment up to and including `through`.
+    void dropThrough(uint64_t through) {
+        dropThrough(baseName, through);
+    }
+
+    static void dropThrough(const std::string &baseName, uint64_t through) {
+        for (uint64_t s : existingSegments(baseName)) {
+            if (s <= through) std::remove(segmentPath(baseName, s).c_str());
+        }
+    }
+
+    size_t bytesSinceSeal() const { return segmentBytes.load(); }
+    uint64_t syncCount() const { return syncs.load(); }
+    uint64_t bytesWritten() const { return written.load(std::memory_order_relaxed); }
+
+    // How long each fdatasync took, and how long commit() callers waited
+    // for their records to become durable.
+    const LatencyHistogram &syncLatency() const { return syncTimes; }
+    const LatencyHistogram &commitLatency() const { return commitWait; }
+
+private:
+    void flushLoop() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (policy == SyncPolicy::Interval) {
+                    pendingCv.wait_for(lock, std::chrono::milliseconds(intervalMs), [&]() { return stopping; });
+                } else {
+                    pendingCv.wait(lock, [&]() { return stopping || !pending.empty(); });
+                }
+                if (stopping && pending.empty()) return;
+            }
+
+            std::lock_guard<std::mutex> io(ioMutex);
+            std::string batch;
+            uint64_t batchEnd;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                batch.swap(pending);
+                batchEnd = appended;
+            }
+            if (batch.empty()) continue;
+            bool ok = writeBatch(batch, policy != SyncPolicy::None);
+            markDurable(batchEnd, !ok);
+        }
+    }
+
+    bool writeBatch(const std::string &batch, bool sync) {
+        if (fd < 0) return false;
+        if (!batch.empty() && !writeFully(fd, batch.data(), batch.size())) return false;
+        segmentBytes.fetch_add(batch.size());
+        written.fetch_add(batch.size(), std::memory_order_relaxed);
+        if (sync) {
+            uint64_t start = monotonicMicros();
+            if (!syncFile(fd)) return false;
+            syncTimes.record(monotonicMicros() - start);
+            syncs.fetch_add(1);
+        }
+        return true;
+    }
+
+    void markDurable(uint64_t upTo, bool error) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (upTo > durable) durable = upTo;
+            if (error) failed = true;
+        }
+        durableCv.notify_all();
+        if (error) fprintf(stderr, "Write-ahead log %s: write failed\n", baseName.c_str());
+    }
+
+    // A synced record is only durable once the segment's directory entry is.
+    bool syncSegmentEntry() const {
+        if (policy == SyncPolicy::None) return true;
+        return syncDirectory(directoryOf(baseName).string().c_str());
+    }
+
+    static std::filesystem::path directoryOf(const std::string &baseName) {
+        std::filesystem::path base(baseName);
+        return base.has_parent_path() ? base.parent_path() : std::filesystem::path(".");
+    }
+
+    static std::string segmentPath(const std::string &baseName, uint64_t n) {
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".%06llu", (unsigned long long)n);
+        return baseName + suffix;
+    }
+
+    static std::vector<uint64_t> existingSegments(const std::string &baseName) {
+        std::vector<uint64_t> segments;
+        std::filesystem::path dir = directoryOf(baseName);
+        std::string prefix = std::filesystem::path(baseName).filename().string() + ".";
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+            std::string name = entry.path().filename().string();
+            if (name.compare(0, prefix.size(), prefix) != 0) continue;
+            std::string digits = name.substr(prefix.size());
+            if (digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos) continue;
+            segments.push_back(std::stoull(digits));
+        }
+        std::sort(segments.begin(), segments.end());
+        return segments;
+    }
+
+    static int nextInstance() {
+        static std::atomic<int> counter{0};
+        return counter.fetch_add(1) % MAX_INSTANCES;
+    }
+
+    uint64_t &lastTicket() {
+        thread_local uint64_t tickets[MAX_INSTANCES] = {};
+        return tickets[instance];
+    }
+
+    static const int MAX_INSTANCES = 128;
+
+    std::string baseName;
+    SyncPolicy policy;
+    int intervalMs;
+    int instance;
+
+    std::mutex mutex;       // pending, appended, durable, stopping
+    std::mutex ioMutex;     // the segment file; always taken before `mutex`
+    std::condition_variable pendingCv;
+    std::condition_variable durableCv;
+    std::string pending;
+    uint64_t appended = 0;
+    uint64_t durable = 0;
+    bool stopping = false;
+    std::atomic<bool> failed{false};    // set under `mutex`, read without it
+
+    int fd = -1;
+    uint64_t segment = 0;
+    std::atomic<size_t> segmentBytes{0};
+    std::atomic<uint64_t> syncs{0};
+    std::atomic<uint64_t> written{0};
+    LatencyHistogram syncTimes;
+    LatencyHistogram commitWait;
+    std::thread flusher;
+};
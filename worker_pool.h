@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads for CPU-heavy work that must not run on an event
+// loop, such as password hashing. The queue is bounded: when it is full,
+// trySubmit() refuses the job and the caller answers 503 instead of letting
+// latency grow without limit.
+class WorkerPool {
+public:
+    WorkerPool(unsigned threads, size_t maxQueued) : maxQueued(maxQueued) {
+        if (threads == 0) threads = 1;
+        for (unsigned i = 0; i < threads; i++) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(queueLock);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (std::thread &t : workers) t.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    bool trySubmit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(queueLock);
+            if (stopping || queue.size() >= maxQueued) return false;
+            queue.push_back(std::move(job));
+        }
+        ready.notify_one();
+        return true;
+    }
+
+private:
+    void work() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(queueLock);
+                ready.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+            job();
+        }
+    }
+
+    size_t maxQueued;
+    std::mutex queueLock;
+    std::condition_variable ready;
+    std::deque<std::function<void()>> queue;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};